@@ -0,0 +1,7 @@
+(defun ackermann (m n)
+    (cond
+        (eq m 0) (+ n 1)
+        (eq n 0) (ackermann (- m 1) 1)
+        (ackermann (- m 1) (ackermann m (- n 1)))))
+(print (ackermann 2 500))
+(print (ackermann 3 6))
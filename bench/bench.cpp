@@ -0,0 +1,295 @@
+// Benchmark runner for `make bench`: runs the interpreter on each benchmark, reports wall time,
+// instructions, peak RSS and allocation counts as JSON and compares them against a baseline.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const char* USAGE = "Expected [--runs <n>] [--threshold <percent>] [--baseline <file>] [--output <file>] [--vm] <interpreter> <benchmark>...";
+
+struct Result {
+    std::string name;
+    double wall_ms = 0;
+    std::optional<uint64_t> instructions;
+    uint64_t peak_rss_kb = 0;
+    uint64_t allocations = 0;
+    uint64_t arena_nodes = 0;
+};
+
+void panic(const char* msg) {
+    std::cerr << "[Panic]: " << msg << std::endl;
+    std::exit(1);
+}
+
+static std::string benchmark_name(const std::string& path) {
+    auto name = path.substr(path.find_last_of('/') + 1);
+    return name.substr(0, name.find('.'));
+}
+
+// counts the child's instructions from `exec` on, unavailable without perf permissions
+static int open_instruction_counter(pid_t pid) {
+    perf_event_attr attr = {};
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
+}
+
+static uint64_t parse_stat(const std::string& stats, const char* label) {
+    auto position = stats.find(label);
+    if(position == std::string::npos)
+        return 0;
+    return std::strtoull(stats.c_str() + position + strlen(label), nullptr, 10);
+}
+
+static Result run(const std::vector<const char*>& command, const std::string& path) {
+    int start[2], errors[2];
+    if(pipe(start) < 0 || pipe(errors) < 0)
+        panic(strerror(errno));
+
+    pid_t pid = fork();
+    if(pid < 0)
+        panic(strerror(errno));
+
+    if(pid == 0) {
+        // wait until the parent attached the counter, then run with stdout discarded
+        char go;
+        close(start[1]);
+        if(read(start[0], &go, 1) != 1)
+            _exit(127);
+
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(errors[1], STDERR_FILENO);
+        close(errors[0]);
+
+        auto argv = command;
+        argv.push_back(path.c_str());
+        argv.push_back(nullptr);
+        execv(argv[0], const_cast<char* const*>(argv.data()));
+        _exit(127);
+    }
+
+    close(start[0]);
+    close(errors[1]);
+    int counter = open_instruction_counter(pid);
+
+    auto begin = std::chrono::steady_clock::now();
+    if(write(start[1], "x", 1) != 1)
+        panic(strerror(errno));
+    close(start[1]);
+
+    std::string stats;
+    char buffer[4096];
+    ssize_t size;
+    while((size = read(errors[0], buffer, sizeof(buffer))) > 0)
+        stats.append(buffer, size);
+    close(errors[0]);
+
+    int status;
+    struct rusage usage;
+    if(wait4(pid, &status, 0, &usage) < 0)
+        panic(strerror(errno));
+    auto end = std::chrono::steady_clock::now();
+
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::cerr << stats;
+        panic(("benchmark `" + path + "` failed").c_str());
+    }
+
+    Result result;
+    result.name = benchmark_name(path);
+    result.wall_ms = std::chrono::duration<double, std::milli>(end - begin).count();
+    result.peak_rss_kb = usage.ru_maxrss;
+    result.allocations = parse_stat(stats, "[GC]: allocated:");
+    result.arena_nodes = parse_stat(stats, "[Arena]: nodes:");
+
+    if(counter >= 0) {
+        uint64_t instructions;
+        if(read(counter, &instructions, sizeof(instructions)) == sizeof(instructions))
+            result.instructions = instructions;
+        close(counter);
+    }
+    return result;
+}
+
+static void write_json(std::ostream& stream, const std::vector<Result>& results, const char* interpreter, bool vm) {
+    stream << "{" << std::endl
+           << "  \"interpreter\": \"" << interpreter << "\"," << std::endl
+           << "  \"mode\": \"" << (vm ? "vm" : "tree") << "\"," << std::endl
+           << "  \"benchmarks\": [" << std::endl;
+    for(size_t i = 0; i < results.size(); i++) {
+        auto& result = results[i];
+        stream << "    {\"name\": \"" << result.name << "\""
+               << ", \"wall_ms\": " << result.wall_ms
+               << ", \"instructions\": ";
+        if(result.instructions)
+            stream << result.instructions.value();
+        else
+            stream << "null";
+        stream << ", \"peak_rss_kb\": " << result.peak_rss_kb
+               << ", \"allocations\": " << result.allocations
+               << ", \"arena_nodes\": " << result.arena_nodes << "}"
+               << (i + 1 < results.size() ? "," : "") << std::endl;
+    }
+    stream << "  ]" << std::endl
+           << "}" << std::endl;
+}
+
+// reads back the flat benchmark objects written by `write_json`
+static std::vector<Result> read_json(std::istream& stream) {
+    std::stringstream buffer;
+    buffer << stream.rdbuf();
+    auto text = buffer.str();
+
+    auto field = [](const std::string& object, const char* key) -> std::optional<double> {
+        auto position = object.find(std::string("\"") + key + "\": ");
+        if(position == std::string::npos)
+            return std::nullopt;
+        auto value = object.c_str() + position + strlen(key) + 4;
+        if(strncmp(value, "null", 4) == 0)
+            return std::nullopt;
+        return std::strtod(value, nullptr);
+    };
+
+    std::vector<Result> results;
+    size_t position = text.find("\"benchmarks\"");
+    while(position != std::string::npos && (position = text.find('{', position)) != std::string::npos) {
+        auto end = text.find('}', position);
+        if(end == std::string::npos)
+            break;
+        auto object = text.substr(position, end - position);
+        position = end;
+
+        auto name = object.find("\"name\": \"");
+        if(name == std::string::npos)
+            continue;
+        name += 9;
+
+        Result result;
+        result.name = object.substr(name, object.find('"', name) - name);
+        result.wall_ms = field(object, "wall_ms").value_or(0);
+        if(auto instructions = field(object, "instructions"))
+            result.instructions = instructions.value();
+        result.peak_rss_kb = field(object, "peak_rss_kb").value_or(0);
+        result.allocations = field(object, "allocations").value_or(0);
+        result.arena_nodes = field(object, "arena_nodes").value_or(0);
+        results.push_back(result);
+    }
+    return results;
+}
+
+// prints every metric that grew by more than `threshold` percent, returns whether any did
+static bool compare(const std::vector<Result>& results, const std::vector<Result>& baseline, double threshold) {
+    bool regressed = false;
+    auto check = [&](const std::string& name, const char* metric, double before, double after) {
+        if(before <= 0)
+            return;
+        double change = (after - before) / before * 100;
+        bool regression = change > threshold;
+        regressed |= regression;
+        std::cerr << "[Bench]: " << (regression ? "REGRESSION " : "           ") << name << " " << metric << ": "
+                  << before << " -> " << after << " (" << (change >= 0 ? "+" : "") << change << "%)" << std::endl;
+    };
+
+    for(auto& result : results) {
+        auto before = std::find_if(baseline.begin(), baseline.end(), [&](auto& b) { return b.name == result.name; });
+        if(before == baseline.end()) {
+            std::cerr << "[Bench]: " << result.name << " is not in the baseline" << std::endl;
+            continue;
+        }
+
+        check(result.name, "wall_ms", before->wall_ms, result.wall_ms);
+        if(before->instructions && result.instructions)
+            check(result.name, "instructions", before->instructions.value(), result.instructions.value());
+        check(result.name, "peak_rss_kb", before->peak_rss_kb, result.peak_rss_kb);
+        check(result.name, "allocations", before->allocations, result.allocations);
+    }
+    return regressed;
+}
+
+int main(int argc, char* argv[]) {
+    int runs = 3;
+    double threshold = 10;
+    const char* baseline = nullptr;
+    const char* output = nullptr;
+    bool vm = false;
+    const char* interpreter = nullptr;
+    std::vector<std::string> benchmarks;
+
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+            runs = std::max(1, atoi(argv[++i]));
+        else if(strcmp(argv[i], "--threshold") == 0 && i + 1 < argc)
+            threshold = std::strtod(argv[++i], nullptr);
+        else if(strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+            baseline = argv[++i];
+        else if(strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            output = argv[++i];
+        else if(strcmp(argv[i], "--vm") == 0)
+            vm = true;
+        else if(!interpreter)
+            interpreter = argv[i];
+        else
+            benchmarks.push_back(argv[i]);
+    }
+
+    if(!interpreter || benchmarks.empty())
+        panic(USAGE);
+
+    // parsing is part of what's measured, so the benchmarks are never loaded from a cache
+    std::vector<const char*> command = {interpreter, "--gc-stats", "--no-cache"};
+    if(vm)
+        command.push_back("--vm");
+
+    // the fastest run is the least disturbed by the rest of the system
+    std::vector<Result> results;
+    for(auto& path : benchmarks) {
+        Result best;
+        for(int i = 0; i < runs; i++) {
+            auto result = run(command, path);
+            if(i == 0 || result.wall_ms < best.wall_ms)
+                best = result;
+        }
+        results.push_back(best);
+    }
+
+    write_json(std::cout, results, interpreter, vm);
+    if(output) {
+        std::ofstream file(output);
+        if(file.fail())
+            panic(strerror(errno));
+        write_json(file, results, interpreter, vm);
+    }
+
+    if(baseline) {
+        std::ifstream file(baseline);
+        if(file.fail()) {
+            std::cerr << "[Bench]: no baseline at " << baseline << ", run `make bench-baseline` to store one" << std::endl;
+            return 0;
+        }
+        if(compare(results, read_json(file), threshold))
+            return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,28 @@
+(defun classify (n)
+    (cond
+        (< n 10) 0
+        (< n 20) 1
+        (< n 30) 2
+        (< n 40) 3
+        (< n 50) 4
+        (< n 60) 5
+        (< n 70) 6
+        (< n 80) 7
+        (< n 90) 8
+        (< n 100) 9
+        (< n 110) 10
+        (< n 120) 11
+        (< n 130) 12
+        (< n 140) 13
+        (< n 150) 14
+        (< n 160) 15
+        (< n 170) 16
+        (< n 180) 17
+        (< n 190) 18
+        (< n 200) 19
+        20))
+(defun run (n acc)
+    (if (eq n 0)
+        acc
+        (run (- n 1) (+ acc (classify (- n (* (/ n 210) 210)))))))
+(print (run 500000 0))
@@ -0,0 +1,5 @@
+(defun loop (n acc)
+    (if (eq n 0)
+        acc
+        (loop (- n 1) (+ acc (* 3 (- n (/ n 7)))))))
+(print (loop 3000000 0))
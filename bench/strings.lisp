@@ -0,0 +1,6 @@
+(defun lines (n)
+    (if (eq n 0)
+        nil
+        ((print "The quick brown fox jumps over the lazy dog" n 'symbol "another string")
+         (lines (- n 1)))))
+(lines 200000)
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <memory_resource>
+#include <ostream>
+#include <vector>
+
+#include "value.hpp"
+
+namespace lisp {
+    // Bump allocator for the parsed program. AST nodes and their child arrays live as long as
+    // the context and are released in one shot when it is destroyed.
+    //
+    // The garbage collector traces through arena values, since they can reference heap values,
+    // but never frees them.
+    class Arena {
+    public:
+        static constexpr size_t BLOCK_SIZE = 64 << 10;
+
+        Arena() : m_Resource(BLOCK_SIZE) {}
+        Arena(const Arena&) = delete;
+        ~Arena() {
+            for(auto value : m_Values)
+                value->~Value();
+        }
+
+        template<typename T, typename... Args>
+        T* alloc(Args&&... args) {
+            auto value = new(m_Resource.allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+            value->m_InArena = true;
+            m_Values.push_back(value);
+            m_Bytes += sizeof(T);
+            return value;
+        }
+
+        // memory resource for the child arrays of arena values
+        std::pmr::memory_resource* resource() { return &m_Resource; }
+
+        size_t get_bytes() const { return m_Bytes; }
+
+        std::ostream& print_stats(std::ostream& stream) const {
+            return stream << "[Arena]: nodes:           " << m_Values.size() << " objects, " << m_Bytes << " bytes" << std::endl;
+        }
+
+    private:
+        std::pmr::monotonic_buffer_resource m_Resource;
+        std::vector<Value*> m_Values;
+        size_t m_Bytes = 0;
+    };
+}
@@ -0,0 +1,399 @@
+#include <algorithm>
+#include <deque>
+
+#include "bignum.hpp"
+
+namespace lisp {
+    using Limbs = BigInt::Limbs;
+
+    // limb bases, binary for the integers themselves and decimal for converting them from and to text.
+    // the helpers below work on both, products of two limbs plus two carries always fit into 64 bits
+    static constexpr uint64_t BINARY = uint64_t(1) << 32;
+    static constexpr uint64_t DECIMAL = 1000000000;
+    static constexpr size_t DECIMAL_DIGITS = 9;
+
+    // the smaller operand needs this many limbs before Karatsuba beats schoolbook multiplication
+    static constexpr size_t KARATSUBA_THRESHOLD = 32;
+    // numbers with up to this many limbs are converted from and to text limb by limb
+    static constexpr size_t CONVERSION_THRESHOLD = 32;
+
+    static void trim(Limbs& limbs) {
+        while(!limbs.empty() && limbs.back() == 0)
+            limbs.pop_back();
+    }
+
+    static size_t length(const uint32_t* a, size_t size) {
+        while(size > 0 && a[size - 1] == 0)
+            size--;
+        return size;
+    }
+
+    static int compare_magnitude(const Limbs& a, const Limbs& b) {
+        if(a.size() != b.size())
+            return a.size() < b.size() ? -1 : 1;
+        for(size_t i = a.size(); i-- > 0;) {
+            if(a[i] != b[i])
+                return a[i] < b[i] ? -1 : 1;
+        }
+        return 0;
+    }
+
+    // r += a * Base^offset, the sum has to fit into the `size` limbs of `r`
+    template<uint64_t Base>
+    static void add_into(uint32_t* r, size_t size, const uint32_t* a, size_t a_size, size_t offset) {
+        uint64_t carry = 0;
+        for(size_t i = 0; i < a_size; i++) {
+            uint64_t sum = uint64_t(r[offset + i]) + a[i] + carry;
+            carry = sum >= Base;
+            r[offset + i] = carry ? sum - Base : sum;
+        }
+        for(size_t i = offset + a_size; carry && i < size; i++) {
+            uint64_t sum = uint64_t(r[i]) + carry;
+            carry = sum >= Base;
+            r[i] = carry ? sum - Base : sum;
+        }
+    }
+
+    // r -= a, `r` may not be less than `a`
+    template<uint64_t Base>
+    static void subtract_from(uint32_t* r, size_t size, const uint32_t* a, size_t a_size) {
+        uint64_t borrow = 0;
+        for(size_t i = 0; i < size && (i < a_size || borrow); i++) {
+            uint64_t subtrahend = (i < a_size ? a[i] : 0) + borrow;
+            borrow = r[i] < subtrahend;
+            r[i] = borrow ? Base + r[i] - subtrahend : r[i] - subtrahend;
+        }
+    }
+
+    // r = a * b, `r` holds `a_size + b_size` zeroed limbs
+    template<uint64_t Base>
+    static void multiply_into(uint32_t* r, const uint32_t* a, size_t a_size, const uint32_t* b, size_t b_size) {
+        if(a_size < b_size) {
+            std::swap(a, b);
+            std::swap(a_size, b_size);
+        }
+
+        if(b_size < KARATSUBA_THRESHOLD) {
+            for(size_t i = 0; i < b_size; i++) {
+                uint64_t carry = 0;
+                for(size_t j = 0; j < a_size; j++) {
+                    uint64_t product = uint64_t(b[i]) * a[j] + r[i + j] + carry;
+                    carry = product / Base;
+                    r[i + j] = product % Base;
+                }
+                r[i + a_size] = carry;
+            }
+            return;
+        }
+
+        size_t half = (a_size + 1) / 2;
+        if(b_size <= half) {
+            // unbalanced operands, multiply `b` with slices of `a` of its own size
+            Limbs product(2 * b_size);
+            for(size_t offset = 0; offset < a_size; offset += b_size) {
+                size_t slice = std::min(b_size, a_size - offset);
+                std::fill(product.begin(), product.end(), 0);
+                multiply_into<Base>(product.data(), a + offset, slice, b, b_size);
+                add_into<Base>(r, a_size + b_size, product.data(), slice + b_size, offset);
+            }
+            return;
+        }
+
+        // a = a1 * Base^half + a0 and b = b1 * Base^half + b0, so a * b is
+        // z2 * Base^(2 * half) + ((a0 + a1) * (b0 + b1) - z2 - z0) * Base^half + z0
+        // with z0 = a0 * b0 and z2 = a1 * b1, which go straight into the halves of `r`
+        multiply_into<Base>(r, a, half, b, half);
+        multiply_into<Base>(r + 2 * half, a + half, a_size - half, b + half, b_size - half);
+
+        Limbs a_sum(a, a + half), b_sum(b, b + half);
+        a_sum.push_back(0);
+        b_sum.push_back(0);
+        add_into<Base>(a_sum.data(), a_sum.size(), a + half, a_size - half, 0);
+        add_into<Base>(b_sum.data(), b_sum.size(), b + half, b_size - half, 0);
+
+        Limbs middle(a_sum.size() + b_sum.size());
+        multiply_into<Base>(middle.data(), a_sum.data(), a_sum.size(), b_sum.data(), b_sum.size());
+        subtract_from<Base>(middle.data(), middle.size(), r, 2 * half);
+        subtract_from<Base>(middle.data(), middle.size(), r + 2 * half, a_size + b_size - 2 * half);
+        add_into<Base>(r, a_size + b_size, middle.data(), length(middle.data(), middle.size()), half);
+    }
+
+    template<uint64_t Base>
+    static Limbs multiply(const Limbs& a, const Limbs& b) {
+        if(a.empty() || b.empty())
+            return {};
+        Limbs r(a.size() + b.size());
+        multiply_into<Base>(r.data(), a.data(), a.size(), b.data(), b.size());
+        trim(r);
+        return r;
+    }
+
+    // a <<= shift bits into `size` limbs, for 0 <= shift < 32
+    static Limbs shift_left(const Limbs& a, int shift, size_t size) {
+        Limbs r(size);
+        uint64_t carry = 0;
+        for(size_t i = 0; i < a.size(); i++) {
+            uint64_t shifted = (uint64_t(a[i]) << shift) | carry;
+            r[i] = shifted;
+            carry = shifted >> 32;
+        }
+        if(a.size() < size)
+            r[a.size()] = carry;
+        return r;
+    }
+
+    // a / b for b != 0, schoolbook long division (Knuth's algorithm D)
+    static Limbs divide_magnitude(const Limbs& a, const Limbs& b) {
+        if(compare_magnitude(a, b) < 0)
+            return {};
+
+        Limbs q(a.size() - b.size() + 1);
+        if(b.size() == 1) {
+            uint64_t remainder = 0;
+            for(size_t i = a.size(); i-- > 0;) {
+                uint64_t dividend = (remainder << 32) | a[i];
+                q[i] = dividend / b[0];
+                remainder = dividend % b[0];
+            }
+            trim(q);
+            return q;
+        }
+
+        // normalize the divisor's top bit to be set, so the quotient limb estimates are off by at most 2
+        int shift = __builtin_clz(b.back());
+        auto v = shift_left(b, shift, b.size());
+        auto u = shift_left(a, shift, a.size() + 1);
+        size_t n = v.size();
+
+        for(size_t j = q.size(); j-- > 0;) {
+            uint64_t top = (uint64_t(u[j + n]) << 32) | u[j + n - 1];
+            uint64_t estimate = top / v[n - 1];
+            uint64_t remainder = top % v[n - 1];
+            while(estimate >= BINARY || estimate * v[n - 2] > ((remainder << 32) | u[j + n - 2])) {
+                estimate--;
+                remainder += v[n - 1];
+                if(remainder >= BINARY)
+                    break;
+            }
+
+            // u -= estimate * v * BINARY^j
+            int64_t borrow = 0;
+            uint64_t carry = 0;
+            for(size_t i = 0; i < n; i++) {
+                uint64_t product = estimate * v[i] + carry;
+                carry = product >> 32;
+                int64_t difference = int64_t(u[i + j]) - borrow - int64_t(product & 0xffffffff);
+                u[i + j] = difference;
+                borrow = difference < 0;
+            }
+            int64_t difference = int64_t(u[j + n]) - borrow - int64_t(carry);
+            u[j + n] = difference;
+
+            // the estimate was one too large, add `v` back
+            if(difference < 0) {
+                estimate--;
+                carry = 0;
+                for(size_t i = 0; i < n; i++) {
+                    uint64_t sum = uint64_t(u[i + j]) + v[i] + carry;
+                    u[i + j] = sum;
+                    carry = sum >> 32;
+                }
+                u[j + n] += carry;
+            }
+            q[j] = estimate;
+        }
+        trim(q);
+        return q;
+    }
+
+    // BINARY^(2^i) in decimal limbs and DECIMAL^(2^i) in binary limbs, each squaring the one before.
+    // deques keep the references of returned powers valid while the recursion adds smaller ones
+    static const Limbs& decimal_power(size_t i) {
+        thread_local std::deque<Limbs> powers = {{294967296, 4}};
+        while(powers.size() <= i)
+            powers.push_back(multiply<DECIMAL>(powers.back(), powers.back()));
+        return powers[i];
+    }
+
+    static const Limbs& binary_power(size_t i) {
+        thread_local std::deque<Limbs> powers = {{DECIMAL}};
+        while(powers.size() <= i)
+            powers.push_back(multiply<BINARY>(powers.back(), powers.back()));
+        return powers[i];
+    }
+
+    // binary limbs to decimal limbs, splitting off the low 2^i limbs as high * BINARY^(2^i) + low
+    static Limbs to_decimal(const uint32_t* a, size_t size) {
+        size = length(a, size);
+        if(size <= CONVERSION_THRESHOLD) {
+            Limbs r;
+            for(size_t i = size; i-- > 0;) {
+                uint64_t carry = a[i];
+                for(auto& limb : r) {
+                    uint64_t shifted = uint64_t(limb) * BINARY + carry;
+                    limb = shifted % DECIMAL;
+                    carry = shifted / DECIMAL;
+                }
+                for(; carry; carry /= DECIMAL)
+                    r.push_back(carry % DECIMAL);
+            }
+            return r;
+        }
+
+        size_t i = 0;
+        while((size_t(2) << i) < size)
+            i++;
+        size_t half = size_t(1) << i;
+
+        auto r = multiply<DECIMAL>(to_decimal(a + half, size - half), decimal_power(i));
+        auto low = to_decimal(a, half);
+        r.resize(std::max(r.size(), low.size()) + 1);
+        add_into<DECIMAL>(r.data(), r.size(), low.data(), low.size(), 0);
+        trim(r);
+        return r;
+    }
+
+    // decimal digits to binary limbs, splitting off the low 9 * 2^i digits as high * DECIMAL^(2^i) + low
+    static Limbs from_decimal(std::string_view digits) {
+        if(digits.size() <= CONVERSION_THRESHOLD * DECIMAL_DIGITS) {
+            Limbs r;
+            size_t chunk = digits.size() % DECIMAL_DIGITS;
+            if(chunk == 0)
+                chunk = DECIMAL_DIGITS;
+            for(size_t start = 0; start < digits.size(); start += chunk, chunk = DECIMAL_DIGITS) {
+                uint64_t carry = 0;
+                for(size_t i = start; i < start + chunk; i++)
+                    carry = carry * 10 + (digits[i] - '0');
+                for(auto& limb : r) {
+                    uint64_t product = uint64_t(limb) * DECIMAL + carry;
+                    limb = product;
+                    carry = product >> 32;
+                }
+                if(carry)
+                    r.push_back(carry);
+            }
+            trim(r);
+            return r;
+        }
+
+        size_t i = 0;
+        while((DECIMAL_DIGITS << (i + 1)) < digits.size())
+            i++;
+        size_t split = digits.size() - (DECIMAL_DIGITS << i);
+
+        auto r = multiply<BINARY>(from_decimal(digits.substr(0, split)), binary_power(i));
+        auto low = from_decimal(digits.substr(split));
+        r.resize(std::max(r.size(), low.size()) + 1);
+        add_into<BINARY>(r.data(), r.size(), low.data(), low.size(), 0);
+        trim(r);
+        return r;
+    }
+
+    BigInt::BigInt(int64_t value) : m_Negative(value < 0) {
+        uint64_t magnitude = value < 0 ? -static_cast<uint64_t>(value) : value;
+        for(; magnitude; magnitude >>= 32)
+            m_Limbs.push_back(magnitude);
+    }
+
+    BigInt::BigInt(bool negative, Limbs limbs) : m_Negative(negative), m_Limbs(std::move(limbs)) {
+        trim(m_Limbs);
+        if(m_Limbs.empty())
+            m_Negative = false;
+    }
+
+    BigInt BigInt::parse(std::string_view digits) {
+        return BigInt(false, from_decimal(digits));
+    }
+
+    bool BigInt::fits_int64() const {
+        if(m_Limbs.size() <= 1)
+            return true;
+        if(m_Limbs.size() > 2)
+            return false;
+        uint64_t magnitude = (uint64_t(m_Limbs[1]) << 32) | m_Limbs[0];
+        return magnitude <= uint64_t(INT64_MAX) + m_Negative;
+    }
+
+    int64_t BigInt::to_int64() const {
+        if(!fits_int64())
+            return m_Negative ? INT64_MIN : INT64_MAX;
+
+        uint64_t magnitude = 0;
+        for(size_t i = m_Limbs.size(); i-- > 0;)
+            magnitude = (magnitude << 32) | m_Limbs[i];
+        return m_Negative ? -magnitude : magnitude;
+    }
+
+    double BigInt::to_double() const {
+        double value = 0;
+        for(size_t i = m_Limbs.size(); i-- > 0;)
+            value = value * double(BINARY) + m_Limbs[i];
+        return m_Negative ? -value : value;
+    }
+
+    int BigInt::compare(const BigInt& other) const {
+        if(m_Negative != other.m_Negative)
+            return m_Negative ? -1 : 1;
+        int magnitude = compare_magnitude(m_Limbs, other.m_Limbs);
+        return m_Negative ? -magnitude : magnitude;
+    }
+
+    BigInt BigInt::add(bool a_negative, const Limbs& a, bool b_negative, const Limbs& b) {
+        if(a_negative == b_negative) {
+            Limbs r(a);
+            r.resize(std::max(a.size(), b.size()) + 1);
+            add_into<BINARY>(r.data(), r.size(), b.data(), b.size(), 0);
+            return BigInt(a_negative, std::move(r));
+        }
+
+        // opposite signs subtract the smaller magnitude from the larger one
+        if(compare_magnitude(a, b) < 0)
+            return add(b_negative, b, a_negative, a);
+        Limbs r(a);
+        subtract_from<BINARY>(r.data(), r.size(), b.data(), b.size());
+        return BigInt(a_negative, std::move(r));
+    }
+
+    BigInt BigInt::operator+(const BigInt& other) const {
+        return add(m_Negative, m_Limbs, other.m_Negative, other.m_Limbs);
+    }
+
+    BigInt BigInt::operator-(const BigInt& other) const {
+        return add(m_Negative, m_Limbs, !other.m_Negative, other.m_Limbs);
+    }
+
+    BigInt BigInt::operator*(const BigInt& other) const {
+        return BigInt(m_Negative != other.m_Negative, multiply<BINARY>(m_Limbs, other.m_Limbs));
+    }
+
+    BigInt BigInt::operator/(const BigInt& other) const {
+        return BigInt(m_Negative != other.m_Negative, divide_magnitude(m_Limbs, other.m_Limbs));
+    }
+
+    std::string BigInt::to_string() const {
+        if(is_zero())
+            return "0";
+
+        auto decimal = to_decimal(m_Limbs.data(), m_Limbs.size());
+        std::string text = m_Negative ? "-" : "";
+        text += std::to_string(decimal.back());
+
+        // every lower limb has exactly 9 digits
+        size_t start = text.size();
+        text.resize(start + (decimal.size() - 1) * DECIMAL_DIGITS);
+        for(size_t i = decimal.size() - 1; i-- > 0;) {
+            uint32_t limb = decimal[i];
+            for(size_t digit = DECIMAL_DIGITS; digit-- > 0; limb /= 10)
+                text[start + digit] = '0' + limb % 10;
+            start += DECIMAL_DIGITS;
+        }
+        return text;
+    }
+
+    size_t BigInt::hash() const {
+        size_t hash = m_Negative;
+        for(auto limb : m_Limbs)
+            hash = hash * 1000003 + limb;
+        return hash;
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace lisp {
+    // Arbitrary-precision integer, boxed by numbers that don't fit into a fixnum. The magnitude
+    // is stored in 32-bit limbs, least significant first and without leading zero limbs, so zero
+    // has no limbs and is never negative.
+    class BigInt {
+    public:
+        using Limbs = std::vector<uint32_t>;
+
+        BigInt() {}
+        BigInt(int64_t value);
+
+        // parse a non-empty string of decimal digits
+        static BigInt parse(std::string_view digits);
+
+        bool is_zero() const { return m_Limbs.empty(); }
+        bool is_negative() const { return m_Negative; }
+
+        bool fits_int64() const;
+        // saturates outside the range of `int64_t`
+        int64_t to_int64() const;
+        double to_double() const;
+
+        // negative, zero or positive for less, equal or greater
+        int compare(const BigInt& other) const;
+        bool operator==(const BigInt& other) const {
+            return m_Negative == other.m_Negative && m_Limbs == other.m_Limbs;
+        }
+
+        BigInt operator+(const BigInt& other) const;
+        BigInt operator-(const BigInt& other) const;
+        // Karatsuba multiplication once both operands are large enough
+        BigInt operator*(const BigInt& other) const;
+        // truncates towards zero like `/` on `int64_t`, `other` may not be zero
+        BigInt operator/(const BigInt& other) const;
+
+        // divide-and-conquer conversion, splitting at powers of 2^32 computed in decimal limbs
+        std::string to_string() const;
+        size_t hash() const;
+
+        size_t owned_bytes() const { return m_Limbs.capacity() * sizeof(uint32_t); }
+
+    private:
+        BigInt(bool negative, Limbs limbs);
+
+        static BigInt add(bool a_negative, const Limbs& a, bool b_negative, const Limbs& b);
+
+        bool m_Negative = false;
+        Limbs m_Limbs;
+    };
+}
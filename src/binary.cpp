@@ -0,0 +1,46 @@
+#include <cstdio>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "binary.hpp"
+
+namespace lisp {
+    MappedFile::~MappedFile() {
+        munmap(const_cast<char*>(m_Data), m_Size);
+    }
+
+    std::unique_ptr<MappedFile> MappedFile::open(const std::string& path) {
+        int file = ::open(path.c_str(), O_RDONLY);
+        if(file < 0)
+            return nullptr;
+
+        struct stat info;
+        if(fstat(file, &info) != 0 || info.st_size == 0) {
+            close(file);
+            return nullptr;
+        }
+        void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        close(file);
+        if(mapping == MAP_FAILED)
+            return nullptr;
+        return std::unique_ptr<MappedFile>(new MappedFile(static_cast<const char*>(mapping), info.st_size));
+    }
+
+    bool write_file(const std::string& path, std::string_view data) {
+        auto temporary = path + "." + std::to_string(getpid()) + ".tmp";
+        std::ofstream file(temporary, std::ios::binary);
+        if(!file.write(data.data(), data.size()) || (file.close(), file.fail())) {
+            std::remove(temporary.c_str());
+            return false;
+        }
+        if(std::rename(temporary.c_str(), path.c_str()) != 0) {
+            std::remove(temporary.c_str());
+            return false;
+        }
+        return true;
+    }
+}
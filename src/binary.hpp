@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace lisp {
+    // Helpers for the binary files the interpreter writes, program caches and heap images.
+    // Values are stored in the byte order of the machine writing them.
+
+    // a file mapped read-only, for reading it with `Reader`
+    class MappedFile {
+    public:
+        MappedFile(const MappedFile&) = delete;
+        ~MappedFile();
+
+        // nullptr if the file can't be opened or mapped
+        static std::unique_ptr<MappedFile> open(const std::string& path);
+
+        const char* data() const { return m_Data; }
+        size_t size() const { return m_Size; }
+
+    private:
+        MappedFile(const char* data, size_t size) : m_Data(data), m_Size(size) {}
+
+        const char* m_Data;
+        size_t m_Size;
+    };
+
+    // bounds-checked reads, which stay failed after the first one past the end
+    class Reader {
+    public:
+        Reader(const char* data, size_t size) : m_Data(data), m_End(data + size) {}
+
+        template<typename T>
+        T read() {
+            T value{};
+            if(m_Failed || size_t(m_End - m_Data) < sizeof(T)) {
+                m_Failed = true;
+                return value;
+            }
+            memcpy(&value, m_Data, sizeof(T));
+            m_Data += sizeof(T);
+            return value;
+        }
+
+        std::string_view read_text() {
+            auto size = read<uint32_t>();
+            if(m_Failed || size_t(m_End - m_Data) < size) {
+                m_Failed = true;
+                return {};
+            }
+            std::string_view text(m_Data, size);
+            m_Data += size;
+            return text;
+        }
+
+        size_t remaining() const { return m_End - m_Data; }
+        bool failed() const { return m_Failed; }
+        void fail() { m_Failed = true; }
+
+    private:
+        const char* m_Data;
+        const char* m_End;
+        bool m_Failed = false;
+    };
+
+    class Writer {
+    public:
+        template<typename T>
+        void write(T value) {
+            m_Output.append(reinterpret_cast<const char*>(&value), sizeof(value));
+        }
+
+        void write_text(std::string_view text) {
+            write(uint32_t(text.size()));
+            m_Output += text;
+        }
+
+        std::string& output() { return m_Output; }
+
+    private:
+        std::string m_Output;
+    };
+
+    // replace `path` with `data` through a temporary file, so readers never see a partial one
+    bool write_file(const std::string& path, std::string_view data);
+}
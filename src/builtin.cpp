@@ -1,49 +1,68 @@
 #include "builtin.hpp"
 #include "value.hpp"
+#include "memo.hpp"
+#include "pool.hpp"
+#include "simd.hpp"
+#include "scheduler.hpp"
+#include "port.hpp"
+
+#include <cstring>
+#include <thread>
 
 namespace lisp {
     namespace builtin {
-        std::shared_ptr<Value> print(Context& context, std::vector<std::shared_ptr<Value>>& args) {
+        // the arguments are evaluated before anything is written, since evaluating them may print too
+        Ref print(Context& context, RefList& args) {
+            auto& stack = context.get_stack();
+            size_t base = stack.size();
             for(uint64_t i = 1; i < args.size(); i++)
-                args[i]->eval(context)->print(std::cout) << ' ';
-            std::cout << std::endl;
+                context.push(args[i].eval(context));
+
+            print_line(stack.data() + base, stack.size() - base);
+            stack.resize(base);
             return context.get_const_val(ConstValue::Kind::Nil);
         }
 
-        std::shared_ptr<Value> setq(Context& context, std::vector<std::shared_ptr<Value>>& args) {
+        Ref setq(Context& context, RefList& args) {
             if(args.size() != 3)
                 return ERROR("expect 2 arguments for `setq`");
             auto first = args[1];
-            if(first->kind() != ValueKind::Ident)
+            if(first.kind() == ValueKind::Local) {
+                auto& local = dynamic_cast<LocalValue&>(*first);
+                auto second = args[2].eval(context);
+                context.get_local(local.get_depth(), local.get_slot()) = second;
+                return context.get_const_val(ConstValue::Kind::Nil);
+            }
+            if(first.kind() != ValueKind::Ident)
                 return ERROR("expect first `setq` argument to be an identifier");
 
             auto ident = dynamic_cast<IdentValue&>(*first);
             
-            auto second = args[2]->eval(context);
+            auto second = args[2].eval(context);
             context.add_symbol(ident.get_name(), second);
 
             return context.get_const_val(ConstValue::Kind::Nil);
         }
 
-        std::shared_ptr<Value> defun(Context& context, std::vector<std::shared_ptr<Value>>& args) {
+        Ref defun(Context& context, RefList& args) {
             if(args.size() != 4)
                 return ERROR("expect 4 arguments for `defun`");
             
             auto first = args[1];
-            if(first->kind() != ValueKind::Ident)
+            if(first.kind() != ValueKind::Ident)
                 return ERROR("expect first `defun` argument to be an identifier");
             
             auto ident = dynamic_cast<IdentValue&>(*first);
 
             auto second = args[2];
-            if(second->kind() != ValueKind::Compound)
+            if(second.kind() != ValueKind::Compound)
                 return ERROR("expect second `defun` argument to be a compound");
 
             std::vector<std::string> argument_names;
             
-            auto argument_list = dynamic_cast<CompoundValue&>(*second);
+            auto& argument_list = dynamic_cast<CompoundValue&>(*second);
             for(auto& argument : argument_list.get_contents()) {
-                if(argument->kind() != ValueKind::Ident)
+                if(argument.kind() != ValueKind::Ident)
                     return ERROR("expect arguments to be identifiers");
                 
                 argument_names.push_back((dynamic_cast<IdentValue&>(*argument)).get_name());
@@ -51,190 +70,1162 @@ namespace lisp {
 
             auto body = args[3];
 
-            context.add_symbol(ident.get_name(), std::make_shared<FunctionValue>(ident.get_name(), argument_names, body));
+            context.add_symbol(ident.get_name(), context.alloc<FunctionValue>(ident.get_name(), argument_names, body));
             
             return context.get_const_val(ConstValue::Kind::Nil);
         }
 
-        std::shared_ptr<Value> eq(Context& context, std::vector<std::shared_ptr<Value>>& args) {
+        Ref eq(Context& context, RefList& args) {
             if(args.size() < 3)
                 return ERROR("expect at least 2 arguments for `eq`");
             
-            auto first = args[1]->eval(context);
+            auto first = args[1].eval(context);
+            context.push(first);
 
             for(uint64_t i = 2; i < args.size(); i++) {
-                if(!(args[i]->eval(context)->equals(first)))
+                if(!(args[i].eval(context).equals(first))) {
+                    context.pop();
                     return context.get_const_val(ConstValue::Kind::F);
+                }
             }
+            context.pop();
             return context.get_const_val(ConstValue::Kind::T);
         }
 
-        std::shared_ptr<Value> cond(Context& context, std::vector<std::shared_ptr<Value>>& args) {
+        // `cond` and `if` return the branch to evaluate, so it can be evaluated in tail position
+        Ref cond_branch(Context& context, RefList& args) {
             if(args.size() < 4 || args.size() % 2 == 1)
                 return ERROR("expect uneven amount of four or more arguments for `cond`");
             
             for(uint64_t i = 1; i < args.size() - 1; i += 2) {
-                auto cond = args[i]->eval(context);
-                if(cond->kind() != ValueKind::Const)
+                auto cond = args[i].eval(context);
+                if(cond.kind() == ValueKind::Error)
+                    return cond;
+                if(cond.kind() != ValueKind::Const)
                     return ERROR("expect `T`, `F` or `NIL` as condition values");
                 
-                if(dynamic_cast<ConstValue&>(*cond).is_truthy())
-                    return args[i + 1]->eval(context);
+                if(cond.is_truthy())
+                    return args[i + 1];
             }
 
-            return args.back()->eval(context);
+            return args.back();
         }
 
-        std::shared_ptr<Value> if_(Context& context, std::vector<std::shared_ptr<Value>>& args) {
+        Ref if_branch(Context& context, RefList& args) {
             if(args.size() != 4)
                 return ERROR("expect exactly 3 arguments for `if`");
             
-            auto cond = args[1]->eval(context);
-            if(cond->kind() != ValueKind::Const)
+            auto cond = args[1].eval(context);
+            if(cond.kind() == ValueKind::Error)
+                return cond;
+            if(cond.kind() != ValueKind::Const)
                 return ERROR("expect `T`, `F` or `NIL` as condition values");
             
-            if(dynamic_cast<ConstValue&>(*cond).is_truthy())
-                return args[2]->eval(context);
-            return args[3]->eval(context);
+            if(cond.is_truthy())
+                return args[2];
+            return args[3];
         }
 
-        std::shared_ptr<Value> add(Context& context, std::vector<std::shared_ptr<Value>>& args) {
-            if(args.size() < 2)
-                return ERROR("expect at least 1 argument for `+`");
+        Ref cond(Context& context, RefList& args) {
+            return cond_branch(context, args).eval(context);
+        }
 
-            auto first = args[1]->eval(context);
-            int64_t total = dynamic_cast<NumberValue&>(*first).value();
+        Ref if_(Context& context, RefList& args) {
+            return if_branch(context, args).eval(context);
+        }
+
+        // evaluate the forms of a body before the last one and return that one, or the first error
+        static Ref body_branch(Context& context, RefList& args, size_t first) {
+            for(size_t i = first; i < args.size() - 1; i++) {
+                auto value = args[i].eval(context);
+                if(value.kind() == ValueKind::Error)
+                    return value;
+            }
+            return args.back();
+        }
 
-             for(uint64_t i = 2; i < args.size(); i++) {
-                auto arg = args[i]->eval(context);
-                if(arg->kind() != ValueKind::Number)
-                    return ERROR("`+` exepects all arguments to be numbers");
-                total += dynamic_cast<NumberValue&>(*arg).value();
+        // evaluate every form of a loop body, the error of the first one that fails or `NIL`
+        static Ref loop_body(Context& context, RefList& args, size_t first) {
+            for(size_t i = first; i < args.size(); i++) {
+                auto value = args[i].eval(context);
+                if(value.kind() == ValueKind::Error)
+                    return value;
             }
+            return context.get_const_val(ConstValue::Kind::Nil);
+        }
 
-            return context.get_number(total);
+        // a `(name value)` pair whose name the resolver turned into a slot of the current frame
+        static bool is_binding(Ref value) {
+            if(value.kind() != ValueKind::Compound)
+                return false;
+            auto& pair = dynamic_cast<CompoundValue&>(*value).get_contents();
+            return pair.size() == 2 && pair[0].kind() == ValueKind::Local;
         }
 
-        std::shared_ptr<Value> subtract(Context& context, std::vector<std::shared_ptr<Value>>& args) {
+        // `let` binds its values to slots of the current frame, reserved for it when the function
+        // was defined, so entering it doesn't allocate anything
+        Ref let_branch(Context& context, RefList& args) {
+            if(args.size() < 3)
+                return ERROR("expect at least 2 arguments for `let`");
+            if(args[1].kind() != ValueKind::Compound)
+                return ERROR("expect first `let` argument to be a list of bindings");
+
+            auto& bindings = dynamic_cast<CompoundValue&>(*args[1]).get_contents();
+            for(auto& binding : bindings) {
+                if(!is_binding(binding))
+                    return ERROR("expect `let` bindings to be pairs of an identifier and a value");
+            }
+
+            // the values can't see the new names, so binding them one by one is like binding them at once
+            for(auto& binding : bindings) {
+                auto& pair = dynamic_cast<CompoundValue&>(*binding).get_contents();
+                auto value = pair[1].eval(context);
+                if(value.kind() == ValueKind::Error)
+                    return value;
+                auto& local = dynamic_cast<LocalValue&>(*pair[0]);
+                context.get_local(local.get_depth(), local.get_slot()) = value;
+            }
+
+            return body_branch(context, args, 2);
+        }
+
+        Ref let(Context& context, RefList& args) {
+            return let_branch(context, args).eval(context);
+        }
+
+        Ref while_(Context& context, RefList& args) {
             if(args.size() < 2)
-                return ERROR("expect at least 1 argument for `-`");
+                return ERROR("expect at least 1 argument for `while`");
 
-            auto first = args[1]->eval(context);
-            int64_t total = dynamic_cast<NumberValue&>(*first).value();
+            for(;;) {
+                context.safepoint();
+                auto cond = args[1].eval(context);
+                if(cond.kind() == ValueKind::Error)
+                    return cond;
+                if(cond.kind() != ValueKind::Const)
+                    return ERROR("expect `T`, `F` or `NIL` as condition values");
+                if(!cond.is_truthy())
+                    return context.get_const_val(ConstValue::Kind::Nil);
 
-             for(uint64_t i = 2; i < args.size(); i++) {
-                auto arg = args[i]->eval(context);
-                if(arg->kind() != ValueKind::Number)
-                    return ERROR("`-` exepects all arguments to be numbers");
-                total -= dynamic_cast<NumberValue&>(*arg).value();
+                auto result = loop_body(context, args, 2);
+                if(result.kind() == ValueKind::Error)
+                    return result;
             }
+        }
 
-            return context.get_number(total);
+        // (dotimes (i count) body...) evaluates the body with `i` bound to 0 up to `count` - 1
+        Ref dotimes(Context& context, RefList& args) {
+            if(args.size() < 2)
+                return ERROR("expect at least 1 argument for `dotimes`");
+            if(!is_binding(args[1]))
+                return ERROR("expect first `dotimes` argument to be a pair of an identifier and a count");
+
+            auto& pair = dynamic_cast<CompoundValue&>(*args[1]).get_contents();
+            auto count = pair[1].eval(context);
+            if(count.kind() == ValueKind::Error)
+                return count;
+            if(count.kind() != ValueKind::Number)
+                return ERROR("expect `dotimes` count to be an integer");
+            if(!count.is_fixnum())
+                return ERROR("`dotimes` count is out of range");
+
+            auto& local = dynamic_cast<LocalValue&>(*pair[0]);
+            for(int64_t i = 0; i < count.fixnum(); i++) {
+                context.safepoint();
+                context.get_local(local.get_depth(), local.get_slot()) = Ref::fixnum(i);
+                auto result = loop_body(context, args, 2);
+                if(result.kind() == ValueKind::Error)
+                    return result;
+            }
+            return context.get_const_val(ConstValue::Kind::Nil);
         }
 
-        std::shared_ptr<Value> multiply(Context& context, std::vector<std::shared_ptr<Value>>& args) {
+        // fold the operands of `+`, `-`, `*` and `/` from left to right, the running total stays on
+        // the stack while evaluating the next operand, which may collect a boxed total
+        static Ref arithmetic(Context& context, RefList& args, Operator op, const char* arity_error) {
             if(args.size() < 2)
-                return ERROR("expect at least 1 argument for `*`");
+                return context.get_error(arity_error);
 
-            auto first = args[1]->eval(context);
-            int64_t total = dynamic_cast<NumberValue&>(*first).value();
+            auto first = args[1].eval(context);
+            if(auto error = check_operand(context, op, first))
+                return error;
+            context.push(first);
 
             for(uint64_t i = 2; i < args.size(); i++) {
-                auto arg = args[i]->eval(context);
-                if(arg->kind() != ValueKind::Number)
-                    return ERROR("`*` exepects all arguments to be numbers");
-                total *= dynamic_cast<NumberValue&>(*arg).value();
+                auto arg = args[i].eval(context);
+                if(auto error = check_operand(context, op, arg)) {
+                    context.pop();
+                    return error;
+                }
+
+                auto& total = context.get_stack().back();
+                total = apply_operator(context, op, total, arg);
+                if(total.kind() == ValueKind::Error)
+                    break;
+            }
+            return context.pop();
+        }
+
+        // `lhs` stays on the stack while evaluating `rhs`
+        static Ref comparison(Context& context, RefList& args, Operator op, const char* arity_error) {
+            if(args.size() != 3)
+                return context.get_error(arity_error);
+
+            auto first = args[1].eval(context);
+            if(auto error = check_operand(context, op, first))
+                return error;
+
+            context.push(first);
+            auto second = args[2].eval(context);
+            context.pop();
+            if(auto error = check_operand(context, op, second))
+                return error;
+
+            return apply_operator(context, op, first, second);
+        }
+
+        Ref add(Context& context, RefList& args) {
+            return arithmetic(context, args, Operator::Add, "expect at least 1 argument for `+`");
+        }
+
+        Ref subtract(Context& context, RefList& args) {
+            return arithmetic(context, args, Operator::Subtract, "expect at least 1 argument for `-`");
+        }
+
+        Ref multiply(Context& context, RefList& args) {
+            return arithmetic(context, args, Operator::Multiply, "expect at least 1 argument for `*`");
+        }
+
+        Ref divide(Context& context, RefList& args) {
+            return arithmetic(context, args, Operator::Divide, "expect at least 1 argument for `/`");
+        }
+
+        Ref lt(Context& context, RefList& args) {
+            return comparison(context, args, Operator::Lt, "expect exactly 2 arguments for `<`");
+        }
+
+        Ref gt(Context& context, RefList& args) {
+            return comparison(context, args, Operator::Gt, "expect exactly 2 arguments for `>`");
+        }
+
+        Ref lt_eq(Context& context, RefList& args) {
+            return comparison(context, args, Operator::LtEq, "expect exactly 2 arguments for `<=`");
+        }
+
+        Ref gt_eq(Context& context, RefList& args) {
+            return comparison(context, args, Operator::GtEq, "expect exactly 2 arguments for `>=`");
+        }
+
+        Ref gc(Context& context, RefList& args) {
+            if(args.size() != 1)
+                return ERROR("expect no arguments for `gc`");
+            context.collect();
+            return context.get_const_val(ConstValue::Kind::Nil);
+        }
+
+        // builtins with side effects or reading state that changes between calls
+        static const std::unordered_set<std::string> IMPURE_BUILTINS = {
+            "print", "setq", "defun", "defun-memo", "memoize", "memo-stats", "gc", "pcall", "pmap",
+            "spawn", "await", "channel", "send", "recv", "yield", "open-input", "open-output", "write", "read-line",
+            "close", "flush"
+        };
+
+        static bool is_pure(Context& context, Ref value, std::unordered_set<std::string>& checked);
+
+        // the values bound by `let` and `dotimes`, whose names are no calls
+        static bool are_pure_bindings(Context& context, const std::string& name, Ref bindings, std::unordered_set<std::string>& checked) {
+            if(bindings.kind() != ValueKind::Compound)
+                return true;
+            if(name == "dotimes")
+                return !is_binding(bindings) || is_pure(context, dynamic_cast<CompoundValue&>(*bindings).get_contents()[1], checked);
+
+            for(auto& binding : dynamic_cast<CompoundValue&>(*bindings).get_contents()) {
+                if(is_binding(binding) && !is_pure(context, dynamic_cast<CompoundValue&>(*binding).get_contents()[1], checked))
+                    return false;
             }
+            return true;
+        }
+
+        // whether `value` only depends on the function's arguments and has no side effects. it
+        // can't read globals, and calls only pure builtins and functions that are pure as they are
+        // currently defined. `checked` holds the functions assumed pure, to allow recursion
+        static bool is_pure(Context& context, Ref value, std::unordered_set<std::string>& checked) {
+            switch(value.kind()) {
+            case ValueKind::Ident:
+                return false;
+            case ValueKind::Compound: {
+                auto& contents = dynamic_cast<CompoundValue&>(*value).get_contents();
+                size_t first = 0;
+                if(!contents.empty() && contents[0].kind() == ValueKind::Local)
+                    return false;
+                if(!contents.empty() && contents[0].kind() == ValueKind::Ident) {
+                    auto& name = dynamic_cast<IdentValue&>(*contents[0]).get_name();
+                    if(IMPURE_BUILTINS.find(name) != IMPURE_BUILTINS.end())
+                        return false;
+                    if(BUILTINS.find(name) == BUILTINS.end() && checked.find(name) == checked.end()) {
+                        auto callee = context.get_symbol(name);
+                        if(!callee || callee.value().kind() != ValueKind::Function)
+                            return false;
+                        checked.insert(name);
+                        if(!is_pure(context, dynamic_cast<FunctionValue&>(*callee.value()).get_body(), checked))
+                            return false;
+                    }
+                    first = 1;
+                    if((name == "let" || name == "dotimes") && contents.size() > 1) {
+                        if(!are_pure_bindings(context, name, contents[1], checked))
+                            return false;
+                        first = 2;
+                    }
+                }
 
-            return context.get_number(total);
+                for(size_t i = first; i < contents.size(); i++) {
+                    if(!is_pure(context, contents[i], checked))
+                        return false;
+                }
+                return true;
+            }
+            default:
+                return true;
+            }
+        }
+
+        // a function value, or the function bound to a (quoted) identifier
+        static FunctionValue* find_function(Context& context, Ref value) {
+            if(value.kind() == ValueKind::Ident) {
+                auto symbol = context.get_symbol(dynamic_cast<IdentValue&>(*value).get_name());
+                if(!symbol)
+                    return nullptr;
+                value = symbol.value();
+            }
+            if(value.kind() != ValueKind::Function)
+                return nullptr;
+            return static_cast<FunctionValue*>(value.get());
         }
 
-        std::shared_ptr<Value> divide(Context& context, std::vector<std::shared_ptr<Value>>& args) {
+        static Ref memoize_function(Context& context, FunctionValue& function, size_t capacity) {
+            std::unordered_set<std::string> checked = {function.get_name()};
+            if(!is_pure(context, function.get_body(), checked))
+                return ERROR("can only memoize pure functions");
+
+            function.set_memo(std::make_shared<Memo>(capacity));
+            return context.get_const_val(ConstValue::Kind::Nil);
+        }
+
+        Ref memoize(Context& context, RefList& args) {
+            if(args.size() != 2 && args.size() != 3)
+                return ERROR("expect 1 or 2 arguments for `memoize`");
+
+            auto target = args[1].eval(context);
+            if(target.kind() == ValueKind::Error)
+                return target;
+            context.push(target);
+
+            size_t capacity = Memo::DEFAULT_CAPACITY;
+            if(args.size() == 3) {
+                auto size = args[2].eval(context);
+                if(size.kind() != ValueKind::Number || size.number() < 1) {
+                    context.pop();
+                    return ERROR("expect a positive size for `memoize`");
+                }
+                capacity = size.number();
+            }
+            context.pop();
+
+            auto function = find_function(context, target);
+            if(!function)
+                return ERROR("expect a function for `memoize`");
+            return memoize_function(context, *function, capacity);
+        }
+
+        Ref defun_memo(Context& context, RefList& args) {
+            auto result = defun(context, args);
+            if(result.kind() == ValueKind::Error)
+                return result;
+
+            auto& name = dynamic_cast<IdentValue&>(*args[1]).get_name();
+            auto& function = dynamic_cast<FunctionValue&>(*context.get_symbol(name).value());
+            return memoize_function(context, function, Memo::DEFAULT_CAPACITY);
+        }
+
+        // (hits misses evictions size) of a memoized function
+        Ref memo_stats(Context& context, RefList& args) {
+            if(args.size() != 2)
+                return ERROR("expect exactly 1 argument for `memo-stats`");
+
+            auto function = find_function(context, args[1].eval(context));
+            if(!function || !function->get_memo())
+                return ERROR("expect a memoized function for `memo-stats`");
+
+            auto memo = function->get_memo();
+            return context.alloc<CompoundValue>(RefList({
+                context.get_number(memo->get_hits()),
+                context.get_number(memo->get_misses()),
+                context.get_number(memo->get_evictions()),
+                context.get_number(memo->get_size())
+            }));
+        }
+
+        // call a function of one argument with each of `arguments`, which are rooted on the stack
+        static Ref parallel_map(Context& context, Ref callee, const std::vector<Ref>& arguments, const char* reason) {
+            // functions can be passed by name, as in `(pmap 'f list)`
+            if(callee.kind() == ValueKind::Ident) {
+                if(auto symbol = context.get_symbol(dynamic_cast<IdentValue&>(*callee).get_name()))
+                    callee = symbol.value();
+            }
+            if(callee.kind() != ValueKind::Function || dynamic_cast<FunctionValue&>(*callee).get_arity() != 1)
+                return context.get_error(reason);
+            auto& function = dynamic_cast<FunctionValue&>(*callee);
+
+            std::vector<Ref> results;
+            if(context.is_worker()) {
+                // tasks that fan out further run their calls themselves
+                for(auto& argument : arguments) {
+                    results.push_back(function.apply(context, {argument}));
+                    context.push(results.back());
+                }
+                for(size_t i = 0; i < results.size(); i++)
+                    context.pop();
+            }
+            else {
+                if(!context.get_pool()) {
+                    size_t threads = context.get_threads();
+                    if(threads == 0)
+                        threads = std::max(1u, std::thread::hardware_concurrency());
+                    context.set_pool(std::make_shared<ThreadPool>(context, threads));
+                }
+                results = context.get_pool()->map(function, arguments);
+            }
+            return context.alloc<CompoundValue>(RefList(results.begin(), results.end()));
+        }
+
+        // (pcall f a b c) evaluates (f a), (f b) and (f c) in parallel
+        Ref pcall(Context& context, RefList& args) {
             if(args.size() < 2)
-                return ERROR("expect at least 1 argument for `/`");
+                return ERROR("expect at least 1 argument for `pcall`");
 
-            auto first = args[1]->eval(context);
-            int64_t total = dynamic_cast<NumberValue&>(*first).value();
+            std::vector<Ref> values;
+            for(size_t i = 1; i < args.size(); i++) {
+                values.push_back(args[i].eval(context));
+                context.push(values.back());
+            }
 
-            for(uint64_t i = 2; i < args.size(); i++) {
-                auto arg = args[i]->eval(context);
-                if(arg->kind() != ValueKind::Number)
-                    return ERROR("`/` exepects all arguments to be numbers");
-                total /= dynamic_cast<NumberValue&>(*arg).value();
+            auto result = parallel_map(context, values[0], std::vector<Ref>(values.begin() + 1, values.end()),
+                                       "expect a function of 1 argument for `pcall`");
+            for(size_t i = 0; i < values.size(); i++)
+                context.pop();
+            return result;
+        }
+
+        // (pmap f '(a b c)) evaluates (f a), (f b) and (f c) in parallel
+        Ref pmap(Context& context, RefList& args) {
+            if(args.size() != 3)
+                return ERROR("expect exactly 2 arguments for `pmap`");
+
+            auto function = args[1].eval(context);
+            context.push(function);
+            auto list = args[2].eval(context);
+            context.push(list);
+
+            Ref result;
+            if(list.kind() != ValueKind::Compound)
+                result = ERROR("expect second `pmap` argument to be a list");
+            else {
+                auto& contents = dynamic_cast<CompoundValue&>(*list).get_contents();
+                result = parallel_map(context, function, std::vector<Ref>(contents.begin(), contents.end()),
+                                      "expect a function of 1 argument for `pmap`");
+            }
+            context.pop();
+            context.pop();
+            return result;
+        }
+        static double to_double(Ref number) {
+            if(number.is_fixnum())
+                return number.fixnum();
+            if(number.kind() == ValueKind::Float)
+                return static_cast<FloatValue&>(*number).value();
+            return static_cast<NumberValue&>(*number).value().to_double();
+        }
+
+        static std::vector<double> to_floats(const ArrayValue& array) {
+            if(array.is_float())
+                return array.floats();
+            return std::vector<double>(array.ints().begin(), array.ints().end());
+        }
+
+        // (vec 1 2 3) is an integer array, any float makes it a float array
+        Ref vec(Context& context, RefList& args) {
+            std::vector<int64_t> ints;
+            std::vector<double> floats;
+            bool is_float = false;
+
+            // elements are unboxed right away, so nothing has to stay on the stack
+            for(size_t i = 1; i < args.size(); i++) {
+                auto element = args[i].eval(context);
+                if(element.kind() == ValueKind::Error)
+                    return element;
+                if(!element.is_numeric())
+                    return ERROR("expect `vec` elements to be numbers");
+
+                if(element.kind() == ValueKind::Float && !is_float) {
+                    floats.assign(ints.begin(), ints.end());
+                    is_float = true;
+                }
+                if(is_float)
+                    floats.push_back(to_double(element));
+                else if(element.is_fixnum() || dynamic_cast<NumberValue&>(*element).value().fits_int64())
+                    ints.push_back(element.number());
+                else
+                    return ERROR("expect `vec` integers to fit into 64 bits");
             }
 
-            return context.get_number(total);
+            if(is_float)
+                return context.alloc<ArrayValue>(std::move(floats));
+            return context.alloc<ArrayValue>(std::move(ints));
         }
 
-        std::shared_ptr<Value> lt(Context& context, std::vector<std::shared_ptr<Value>>& args) {
+        // (make-vec n x) repeats `x` n times
+        Ref make_vec(Context& context, RefList& args) {
             if(args.size() != 3)
-                return ERROR("expect exactly 2 arguments for `<`");
-            
-            auto first = args[1]->eval(context);
-            if(first->kind() != ValueKind::Number)
-                return ERROR("`<` only operates on numbers");
-            
-            auto second = args[2]->eval(context);
-            if(second->kind() != ValueKind::Number)
-                return ERROR("`<` only operates on numbers");
-            
-            if(dynamic_cast<NumberValue&>(*first).value() < dynamic_cast<NumberValue&>(*second).value())
-                return context.get_const_val(ConstValue::Kind::T);
-            return context.get_const_val(ConstValue::Kind::F);
+                return ERROR("expect exactly 2 arguments for `make-vec`");
+
+            auto size = args[1].eval(context);
+            if(size.kind() == ValueKind::Error)
+                return size;
+            if(!size.is_fixnum() || size.fixnum() < 0)
+                return ERROR("expect first `make-vec` argument to be a size");
+
+            auto element = args[2].eval(context);
+            if(element.kind() == ValueKind::Error)
+                return element;
+            if(element.kind() == ValueKind::Float)
+                return context.alloc<ArrayValue>(std::vector<double>(size.fixnum(), to_double(element)));
+            if(!element.is_fixnum())
+                return ERROR("expect second `make-vec` argument to be a fixnum or float");
+            return context.alloc<ArrayValue>(std::vector<int64_t>(size.fixnum(), element.fixnum()));
+        }
+
+        // (vec-range n) is [0 1 ... n-1]
+        Ref vec_range(Context& context, RefList& args) {
+            if(args.size() != 2)
+                return ERROR("expect exactly 1 argument for `vec-range`");
+
+            auto size = args[1].eval(context);
+            if(size.kind() == ValueKind::Error)
+                return size;
+            if(!size.is_fixnum() || size.fixnum() < 0)
+                return ERROR("expect `vec-range` argument to be a size");
+
+            std::vector<int64_t> ints(size.fixnum());
+            for(size_t i = 0; i < ints.size(); i++)
+                ints[i] = i;
+            return context.alloc<ArrayValue>(std::move(ints));
         }
 
-        std::shared_ptr<Value> gt(Context& context, std::vector<std::shared_ptr<Value>>& args) {
+        // evaluate an array argument, returning it or the error to report
+        static Ref eval_array(Context& context, Ref arg, const char* reason) {
+            auto array = arg.eval(context);
+            if(array.kind() == ValueKind::Error || array.kind() == ValueKind::Array)
+                return array;
+            return context.get_error(reason);
+        }
+
+        Ref vec_len(Context& context, RefList& args) {
+            if(args.size() != 2)
+                return ERROR("expect exactly 1 argument for `vec-len`");
+            auto array = eval_array(context, args[1], "expect `vec-len` argument to be an array");
+            if(array.kind() == ValueKind::Error)
+                return array;
+            return context.get_number(dynamic_cast<ArrayValue&>(*array).size());
+        }
+
+        Ref vec_ref(Context& context, RefList& args) {
             if(args.size() != 3)
-                return ERROR("expect exactly 2 arguments for `>`");
-            
-            auto first = args[1]->eval(context);
-            if(first->kind() != ValueKind::Number)
-                return ERROR("`>` only operates on numbers");
-            
-            auto second = args[2]->eval(context);
-            if(second->kind() != ValueKind::Number)
-                return ERROR("`>` only operates on numbers");
-            
-            if(dynamic_cast<NumberValue&>(*first).value() > dynamic_cast<NumberValue&>(*second).value())
-                return context.get_const_val(ConstValue::Kind::T);
-            return context.get_const_val(ConstValue::Kind::F);
+                return ERROR("expect exactly 2 arguments for `vec-ref`");
+            auto value = eval_array(context, args[1], "expect first `vec-ref` argument to be an array");
+            if(value.kind() == ValueKind::Error)
+                return value;
+
+            context.push(value);
+            auto index = args[2].eval(context);
+            context.pop();
+            if(index.kind() == ValueKind::Error)
+                return index;
+
+            auto& array = dynamic_cast<ArrayValue&>(*value);
+            if(!index.is_fixnum() || index.fixnum() < 0 || static_cast<size_t>(index.fixnum()) >= array.size())
+                return ERROR("`vec-ref` index out of bounds");
+            if(array.is_float())
+                return context.get_float(array.floats()[index.fixnum()]);
+            return context.get_number(array.ints()[index.fixnum()]);
         }
 
-        std::shared_ptr<Value> lt_eq(Context& context, std::vector<std::shared_ptr<Value>>& args) {
+        // `vec+` and `vec*` on two arrays of the same size, or an array and a number applied to every
+        // element. integer arrays stay integers unless they meet a float
+        static Ref elementwise(Context& context, RefList& args, Operator op, const char* name) {
             if(args.size() != 3)
-                return ERROR("expect exactly 2 arguments for `<=`");
-            
-            auto first = args[1]->eval(context);
-            if(first->kind() != ValueKind::Number)
-                return ERROR("`<=` only operates on numbers");
-            
-            auto second = args[2]->eval(context);
-            if(second->kind() != ValueKind::Number)
-                return ERROR("`<=` only operates on numbers");
-            
-            if(dynamic_cast<NumberValue&>(*first).value() <= dynamic_cast<NumberValue&>(*second).value())
-                return context.get_const_val(ConstValue::Kind::T);
-            return context.get_const_val(ConstValue::Kind::F);
+                return context.get_error(std::string("expect exactly 2 arguments for `") + name + "`");
+
+            auto lhs = eval_array(context, args[1], (std::string("expect first `") + name + "` argument to be an array").c_str());
+            if(lhs.kind() == ValueKind::Error)
+                return lhs;
+            context.push(lhs);
+            auto rhs = args[2].eval(context);
+            context.pop();
+            if(rhs.kind() == ValueKind::Error)
+                return rhs;
+
+            auto& array = dynamic_cast<ArrayValue&>(*lhs);
+            size_t size = array.size();
+            bool is_array = rhs.kind() == ValueKind::Array;
+            if(!is_array && !rhs.is_numeric())
+                return context.get_error(std::string("expect second `") + name + "` argument to be an array or a number");
+
+            auto other = is_array ? &dynamic_cast<ArrayValue&>(*rhs) : nullptr;
+            if(other && other->size() != size)
+                return context.get_error(std::string("expect `") + name + "` arrays to have the same size");
+
+            bool is_float = array.is_float() || (other ? other->is_float() : rhs.kind() == ValueKind::Float);
+            if(!is_float && !other && !rhs.is_fixnum() && !dynamic_cast<NumberValue&>(*rhs).value().fits_int64())
+                is_float = true;
+
+            if(is_float) {
+                auto a = to_floats(array);
+                std::vector<double> out(size);
+                if(other) {
+                    auto b = to_floats(*other);
+                    op == Operator::Add ? simd::add(a.data(), b.data(), out.data(), size) : simd::multiply(a.data(), b.data(), out.data(), size);
+                }
+                else
+                    op == Operator::Add ? simd::add(a.data(), to_double(rhs), out.data(), size) : simd::multiply(a.data(), to_double(rhs), out.data(), size);
+                return context.alloc<ArrayValue>(std::move(out));
+            }
+
+            auto a = array.ints().data();
+            std::vector<int64_t> out(size);
+            bool fits;
+            if(other)
+                fits = op == Operator::Add ? simd::add(a, other->ints().data(), out.data(), size) : simd::multiply(a, other->ints().data(), out.data(), size);
+            else
+                fits = op == Operator::Add ? simd::add(a, rhs.number(), out.data(), size) : simd::multiply(a, rhs.number(), out.data(), size);
+            if(!fits)
+                return context.get_error(std::string("integer overflow in `") + name + "`");
+            return context.alloc<ArrayValue>(std::move(out));
+        }
+
+        Ref vec_add(Context& context, RefList& args) {
+            return elementwise(context, args, Operator::Add, "vec+");
+        }
+
+        Ref vec_multiply(Context& context, RefList& args) {
+            return elementwise(context, args, Operator::Multiply, "vec*");
+        }
+
+        // integer sums and dot products that overflow 64 bits are redone in bignums
+        static Ref big_sum(Context& context, const int64_t* a, const int64_t* b, size_t size) {
+            BigInt total;
+            for(size_t i = 0; i < size; i++)
+                total = total + (b ? BigInt(a[i]) * BigInt(b[i]) : BigInt(a[i]));
+            return context.get_number(std::move(total));
         }
 
-        std::shared_ptr<Value> gt_eq(Context& context, std::vector<std::shared_ptr<Value>>& args) {
+        Ref dot(Context& context, RefList& args) {
             if(args.size() != 3)
-                return ERROR("expect exactly 2 arguments for `>=`");
-            
-            auto first = args[1]->eval(context);
-            if(first->kind() != ValueKind::Number)
-                return ERROR("`>=` only operates on numbers");
-            
-            auto second = args[2]->eval(context);
-            if(second->kind() != ValueKind::Number)
-                return ERROR("`>=` only operates on numbers");
-            
-            if(dynamic_cast<NumberValue&>(*first).value() >= dynamic_cast<NumberValue&>(*second).value())
-                return context.get_const_val(ConstValue::Kind::T);
-            return context.get_const_val(ConstValue::Kind::F);
+                return ERROR("expect exactly 2 arguments for `dot`");
+
+            auto lhs = eval_array(context, args[1], "expect `dot` arguments to be arrays");
+            if(lhs.kind() == ValueKind::Error)
+                return lhs;
+            context.push(lhs);
+            auto rhs = eval_array(context, args[2], "expect `dot` arguments to be arrays");
+            context.pop();
+            if(rhs.kind() == ValueKind::Error)
+                return rhs;
+
+            auto& a = dynamic_cast<ArrayValue&>(*lhs);
+            auto& b = dynamic_cast<ArrayValue&>(*rhs);
+            if(a.size() != b.size())
+                return ERROR("expect `dot` arrays to have the same size");
+
+            if(a.is_float() || b.is_float())
+                return context.get_float(simd::dot(to_floats(a).data(), to_floats(b).data(), a.size()));
+            int64_t result;
+            if(simd::dot(a.ints().data(), b.ints().data(), a.size(), result))
+                return context.get_number(result);
+            return big_sum(context, a.ints().data(), b.ints().data(), a.size());
+        }
+
+        Ref sum(Context& context, RefList& args) {
+            if(args.size() != 2)
+                return ERROR("expect exactly 1 argument for `sum`");
+
+            auto value = eval_array(context, args[1], "expect `sum` argument to be an array");
+            if(value.kind() == ValueKind::Error)
+                return value;
+
+            auto& array = dynamic_cast<ArrayValue&>(*value);
+            if(array.is_float())
+                return context.get_float(simd::sum(array.floats().data(), array.size()));
+            int64_t result;
+            if(simd::sum(array.ints().data(), array.size(), result))
+                return context.get_number(result);
+            return big_sum(context, array.ints().data(), nullptr, array.size());
+        }
+
+        // (min v) of the elements of an array, or (min a b ...) of its arguments
+        static Ref extremum(Context& context, RefList& args, Operator op, const char* name) {
+            if(args.size() < 2)
+                return context.get_error(std::string("expect at least 1 argument for `") + name + "`");
+
+            auto first = args[1].eval(context);
+            if(first.kind() == ValueKind::Error)
+                return first;
+
+            if(first.kind() == ValueKind::Array && args.size() == 2) {
+                auto& array = dynamic_cast<ArrayValue&>(*first);
+                if(array.size() == 0)
+                    return context.get_error(std::string("`") + name + "` of an empty array");
+                if(array.is_float()) {
+                    auto& floats = array.floats();
+                    return context.get_float(op == Operator::Lt ? simd::min(floats.data(), floats.size()) : simd::max(floats.data(), floats.size()));
+                }
+                auto& ints = array.ints();
+                return context.get_number(op == Operator::Lt ? simd::min(ints.data(), ints.size()) : simd::max(ints.data(), ints.size()));
+            }
+
+            if(!first.is_numeric())
+                return context.get_error(std::string("expect `") + name + "` arguments to be numbers or an array");
+            context.push(first);
+            for(size_t i = 2; i < args.size(); i++) {
+                auto arg = args[i].eval(context);
+                if(auto error = check_operand(context, op, arg)) {
+                    context.pop();
+                    return error;
+                }
+                auto& best = context.get_stack().back();
+                if(apply_operator(context, op, arg, best).is_truthy())
+                    best = arg;
+            }
+            return context.pop();
+        }
+
+        Ref min(Context& context, RefList& args) {
+            return extremum(context, args, Operator::Lt, "min");
+        }
+
+        Ref max(Context& context, RefList& args) {
+            return extremum(context, args, Operator::Gt, "max");
+        }
+
+        // evaluate `args[first]` onwards onto the stack, where they stay rooted until the caller
+        // pops them. nothing is left pushed on an error
+        static Ref push_args(Context& context, RefList& args, size_t first) {
+            auto& stack = context.get_stack();
+            size_t base = stack.size();
+            for(size_t i = first; i < args.size(); i++) {
+                auto arg = args[i].eval(context);
+                if(arg.kind() == ValueKind::Error) {
+                    stack.resize(base);
+                    return arg;
+                }
+                context.push(arg);
+            }
+            return Ref();
+        }
+
+        // (vector 1 "a" 'b) is #(1 a b )
+        Ref vector(Context& context, RefList& args) {
+            auto& stack = context.get_stack();
+            size_t base = stack.size();
+            if(auto error = push_args(context, args, 1))
+                return error;
+
+            PersistentVector elements;
+            size_t copied = 0;
+            for(size_t i = base; i < stack.size(); i++)
+                elements = elements.conj(stack[i], copied);
+            stack.resize(base);
+            return context.alloc<VectorValue>(elements, elements.bytes());
+        }
+
+        // (hash-map k1 v1 k2 v2), later keys replace earlier equal ones
+        Ref hash_map(Context& context, RefList& args) {
+            if(args.size() % 2 == 0)
+                return ERROR("expect an even number of arguments for `hash-map`");
+
+            auto& stack = context.get_stack();
+            size_t base = stack.size();
+            if(auto error = push_args(context, args, 1))
+                return error;
+
+            PersistentMap entries;
+            size_t copied = 0;
+            for(size_t i = base; i < stack.size(); i += 2)
+                entries = entries.assoc(stack[i], stack[i + 1], copied);
+            stack.resize(base);
+            return context.alloc<MapValue>(entries, entries.bytes());
+        }
+
+        // (get coll key default) looks up an index of a vector or a key of a map, returning
+        // `default` or NIL if there is none
+        Ref get(Context& context, RefList& args) {
+            if(args.size() != 3 && args.size() != 4)
+                return ERROR("expect 2 or 3 arguments for `get`");
+
+            auto& stack = context.get_stack();
+            size_t base = stack.size();
+            if(auto error = push_args(context, args, 1))
+                return error;
+            Ref collection = stack[base];
+            Ref key = stack[base + 1];
+            Ref fallback = args.size() == 4 ? stack[base + 2] : context.get_const_val(ConstValue::Kind::Nil);
+            stack.resize(base);
+
+            if(collection.kind() == ValueKind::Vector) {
+                auto& elements = static_cast<VectorValue&>(*collection).elements();
+                if(!key.is_fixnum() || key.fixnum() < 0 || static_cast<size_t>(key.fixnum()) >= elements.size())
+                    return fallback;
+                return elements.get(key.fixnum());
+            }
+            if(collection.kind() == ValueKind::Map) {
+                auto value = static_cast<MapValue&>(*collection).entries().find(key);
+                return value ? *value : fallback;
+            }
+            return ERROR("expect first `get` argument to be a vector or map");
+        }
+
+        // (assoc coll k1 v1 k2 v2) sets indices of a vector, where the size appends, or keys of a map
+        Ref assoc(Context& context, RefList& args) {
+            if(args.size() < 4 || args.size() % 2 == 1)
+                return ERROR("expect a collection and pairs of keys and values for `assoc`");
+
+            auto& stack = context.get_stack();
+            size_t base = stack.size();
+            if(auto error = push_args(context, args, 1))
+                return error;
+            Ref collection = stack[base];
+
+            size_t allocated = 0;
+            if(collection.kind() == ValueKind::Vector) {
+                auto elements = static_cast<VectorValue&>(*collection).elements();
+                for(size_t i = base + 1; i < stack.size(); i += 2) {
+                    Ref index = stack[i];
+                    if(!index.is_fixnum() || index.fixnum() < 0 || static_cast<size_t>(index.fixnum()) > elements.size()) {
+                        stack.resize(base);
+                        return ERROR("`assoc` index out of bounds");
+                    }
+                    elements = elements.assoc(index.fixnum(), stack[i + 1], allocated);
+                }
+                stack.resize(base);
+                return context.alloc<VectorValue>(std::move(elements), allocated);
+            }
+            if(collection.kind() == ValueKind::Map) {
+                auto entries = static_cast<MapValue&>(*collection).entries();
+                for(size_t i = base + 1; i < stack.size(); i += 2)
+                    entries = entries.assoc(stack[i], stack[i + 1], allocated);
+                stack.resize(base);
+                return context.alloc<MapValue>(std::move(entries), allocated);
+            }
+
+            stack.resize(base);
+            return ERROR("expect first `assoc` argument to be a vector or map");
+        }
+
+        // (conj v x y) appends to a vector
+        Ref conj(Context& context, RefList& args) {
+            if(args.size() < 2)
+                return ERROR("expect at least 1 argument for `conj`");
+
+            auto& stack = context.get_stack();
+            size_t base = stack.size();
+            if(auto error = push_args(context, args, 1))
+                return error;
+            Ref collection = stack[base];
+            if(collection.kind() != ValueKind::Vector) {
+                stack.resize(base);
+                return ERROR("expect first `conj` argument to be a vector");
+            }
+
+            auto elements = static_cast<VectorValue&>(*collection).elements();
+            size_t allocated = 0;
+            for(size_t i = base + 1; i < stack.size(); i++)
+                elements = elements.conj(stack[i], allocated);
+            stack.resize(base);
+            return context.alloc<VectorValue>(std::move(elements), allocated);
+        }
+
+        // number of elements of a vector, map, list, array or string
+        Ref count(Context& context, RefList& args) {
+            if(args.size() != 2)
+                return ERROR("expect exactly 1 argument for `count`");
+
+            auto collection = args[1].eval(context);
+            switch(collection.kind()) {
+            case ValueKind::Error:
+                return collection;
+            case ValueKind::Vector:
+                return context.get_number(static_cast<VectorValue&>(*collection).elements().size());
+            case ValueKind::Map:
+                return context.get_number(static_cast<MapValue&>(*collection).entries().size());
+            case ValueKind::Compound:
+                return context.get_number(static_cast<CompoundValue&>(*collection).get_contents().size());
+            case ValueKind::Array:
+                return context.get_number(static_cast<ArrayValue&>(*collection).size());
+            case ValueKind::String:
+                return context.get_number(static_cast<StringValue&>(*collection).get_value().size());
+            default:
+                return ERROR("expect `count` argument to be a collection or string");
+            }
+        }
+
+        static Scheduler& scheduler(Context& context) {
+            if(!context.get_scheduler())
+                context.set_scheduler(std::make_shared<Scheduler>(context));
+            return *context.get_scheduler();
+        }
+
+        // (spawn expr) evaluates `expr` in a new task, which runs once the spawning code waits
+        // for a task or channel or yields
+        Ref spawn(Context& context, RefList& args) {
+            if(args.size() != 2)
+                return ERROR("expect exactly 1 argument for `spawn`");
+            return scheduler(context).spawn(args[1]);
+        }
+
+        // (await task) waits for the task to finish and returns its result
+        Ref await(Context& context, RefList& args) {
+            if(args.size() != 2)
+                return ERROR("expect exactly 1 argument for `await`");
+
+            auto task = args[1].eval(context);
+            if(task.kind() == ValueKind::Error)
+                return task;
+            if(task.kind() != ValueKind::Task)
+                return ERROR("expect `await` argument to be a task");
+
+            context.push(task);
+            auto result = scheduler(context).await(static_cast<TaskValue&>(*task));
+            context.pop();
+            return result;
+        }
+
+        // (channel n) holds up to `n` values, 0 if omitted
+        Ref channel(Context& context, RefList& args) {
+            if(args.size() > 2)
+                return ERROR("expect at most 1 argument for `channel`");
+            if(args.size() == 1)
+                return context.alloc<ChannelValue>(0);
+
+            auto capacity = args[1].eval(context);
+            if(capacity.kind() == ValueKind::Error)
+                return capacity;
+            if(!capacity.is_fixnum() || capacity.fixnum() < 0)
+                return ERROR("expect `channel` argument to be a size");
+            return context.alloc<ChannelValue>(capacity.fixnum());
+        }
+
+        // a `pcall` or `pmap` worker only reaches the channels of the main context through globals.
+        // it can't wait for their tasks, and values it sent would be freed with its own heap
+        static bool is_foreign(Context& context, Ref channel) {
+            return context.is_worker() && !context.get_heap().owns(channel);
+        }
+
+        // (send ch x) waits while the channel is full
+        Ref send(Context& context, RefList& args) {
+            if(args.size() != 3)
+                return ERROR("expect exactly 2 arguments for `send`");
+
+            auto& stack = context.get_stack();
+            size_t base = stack.size();
+            if(auto error = push_args(context, args, 1))
+                return error;
+            Ref channel = stack[base];
+            Ref value = stack[base + 1];
+            if(channel.kind() != ValueKind::Channel) {
+                stack.resize(base);
+                return ERROR("expect first `send` argument to be a channel");
+            }
+            if(is_foreign(context, channel)) {
+                stack.resize(base);
+                return ERROR("can't use channels of the main context in parallel calls");
+            }
+
+            auto result = scheduler(context).send(static_cast<ChannelValue&>(*channel), value);
+            stack.resize(base);
+            return result;
+        }
+
+        // (recv ch) waits while the channel is empty
+        Ref recv(Context& context, RefList& args) {
+            if(args.size() != 2)
+                return ERROR("expect exactly 1 argument for `recv`");
+
+            auto channel = args[1].eval(context);
+            if(channel.kind() == ValueKind::Error)
+                return channel;
+            if(channel.kind() != ValueKind::Channel)
+                return ERROR("expect `recv` argument to be a channel");
+            if(is_foreign(context, channel))
+                return ERROR("can't use channels of the main context in parallel calls");
+
+            context.push(channel);
+            auto value = scheduler(context).recv(static_cast<ChannelValue&>(*channel));
+            context.pop();
+            return value;
+        }
+
+        // (yield) lets the queued tasks run before continuing
+        Ref yield(Context& context, RefList& args) {
+            if(args.size() != 1)
+                return ERROR("expect no arguments for `yield`");
+            if(context.get_scheduler())
+                context.get_scheduler()->yield();
+            return context.get_const_val(ConstValue::Kind::Nil);
+        }
+
+        static Ref open_port(Context& context, RefList& args, FilePort::Mode mode, bool append) {
+            auto path = args[1].eval(context);
+            if(path.kind() == ValueKind::Error)
+                return path;
+            if(path.kind() != ValueKind::String)
+                return ERROR("expect the path of a file to be a string");
+
+            auto& name = dynamic_cast<StringValue&>(*path).get_value();
+            auto port = FilePort::open(name.c_str(), mode, append);
+            if(!port)
+                return ERROR(std::string("can't open file: ") + strerror(errno));
+            return context.alloc<PortValue>(std::move(port), name);
+        }
+
+        // (open-input "file")
+        Ref open_input(Context& context, RefList& args) {
+            if(args.size() != 2)
+                return ERROR("expect exactly 1 argument for `open-input`");
+            return open_port(context, args, FilePort::Mode::Input, false);
+        }
+
+        // (open-output "file" [append]) truncates the file unless `append` is true
+        Ref open_output(Context& context, RefList& args) {
+            if(args.size() != 2 && args.size() != 3)
+                return ERROR("expect 1 or 2 arguments for `open-output`");
+
+            bool append = false;
+            if(args.size() == 3) {
+                auto flag = args[2].eval(context);
+                if(flag.kind() == ValueKind::Error)
+                    return flag;
+                append = flag.is_truthy();
+            }
+            return open_port(context, args, FilePort::Mode::Output, append);
+        }
+
+        // the open port an argument evaluates to, or the error to return
+        static Ref eval_port(Context& context, Ref arg, FilePort::Mode mode, const char* name) {
+            auto port = arg.eval(context);
+            if(port.kind() == ValueKind::Error)
+                return port;
+            if(port.kind() != ValueKind::Port || dynamic_cast<PortValue&>(*port).get_port().get_mode() != mode)
+                return ERROR(std::string("expect `") + name + "` argument to be an " + (mode == FilePort::Mode::Input ? "input" : "output") + " port");
+            if(!dynamic_cast<PortValue&>(*port).get_port().is_open())
+                return ERROR("port is closed");
+            return port;
+        }
+
+        // (write port x ...) writes the values without separators, strings without quotes
+        Ref write(Context& context, RefList& args) {
+            if(args.size() < 2)
+                return ERROR("expect a port for `write`");
+
+            auto& stack = context.get_stack();
+            size_t base = stack.size();
+            auto port = eval_port(context, args[1], FilePort::Mode::Output, "write");
+            if(port.kind() == ValueKind::Error)
+                return port;
+            context.push(port);
+            if(auto error = push_args(context, args, 2)) {
+                stack.resize(base);
+                return error;
+            }
+
+            auto& output = dynamic_cast<PortValue&>(*port).get_port();
+            {
+                auto lock = output.lock();
+                for(size_t i = base + 1; i < stack.size(); i++)
+                    stack[i].print(output.stream());
+                output.commit();
+            }
+            stack.resize(base);
+            return context.get_const_val(ConstValue::Kind::Nil);
+        }
+
+        // (read-line port) is the next line without its line break, NIL at the end of the file
+        Ref read_line(Context& context, RefList& args) {
+            if(args.size() != 2)
+                return ERROR("expect exactly 1 argument for `read-line`");
+
+            auto port = eval_port(context, args[1], FilePort::Mode::Input, "read-line");
+            if(port.kind() == ValueKind::Error)
+                return port;
+
+            std::string line;
+            auto& input = dynamic_cast<PortValue&>(*port).get_port();
+            bool read;
+            {
+                auto lock = input.lock();
+                read = input.read_line(line);
+            }
+            if(!read)
+                return context.get_const_val(ConstValue::Kind::Nil);
+            // lines aren't interned, so they are collected like other values
+            return context.alloc<StringValue>(std::move(line));
+        }
+
+        // (close port) flushes and closes it, closing it again does nothing
+        Ref close(Context& context, RefList& args) {
+            if(args.size() != 2)
+                return ERROR("expect exactly 1 argument for `close`");
+
+            auto port = args[1].eval(context);
+            if(port.kind() == ValueKind::Error)
+                return port;
+            if(port.kind() != ValueKind::Port)
+                return ERROR("expect `close` argument to be a port");
+
+            auto& file = dynamic_cast<PortValue&>(*port).get_port();
+            auto lock = file.lock();
+            if(!file.close())
+                return ERROR("can't write file");
+            return context.get_const_val(ConstValue::Kind::Nil);
+        }
+
+        // (flush [port]) writes what is buffered for a port, or for stdout
+        Ref flush(Context& context, RefList& args) {
+            if(args.size() > 2)
+                return ERROR("expect at most 1 argument for `flush`");
+
+            auto* output = &FilePort::standard_output();
+            if(args.size() == 2) {
+                auto port = eval_port(context, args[1], FilePort::Mode::Output, "flush");
+                if(port.kind() == ValueKind::Error)
+                    return port;
+                output = &dynamic_cast<PortValue&>(*port).get_port();
+            }
+
+            auto lock = output->lock();
+            if(!output->flush())
+                return ERROR("can't write file");
+            return context.get_const_val(ConstValue::Kind::Nil);
         }
     }
 
+    void print_line(const Ref* values, size_t count) {
+        auto& port = FilePort::standard_output();
+        auto lock = port.lock();
+        for(size_t i = 0; i < count; i++)
+            values[i].print(port.stream()) << ' ';
+        port.write("\n");
+        port.commit();
+    }
+
     const std::unordered_map<std::string, Builtin> BUILTINS = {
         {"print", builtin::print},
         {"setq", builtin::setq},
@@ -242,6 +1233,9 @@ namespace lisp {
         {"eq", builtin::eq},
         {"cond", builtin::cond},
         {"if", builtin::if_},
+        {"let", builtin::let},
+        {"while", builtin::while_},
+        {"dotimes", builtin::dotimes},
         {"+", builtin::add},
         {"-", builtin::subtract},
         {"*", builtin::multiply},
@@ -249,6 +1243,145 @@ namespace lisp {
         {"<", builtin::lt},
         {">", builtin::gt},
         {"<=", builtin::lt_eq},
-        {">=", builtin::gt_eq}
+        {">=", builtin::gt_eq},
+        {"gc", builtin::gc},
+        {"memoize", builtin::memoize},
+        {"defun-memo", builtin::defun_memo},
+        {"memo-stats", builtin::memo_stats},
+        {"pcall", builtin::pcall},
+        {"pmap", builtin::pmap},
+        {"vec", builtin::vec},
+        {"make-vec", builtin::make_vec},
+        {"vec-range", builtin::vec_range},
+        {"vec-len", builtin::vec_len},
+        {"vec-ref", builtin::vec_ref},
+        {"vec+", builtin::vec_add},
+        {"vec*", builtin::vec_multiply},
+        {"dot", builtin::dot},
+        {"sum", builtin::sum},
+        {"min", builtin::min},
+        {"max", builtin::max},
+        {"vector", builtin::vector},
+        {"hash-map", builtin::hash_map},
+        {"get", builtin::get},
+        {"assoc", builtin::assoc},
+        {"conj", builtin::conj},
+        {"count", builtin::count},
+        {"spawn", builtin::spawn},
+        {"await", builtin::await},
+        {"channel", builtin::channel},
+        {"send", builtin::send},
+        {"recv", builtin::recv},
+        {"yield", builtin::yield},
+        {"open-input", builtin::open_input},
+        {"open-output", builtin::open_output},
+        {"write", builtin::write},
+        {"read-line", builtin::read_line},
+        {"close", builtin::close},
+        {"flush", builtin::flush}
+    };
+
+    const std::unordered_map<std::string, Builtin> TAIL_BUILTINS = {
+        {"cond", builtin::cond_branch},
+        {"if", builtin::if_branch},
+        {"let", builtin::let_branch}
     };
-}
\ No newline at end of file
+
+    const std::unordered_map<std::string, Operator> OPERATORS = {
+        {"+", Operator::Add},
+        {"-", Operator::Subtract},
+        {"*", Operator::Multiply},
+        {"/", Operator::Divide},
+        {"<", Operator::Lt},
+        {">", Operator::Gt},
+        {"<=", Operator::LtEq},
+        {">=", Operator::GtEq},
+        {"eq", Operator::Eq}
+    };
+
+    Ref check_operand(Context& context, Operator op, Ref operand) {
+        if(operand.kind() == ValueKind::Error)
+            return operand;
+        if(operand.is_numeric())
+            return Ref();
+
+        switch(op) {
+        case Operator::Add:
+            return ERROR("`+` exepects all arguments to be numbers");
+        case Operator::Subtract:
+            return ERROR("`-` exepects all arguments to be numbers");
+        case Operator::Multiply:
+            return ERROR("`*` exepects all arguments to be numbers");
+        case Operator::Divide:
+            return ERROR("`/` exepects all arguments to be numbers");
+        case Operator::Lt:
+            return ERROR("`<` only operates on numbers");
+        case Operator::Gt:
+            return ERROR("`>` only operates on numbers");
+        case Operator::LtEq:
+            return ERROR("`<=` only operates on numbers");
+        default:
+            return ERROR("`>=` only operates on numbers");
+        }
+    }
+
+    Ref apply_operator(Context& context, Operator op, Ref lhs, Ref rhs) {
+        if(lhs.is_fixnum() && rhs.is_fixnum())
+            return apply_operator(context, op, lhs.fixnum(), rhs.fixnum());
+        if(lhs.kind() == ValueKind::Float || rhs.kind() == ValueKind::Float)
+            return apply_operator(context, op, builtin::to_double(lhs), builtin::to_double(rhs));
+
+        auto big = [](Ref number) {
+            return number.is_fixnum() ? BigInt(number.fixnum()) : static_cast<NumberValue&>(*number).value();
+        };
+        return apply_operator(context, op, big(lhs), big(rhs));
+    }
+
+    Ref apply_operator(Context& context, Operator op, const BigInt& lhs, const BigInt& rhs) {
+        switch(op) {
+        case Operator::Add:
+            return context.get_number(lhs + rhs);
+        case Operator::Subtract:
+            return context.get_number(lhs - rhs);
+        case Operator::Multiply:
+            return context.get_number(lhs * rhs);
+        case Operator::Divide:
+            if(rhs.is_zero())
+                return ERROR("division by zero");
+            return context.get_number(lhs / rhs);
+        case Operator::Lt:
+            return context.get_const_val(lhs.compare(rhs) < 0 ? ConstValue::Kind::T : ConstValue::Kind::F);
+        case Operator::Gt:
+            return context.get_const_val(lhs.compare(rhs) > 0 ? ConstValue::Kind::T : ConstValue::Kind::F);
+        case Operator::LtEq:
+            return context.get_const_val(lhs.compare(rhs) <= 0 ? ConstValue::Kind::T : ConstValue::Kind::F);
+        case Operator::GtEq:
+            return context.get_const_val(lhs.compare(rhs) >= 0 ? ConstValue::Kind::T : ConstValue::Kind::F);
+        default:
+            return context.get_const_val(ConstValue::Kind::Nil);
+        }
+    }
+
+    Ref apply_operator(Context& context, Operator op, double lhs, double rhs) {
+        switch(op) {
+        case Operator::Add:
+            return context.get_float(lhs + rhs);
+        case Operator::Subtract:
+            return context.get_float(lhs - rhs);
+        case Operator::Multiply:
+            return context.get_float(lhs * rhs);
+        case Operator::Divide:
+            return context.get_float(lhs / rhs);
+        case Operator::Lt:
+            return context.get_const_val(lhs < rhs ? ConstValue::Kind::T : ConstValue::Kind::F);
+        case Operator::Gt:
+            return context.get_const_val(lhs > rhs ? ConstValue::Kind::T : ConstValue::Kind::F);
+        case Operator::LtEq:
+            return context.get_const_val(lhs <= rhs ? ConstValue::Kind::T : ConstValue::Kind::F);
+        case Operator::GtEq:
+            return context.get_const_val(lhs >= rhs ? ConstValue::Kind::T : ConstValue::Kind::F);
+        default:
+            return context.get_const_val(ConstValue::Kind::Nil);
+        }
+    }
+}
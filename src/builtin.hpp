@@ -3,7 +3,58 @@
 #include "value.hpp"
 
 namespace lisp {
-    using Builtin = std::shared_ptr<Value> (*)(Context& context, std::vector<std::shared_ptr<Value>>& args);
-
     extern const std::unordered_map<std::string, Builtin> BUILTINS;
+
+    // builtins returning the expression to evaluate in their place, for tail calls
+    extern const std::unordered_map<std::string, Builtin> TAIL_BUILTINS;
+
+    extern const std::unordered_map<std::string, Operator> OPERATORS;
+
+    // write a line of values to stdout for `print`, each followed by a space
+    void print_line(const Ref* values, size_t count);
+
+    // the error an operator returns for a non-number operand, or an empty `Ref` for numbers
+    Ref check_operand(Context& context, Operator op, Ref operand);
+
+    // any two numbers, in float arithmetic if either is a float and in bignum arithmetic unless
+    // both are fixnums
+    Ref apply_operator(Context& context, Operator op, Ref lhs, Ref rhs);
+    Ref apply_operator(Context& context, Operator op, const BigInt& lhs, const BigInt& rhs);
+    Ref apply_operator(Context& context, Operator op, double lhs, double rhs);
+
+    // fixnum fast path, promoting to bignum arithmetic when the result overflows
+    inline Ref apply_operator(Context& context, Operator op, int64_t lhs, int64_t rhs) {
+        int64_t result;
+        switch(op) {
+        case Operator::Add:
+            if(__builtin_add_overflow(lhs, rhs, &result))
+                break;
+            return context.get_number(result);
+        case Operator::Subtract:
+            if(__builtin_sub_overflow(lhs, rhs, &result))
+                break;
+            return context.get_number(result);
+        case Operator::Multiply:
+            if(__builtin_mul_overflow(lhs, rhs, &result))
+                break;
+            return context.get_number(result);
+        case Operator::Divide:
+            if(rhs == 0)
+                return ERROR("division by zero");
+            if(lhs == INT64_MIN && rhs == -1)
+                break;
+            return context.get_number(lhs / rhs);
+        case Operator::Lt:
+            return context.get_const_val(lhs < rhs ? ConstValue::Kind::T : ConstValue::Kind::F);
+        case Operator::Gt:
+            return context.get_const_val(lhs > rhs ? ConstValue::Kind::T : ConstValue::Kind::F);
+        case Operator::LtEq:
+            return context.get_const_val(lhs <= rhs ? ConstValue::Kind::T : ConstValue::Kind::F);
+        case Operator::GtEq:
+            return context.get_const_val(lhs >= rhs ? ConstValue::Kind::T : ConstValue::Kind::F);
+        default:
+            return context.get_const_val(ConstValue::Kind::Nil);
+        }
+        return apply_operator(context, op, BigInt(lhs), BigInt(rhs));
+    }
 }
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "value.hpp"
+#include "builtin.hpp"
+
+namespace lisp {
+    // operands are encoded inline after each opcode, u16 and u32 operands in little endian.
+    // constants, names and jump targets are u32, so large programs and functions don't overflow them
+    enum class OpCode : uint8_t {
+        Const,         // u32 constant           push a constant
+        Local,         // u8 slot                push an argument or `let` binding of the current function
+        Global,        // u32 name               push a global symbol
+        SetLocal,      // u8 slot                `setq` an argument or `let` binding of the current function
+        SetGlobal,     // u32 name               `setq` a global symbol
+        Defun,         // u32 constant           bind a function constant to its name
+        Pop,
+        Jump,          // u32 target
+        JumpIfError,   // u32 target             jump if the top of the stack is an error, keeping it
+        Test,          // u32 else, u32 end      pop a `T`/`F`/`NIL` condition and branch on it
+        Loop,          // u32 target             jump back to the start of a loop, collecting garbage if due
+        Count,         // u8 slot, u32 end       pop a `dotimes` count into the loop state after `slot`, or
+                       //                        push an error and jump to `end`
+        Next,          // u8 slot, u32 end       bind the next `dotimes` counter to `slot`, or push `NIL` and
+                       //                        jump to `end` once the count is reached
+        Function,      // u32 name, u8 argc, u32 end
+                       //                        push the callee of a call or jump to `end` with an error
+        Callee,        // u8 argc, u32 end       check the callee on top of the stack like `Function`
+        Call,          // u8 argc                call the function below the arguments
+        TailCall,      // u8 argc                call the function below the arguments in place of the current one
+        Add,           // u8 argc
+        Subtract,      // u8 argc
+        Multiply,      // u8 argc
+        Divide,        // u8 argc
+        Lt,
+        Gt,
+        LtEq,
+        GtEq,
+        Eq,            // u32 end                pop a value and compare it to the first `eq` operand
+        EqEnd,         //                        replace the first `eq` operand with `T`
+        Print,         // u16 argc               pop and print a line of values, push `NIL`
+        Builtin,       // u16 builtin, u32 constant
+                       //                        call a builtin on the arguments of a compound constant
+        Return
+    };
+
+    // function target of a call through a global name, valid while the context's definition version matches
+    struct CallCache {
+        Ref callee;
+        uint64_t version = 0;
+    };
+
+    class Chunk {
+    public:
+        Chunk() {}
+        ~Chunk() {}
+
+        void emit(OpCode op) {
+            m_Code.push_back(static_cast<uint8_t>(op));
+        }
+
+        void emit_u8(uint8_t value) {
+            m_Code.push_back(value);
+        }
+
+        void emit_u16(uint16_t value) {
+            m_Code.push_back(value & 0xff);
+            m_Code.push_back(value >> 8);
+        }
+
+        void emit_u32(uint32_t value) {
+            for(int shift = 0; shift < 32; shift += 8)
+                m_Code.push_back((value >> shift) & 0xff);
+        }
+
+        // emit a placeholder u32 and return its position for `patch`
+        size_t emit_jump() {
+            emit_u32(0);
+            return m_Code.size() - 4;
+        }
+
+        void patch(size_t position) {
+            for(int i = 0; i < 4; i++)
+                m_Code[position + i] = (m_Code.size() >> (8 * i)) & 0xff;
+        }
+
+        // grow the frame to at least `size` slots
+        void reserve_slots(size_t size) {
+            m_FrameSize = std::max(m_FrameSize, size);
+        }
+
+        uint32_t add_constant(Ref value) {
+            m_Constants.push_back(value);
+            return m_Constants.size() - 1;
+        }
+
+        uint32_t add_name(const std::string& name) {
+            for(size_t i = 0; i < m_Names.size(); i++) {
+                if(m_Names[i] == name)
+                    return i;
+            }
+            m_Names.push_back(name);
+            m_CallCaches.emplace_back();
+            return m_Names.size() - 1;
+        }
+
+        uint16_t add_builtin(Builtin builtin) {
+            for(size_t i = 0; i < m_Builtins.size(); i++) {
+                if(m_Builtins[i] == builtin)
+                    return i;
+            }
+            m_Builtins.push_back(builtin);
+            return m_Builtins.size() - 1;
+        }
+
+        size_t size() const { return m_Code.size(); }
+        // slots of the frame the code runs in, its arguments and `let` bindings
+        size_t frame_size() const { return m_FrameSize; }
+        const uint8_t* code() const { return m_Code.data(); }
+        const Ref& constant(uint32_t index) const { return m_Constants[index]; }
+        const std::vector<Ref>& get_constants() const { return m_Constants; }
+        std::string& name(uint32_t index) { return m_Names[index]; }
+        CallCache& call_cache(uint32_t name) { return m_CallCaches[name]; }
+        const std::vector<CallCache>& get_call_caches() const { return m_CallCaches; }
+        Builtin builtin(uint16_t index) const { return m_Builtins[index]; }
+
+    private:
+        std::vector<uint8_t> m_Code;
+        std::vector<Ref> m_Constants;
+        std::vector<std::string> m_Names;
+        std::vector<CallCache> m_CallCaches;
+        std::vector<Builtin> m_Builtins;
+        size_t m_FrameSize = 0;
+    };
+}
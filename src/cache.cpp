@@ -0,0 +1,285 @@
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <unordered_map>
+
+#include <sys/stat.h>
+
+#include "cache.hpp"
+#include "binary.hpp"
+#include "context.hpp"
+
+namespace lisp {
+    // bump whenever the encoding of values or the resolution of syntax changes
+    static constexpr uint32_t FORMAT_VERSION = 3;
+    static constexpr char MAGIC[4] = {'L', 'P', 'P', 'C'};
+    // bounds the recursion when decoding a corrupt file, deeper programs are parsed again
+    static constexpr unsigned MAX_DEPTH = 1 << 14;
+
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint64_t size;
+        int64_t mtime;
+        uint64_t hash;
+        // names of identifiers and locals are stored once, in a table between the header and the forms
+        uint64_t names;
+        uint64_t forms;
+        // hash of everything after the header, which catches corruption the decoder can't see
+        uint64_t checksum;
+    };
+
+    enum class Tag : uint8_t {
+        Compound,
+        Ident,
+        String,
+        Fixnum,
+        Bignum,
+        Float,
+        Quote,
+        Const,
+        Local
+    };
+
+    static int64_t modification_time(const struct stat& info) {
+        return int64_t(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+    }
+
+    static uint64_t hash_bytes(std::string_view bytes) {
+        return std::hash<std::string_view>()(bytes);
+    }
+
+    std::string cache_path(const char* filename, const std::string& directory) {
+        std::string name = filename;
+        if(directory.empty()) {
+            if(name.size() > 5 && name.compare(name.size() - 5, 5, ".lisp") == 0)
+                name.resize(name.size() - 5);
+            return name + ".lppc";
+        }
+
+        // sources with the same name in different directories get different caches
+        char absolute[PATH_MAX];
+        if(realpath(filename, absolute))
+            name = absolute;
+        auto slash = name.find_last_of('/');
+        auto base = slash == std::string::npos ? name : name.substr(slash + 1);
+        char hash[17];
+        snprintf(hash, sizeof(hash), "%016zx", std::hash<std::string>()(name));
+        return directory + "/" + base + "-" + hash + ".lppc";
+    }
+
+    // the name table of a mapped cache, interned as identifiers on first use
+    struct Names {
+        std::vector<std::string_view> texts;
+        std::vector<Ref> idents;
+    };
+
+    // rebuild values the way the parser and resolver allocate them, compounds, quotes and locals
+    // in the arena and everything else interned or on the heap
+
+    static Ref decode(Reader& reader, Names& names, Context& context, unsigned depth) {
+        if(depth > MAX_DEPTH) {
+            reader.fail();
+            return Ref();
+        }
+
+        auto& arena = context.get_arena();
+        switch(static_cast<Tag>(reader.read<uint8_t>())) {
+        case Tag::Compound: {
+            auto size = reader.read<uint32_t>();
+            // every element takes at least a byte
+            if(size > reader.remaining())
+                break;
+            RefList contents(arena.resource());
+            contents.reserve(size);
+            for(uint32_t i = 0; i < size && !reader.failed(); i++)
+                contents.push_back(decode(reader, names, context, depth + 1));
+            return arena.alloc<CompoundValue>(std::move(contents));
+        }
+        case Tag::Ident: {
+            auto index = reader.read<uint32_t>();
+            if(index >= names.texts.size())
+                break;
+            if(!names.idents[index])
+                names.idents[index] = context.get_ident(names.texts[index]);
+            return names.idents[index];
+        }
+        case Tag::String:
+            return context.get_string(reader.read_text());
+        case Tag::Fixnum:
+            return context.get_number(reader.read<int64_t>());
+        case Tag::Bignum: {
+            auto digits = reader.read_text();
+            if(digits.empty() || digits.find_first_not_of("0123456789") != std::string_view::npos)
+                break;
+            return context.get_number(BigInt::parse(digits));
+        }
+        case Tag::Float:
+            return context.get_float(reader.read<double>());
+        case Tag::Quote:
+            return arena.alloc<QuoteValue>(decode(reader, names, context, depth + 1));
+        case Tag::Const: {
+            auto kind = reader.read<uint8_t>();
+            if(kind > ConstValue::Kind::Nil)
+                break;
+            return context.get_const_val(static_cast<ConstValue::Kind>(kind));
+        }
+        case Tag::Local: {
+            auto index = reader.read<uint32_t>();
+            auto frame = reader.read<uint16_t>();
+            auto slot = reader.read<uint16_t>();
+            // locals only ever refer to the innermost frame, see resolver.cpp
+            if(index >= names.texts.size() || frame != 0)
+                break;
+            return arena.alloc<LocalValue>(std::string(names.texts[index]), frame, slot);
+        }
+        }
+
+        reader.fail();
+        return Ref();
+    }
+
+    std::optional<Ref> read_cache(const std::string& path, const char* filename, std::string_view source, Context& context) {
+        struct stat info;
+        if(stat(filename, &info) != 0)
+            return std::nullopt;
+
+        auto file = MappedFile::open(path);
+        if(!file)
+            return std::nullopt;
+
+        auto reader = Reader(file->data(), file->size());
+        auto header = reader.read<Header>();
+        bool valid = !reader.failed() && memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 && header.version == FORMAT_VERSION
+            && header.size == source.size()
+            && (header.mtime == modification_time(info) || header.hash == hash_bytes(source))
+            && header.checksum == hash_bytes(std::string_view(file->data() + sizeof(Header), file->size() - sizeof(Header)));
+
+        std::optional<Ref> program;
+        if(valid) {
+            Names names;
+            if(header.names > reader.remaining())
+                reader.fail();
+            for(uint64_t i = 0; i < header.names && !reader.failed(); i++)
+                names.texts.push_back(reader.read_text());
+            names.idents.resize(names.texts.size());
+
+            auto root = context.alloc<CompoundValue>();
+            for(uint64_t i = 0; i < header.forms && !reader.failed(); i++)
+                root->add_value(decode(reader, names, context, 0));
+            if(!reader.failed())
+                program = root;
+        }
+        return program;
+    }
+
+    // the forms and the names of identifiers and locals they use, in the order they first appear
+    struct Encoder {
+        Writer writer;
+        std::unordered_map<std::string_view, uint32_t> indices;
+        std::vector<std::string_view> names;
+
+        uint32_t name(const std::string& name) {
+            auto [index, added] = indices.try_emplace(name, names.size());
+            if(added)
+                names.push_back(name);
+            return index->second;
+        }
+    };
+
+    static bool encode(Encoder& encoder, Ref value, unsigned depth) {
+        if(depth > MAX_DEPTH)
+            return false;
+
+        auto& writer = encoder.writer;
+
+        switch(value.kind()) {
+        case ValueKind::Compound: {
+            auto& contents = dynamic_cast<CompoundValue&>(*value).get_contents();
+            writer.write(Tag::Compound);
+            writer.write(uint32_t(contents.size()));
+            for(auto& content : contents) {
+                if(!encode(encoder, content, depth + 1))
+                    return false;
+            }
+            return true;
+        }
+        case ValueKind::Ident:
+            writer.write(Tag::Ident);
+            writer.write(encoder.name(dynamic_cast<IdentValue&>(*value).get_name()));
+            return true;
+        case ValueKind::String:
+            writer.write(Tag::String);
+            writer.write_text(dynamic_cast<StringValue&>(*value).get_value());
+            return true;
+        case ValueKind::Number: {
+            if(value.is_fixnum()) {
+                writer.write(Tag::Fixnum);
+                writer.write(int64_t(value.fixnum()));
+                return true;
+            }
+            // literals are never negative
+            auto digits = dynamic_cast<NumberValue&>(*value).value().to_string();
+            if(digits.empty() || digits[0] == '-')
+                return false;
+            writer.write(Tag::Bignum);
+            writer.write_text(digits);
+            return true;
+        }
+        case ValueKind::Float:
+            writer.write(Tag::Float);
+            writer.write(dynamic_cast<FloatValue&>(*value).value());
+            return true;
+        case ValueKind::Quote:
+            writer.write(Tag::Quote);
+            return encode(encoder, dynamic_cast<QuoteValue&>(*value).get_quoted(), depth + 1);
+        case ValueKind::Const:
+            writer.write(Tag::Const);
+            writer.write(uint8_t(value.const_kind()));
+            return true;
+        case ValueKind::Local: {
+            auto& local = dynamic_cast<LocalValue&>(*value);
+            writer.write(Tag::Local);
+            writer.write(encoder.name(local.get_name()));
+            writer.write(local.get_depth());
+            writer.write(local.get_slot());
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+
+    bool write_cache(const std::string& path, const char* filename, std::string_view source, Ref program) {
+        struct stat info;
+        if(stat(filename, &info) != 0)
+            return false;
+
+        auto& forms = dynamic_cast<CompoundValue&>(*program).get_contents();
+        Header header;
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = FORMAT_VERSION;
+        header.size = source.size();
+        header.mtime = modification_time(info);
+        header.hash = hash_bytes(source);
+        header.forms = forms.size();
+
+        Encoder encoder;
+        for(auto& form : forms) {
+            if(!encode(encoder, form, 0))
+                return false;
+        }
+        header.names = encoder.names.size();
+
+        Writer payload;
+        for(auto name : encoder.names)
+            payload.write_text(name);
+        payload.output() += encoder.writer.output();
+        header.checksum = hash_bytes(payload.output());
+
+        Writer writer;
+        writer.write(header);
+        writer.output() += payload.output();
+        return write_file(path, writer.output());
+    }
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "value.hpp"
+
+namespace lisp {
+    // Precompiled program cache (`.lppc` files).
+    //
+    // A cache holds the top-level forms of a source file after parsing and resolving, encoded
+    // depth-first with one tag byte per value. Loading one maps the file and rebuilds the forms
+    // without lexing. It is only used while it matches its source: the size and modification time
+    // have to be equal, or else the hash of the text, in which case the file was just touched. A
+    // checksum of the encoded forms catches a corrupted cache, which is parsed again like a stale one.
+    // Optimizing isn't cached, since it depends on the options and the globals.
+
+    // where the cache of `filename` is kept: next to it, with `.lisp` replaced by `.lppc`, or in
+    // `directory`, named after the absolute path of the source if `directory` isn't empty
+    std::string cache_path(const char* filename, const std::string& directory);
+
+    // the program cached at `path` for the source `filename` with the text `source`, as a compound
+    // of top-level forms. nullopt if there is no usable cache
+    std::optional<Ref> read_cache(const std::string& path, const char* filename, std::string_view source, Context& context);
+
+    // cache a parsed and resolved program, replacing the file atomically. false if the program
+    // holds values that can't be cached or the file can't be written
+    bool write_cache(const std::string& path, const char* filename, std::string_view source, Ref program);
+}
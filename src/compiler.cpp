@@ -0,0 +1,431 @@
+#include "compiler.hpp"
+#include "builtin.hpp"
+#include "value.hpp"
+
+namespace lisp {
+    class Compiler {
+    public:
+        Compiler(Context& context, Chunk& chunk)
+            : m_Context(context), m_Chunk(chunk) {}
+        ~Compiler() {}
+
+        // calls in tail position replace the current function frame instead of pushing one
+        void compile(Ref value, bool tail = false) {
+            switch(value.kind()) {
+            case ValueKind::Ident:
+                m_Chunk.emit(OpCode::Global);
+                m_Chunk.emit_u32(m_Chunk.add_name(dynamic_cast<IdentValue&>(*value).get_name()));
+                break;
+            case ValueKind::Local:
+                emit_slot(OpCode::Local, dynamic_cast<LocalValue&>(*value).get_slot());
+                break;
+            case ValueKind::Quote:
+                emit_const(dynamic_cast<QuoteValue&>(*value).get_quoted());
+                break;
+            case ValueKind::Compound:
+                m_Tail = tail;
+                compile_compound(value);
+                break;
+            default:
+                emit_const(value.eval(m_Context));
+            }
+        }
+
+        // evaluate all values from `first` on, stopping at the first error
+        void compile_sequence(RefList& contents, bool tail = false, size_t first = 0) {
+            if(contents.size() == first) {
+                emit_const(m_Context.alloc<CompoundValue>());
+                return;
+            }
+
+            std::vector<size_t> errors;
+            for(size_t i = first; i < contents.size() - 1; i++) {
+                compile(contents[i]);
+                m_Chunk.emit(OpCode::JumpIfError);
+                errors.push_back(m_Chunk.emit_jump());
+                m_Chunk.emit(OpCode::Pop);
+            }
+            compile(contents.back(), tail);
+
+            for(auto error : errors)
+                m_Chunk.patch(error);
+        }
+
+    private:
+        using Handler = void (Compiler::*)(RefList& args);
+        static const std::unordered_map<std::string, Handler> HANDLERS;
+
+        Context& m_Context;
+        Chunk& m_Chunk;
+        // whether the compound being compiled is in tail position
+        bool m_Tail = false;
+
+        void emit_const(Ref value) {
+            m_Chunk.emit(OpCode::Const);
+            m_Chunk.emit_u32(m_Chunk.add_constant(value));
+        }
+
+        void emit_error(const char* reason) {
+            emit_const(m_Context.get_error(reason));
+        }
+
+        // an instruction on a slot of the frame, which grows to hold it
+        void emit_slot(OpCode op, uint16_t slot) {
+            if(slot > UINT8_MAX)
+                return emit_error("too many local variables");
+            m_Chunk.emit(op);
+            m_Chunk.emit_u8(slot);
+            m_Chunk.reserve_slots(slot + 1);
+        }
+
+        // `(name value)` pairs, with names the resolver turned into slots
+        static bool is_binding(Ref value) {
+            if(value.kind() != ValueKind::Compound)
+                return false;
+            auto& pair = dynamic_cast<CompoundValue&>(*value).get_contents();
+            return pair.size() == 2 && pair[0].kind() == ValueKind::Local;
+        }
+
+        // evaluate the body of a loop for its effects, jumping to one of `ends` with an error
+        void compile_loop_body(RefList& args, size_t first, std::vector<size_t>& ends) {
+            for(size_t i = first; i < args.size(); i++) {
+                compile(args[i]);
+                m_Chunk.emit(OpCode::JumpIfError);
+                ends.push_back(m_Chunk.emit_jump());
+                m_Chunk.emit(OpCode::Pop);
+            }
+        }
+
+        void compile_compound(Ref value) {
+            auto& contents = dynamic_cast<CompoundValue&>(*value).get_contents();
+            if(!contents.empty() && contents[0].kind() == ValueKind::Local)
+                return compile_call(contents);
+            if(contents.empty() || contents[0].kind() != ValueKind::Ident)
+                return compile_sequence(contents, m_Tail);
+
+            auto& name = dynamic_cast<IdentValue&>(*contents[0]).get_name();
+            auto handler = HANDLERS.find(name);
+            if(handler != HANDLERS.end())
+                return (this->*handler->second)(contents);
+
+            // builtins without a dedicated opcode evaluate their arguments themselves
+            auto builtin = BUILTINS.find(name);
+            if(builtin != BUILTINS.end()) {
+                m_Chunk.emit(OpCode::Builtin);
+                m_Chunk.emit_u16(m_Chunk.add_builtin(builtin->second));
+                m_Chunk.emit_u32(m_Chunk.add_constant(value));
+                return;
+            }
+
+            compile_call(contents);
+        }
+
+        void compile_call(RefList& args) {
+            if(args.size() - 1 > UINT8_MAX)
+                return emit_error("too many arguments for function call");
+            bool tail = m_Tail;
+
+            if(args[0].kind() == ValueKind::Local) {
+                compile(args[0]);
+                m_Chunk.emit(OpCode::Callee);
+            }
+            else {
+                m_Chunk.emit(OpCode::Function);
+                m_Chunk.emit_u32(m_Chunk.add_name(dynamic_cast<IdentValue&>(*args[0]).get_name()));
+            }
+            m_Chunk.emit_u8(args.size() - 1);
+            auto end = m_Chunk.emit_jump();
+
+            for(size_t i = 1; i < args.size(); i++)
+                compile(args[i]);
+
+            m_Chunk.emit(tail ? OpCode::TailCall : OpCode::Call);
+            m_Chunk.emit_u8(args.size() - 1);
+            m_Chunk.patch(end);
+        }
+
+        void compile_print(RefList& args) {
+            if(args.size() - 1 > UINT16_MAX)
+                return emit_error("too many arguments for `print`");
+
+            for(size_t i = 1; i < args.size(); i++)
+                compile(args[i]);
+            m_Chunk.emit(OpCode::Print);
+            m_Chunk.emit_u16(args.size() - 1);
+        }
+
+        void compile_setq(RefList& args) {
+            if(args.size() != 3)
+                return emit_error("expect 2 arguments for `setq`");
+
+            if(args[1].kind() == ValueKind::Local) {
+                compile(args[2]);
+                emit_slot(OpCode::SetLocal, dynamic_cast<LocalValue&>(*args[1]).get_slot());
+                return;
+            }
+            if(args[1].kind() != ValueKind::Ident)
+                return emit_error("expect first `setq` argument to be an identifier");
+
+            compile(args[2]);
+            m_Chunk.emit(OpCode::SetGlobal);
+            m_Chunk.emit_u32(m_Chunk.add_name(dynamic_cast<IdentValue&>(*args[1]).get_name()));
+        }
+
+        void compile_defun(RefList& args) {
+            if(args.size() != 4)
+                return emit_error("expect 4 arguments for `defun`");
+            if(args[1].kind() != ValueKind::Ident)
+                return emit_error("expect first `defun` argument to be an identifier");
+            if(args[2].kind() != ValueKind::Compound)
+                return emit_error("expect second `defun` argument to be a compound");
+
+            std::vector<std::string> argument_names;
+            for(auto& argument : dynamic_cast<CompoundValue&>(*args[2]).get_contents()) {
+                if(argument.kind() != ValueKind::Ident)
+                    return emit_error("expect arguments to be identifiers");
+                argument_names.push_back(dynamic_cast<IdentValue&>(*argument).get_name());
+            }
+            if(argument_names.size() > UINT8_MAX)
+                return emit_error("too many arguments for `defun`");
+
+            auto& name = dynamic_cast<IdentValue&>(*args[1]).get_name();
+            m_Chunk.emit(OpCode::Defun);
+            m_Chunk.emit_u32(m_Chunk.add_constant(m_Context.alloc<FunctionValue>(name, argument_names, args[3])));
+        }
+
+        void compile_eq(RefList& args) {
+            if(args.size() < 3)
+                return emit_error("expect at least 2 arguments for `eq`");
+
+            compile(args[1]);
+            std::vector<size_t> ends;
+            for(size_t i = 2; i < args.size(); i++) {
+                compile(args[i]);
+                m_Chunk.emit(OpCode::Eq);
+                ends.push_back(m_Chunk.emit_jump());
+            }
+            m_Chunk.emit(OpCode::EqEnd);
+
+            for(auto end : ends)
+                m_Chunk.patch(end);
+        }
+
+        void compile_cond(RefList& args) {
+            if(args.size() < 4 || args.size() % 2 == 1)
+                return emit_error("expect uneven amount of four or more arguments for `cond`");
+            bool tail = m_Tail;
+
+            std::vector<size_t> ends;
+            for(size_t i = 1; i < args.size() - 1; i += 2) {
+                compile(args[i]);
+                m_Chunk.emit(OpCode::Test);
+                auto otherwise = m_Chunk.emit_jump();
+                ends.push_back(m_Chunk.emit_jump());
+
+                compile(args[i + 1], tail);
+                m_Chunk.emit(OpCode::Jump);
+                ends.push_back(m_Chunk.emit_jump());
+                m_Chunk.patch(otherwise);
+            }
+            compile(args.back(), tail);
+
+            for(auto end : ends)
+                m_Chunk.patch(end);
+        }
+
+        void compile_if(RefList& args) {
+            if(args.size() != 4)
+                return emit_error("expect exactly 3 arguments for `if`");
+            bool tail = m_Tail;
+
+            compile(args[1]);
+            m_Chunk.emit(OpCode::Test);
+            auto otherwise = m_Chunk.emit_jump();
+            auto end = m_Chunk.emit_jump();
+
+            compile(args[2], tail);
+            m_Chunk.emit(OpCode::Jump);
+            auto skip = m_Chunk.emit_jump();
+            m_Chunk.patch(otherwise);
+            compile(args[3], tail);
+
+            m_Chunk.patch(end);
+            m_Chunk.patch(skip);
+        }
+
+        // the values are stored in their slots as they are evaluated, the body runs in tail position
+        void compile_let(RefList& args) {
+            if(args.size() < 3)
+                return emit_error("expect at least 2 arguments for `let`");
+            if(args[1].kind() != ValueKind::Compound)
+                return emit_error("expect first `let` argument to be a list of bindings");
+            auto& bindings = dynamic_cast<CompoundValue&>(*args[1]).get_contents();
+            for(auto& binding : bindings) {
+                if(!is_binding(binding))
+                    return emit_error("expect `let` bindings to be pairs of an identifier and a value");
+                if(dynamic_cast<LocalValue&>(*dynamic_cast<CompoundValue&>(*binding).get_contents()[0]).get_slot() > UINT8_MAX)
+                    return emit_error("too many local variables");
+            }
+            bool tail = m_Tail;
+
+            std::vector<size_t> ends;
+            for(auto& binding : bindings) {
+                auto& pair = dynamic_cast<CompoundValue&>(*binding).get_contents();
+                compile(pair[1]);
+                m_Chunk.emit(OpCode::JumpIfError);
+                ends.push_back(m_Chunk.emit_jump());
+                emit_slot(OpCode::SetLocal, dynamic_cast<LocalValue&>(*pair[0]).get_slot());
+                m_Chunk.emit(OpCode::Pop);
+            }
+            compile_sequence(args, tail, 2);
+
+            for(auto end : ends)
+                m_Chunk.patch(end);
+        }
+
+        void compile_while(RefList& args) {
+            if(args.size() < 2)
+                return emit_error("expect at least 1 argument for `while`");
+
+            auto loop = m_Chunk.size();
+            std::vector<size_t> ends;
+            compile(args[1]);
+            m_Chunk.emit(OpCode::Test);
+            auto otherwise = m_Chunk.emit_jump();
+            ends.push_back(m_Chunk.emit_jump());
+
+            compile_loop_body(args, 2, ends);
+            m_Chunk.emit(OpCode::Loop);
+            m_Chunk.emit_u32(loop);
+            m_Chunk.patch(otherwise);
+            emit_const(m_Context.get_const_val(ConstValue::Kind::Nil));
+
+            for(auto end : ends)
+                m_Chunk.patch(end);
+        }
+
+        // the count and the counter are kept in the two slots the resolver reserved after the name
+        void compile_dotimes(RefList& args) {
+            if(args.size() < 2)
+                return emit_error("expect at least 1 argument for `dotimes`");
+            if(!is_binding(args[1]))
+                return emit_error("expect first `dotimes` argument to be a pair of an identifier and a count");
+            auto& pair = dynamic_cast<CompoundValue&>(*args[1]).get_contents();
+            auto slot = dynamic_cast<LocalValue&>(*pair[0]).get_slot();
+            if(slot + 2 > UINT8_MAX)
+                return emit_error("too many local variables");
+            m_Chunk.reserve_slots(slot + 3);
+
+            std::vector<size_t> ends;
+            compile(pair[1]);
+            m_Chunk.emit(OpCode::Count);
+            m_Chunk.emit_u8(slot);
+            ends.push_back(m_Chunk.emit_jump());
+
+            auto loop = m_Chunk.size();
+            m_Chunk.emit(OpCode::Next);
+            m_Chunk.emit_u8(slot);
+            ends.push_back(m_Chunk.emit_jump());
+
+            compile_loop_body(args, 2, ends);
+            m_Chunk.emit(OpCode::Loop);
+            m_Chunk.emit_u32(loop);
+
+            for(auto end : ends)
+                m_Chunk.patch(end);
+        }
+
+        void compile_arithmetic(RefList& args, OpCode op, const char* error) {
+            if(args.size() < 2)
+                return emit_error(error);
+            if(args.size() - 1 > UINT8_MAX)
+                return emit_error("too many arguments for arithmetic");
+
+            for(size_t i = 1; i < args.size(); i++)
+                compile(args[i]);
+            m_Chunk.emit(op);
+            m_Chunk.emit_u8(args.size() - 1);
+        }
+
+        void compile_comparison(RefList& args, OpCode op, const char* error) {
+            if(args.size() != 3)
+                return emit_error(error);
+
+            compile(args[1]);
+            compile(args[2]);
+            m_Chunk.emit(op);
+        }
+
+        void compile_add(RefList& args) {
+            compile_arithmetic(args, OpCode::Add, "expect at least 1 argument for `+`");
+        }
+
+        void compile_subtract(RefList& args) {
+            compile_arithmetic(args, OpCode::Subtract, "expect at least 1 argument for `-`");
+        }
+
+        void compile_multiply(RefList& args) {
+            compile_arithmetic(args, OpCode::Multiply, "expect at least 1 argument for `*`");
+        }
+
+        void compile_divide(RefList& args) {
+            compile_arithmetic(args, OpCode::Divide, "expect at least 1 argument for `/`");
+        }
+
+        void compile_lt(RefList& args) {
+            compile_comparison(args, OpCode::Lt, "expect exactly 2 arguments for `<`");
+        }
+
+        void compile_gt(RefList& args) {
+            compile_comparison(args, OpCode::Gt, "expect exactly 2 arguments for `>`");
+        }
+
+        void compile_lt_eq(RefList& args) {
+            compile_comparison(args, OpCode::LtEq, "expect exactly 2 arguments for `<=`");
+        }
+
+        void compile_gt_eq(RefList& args) {
+            compile_comparison(args, OpCode::GtEq, "expect exactly 2 arguments for `>=`");
+        }
+    };
+
+    const std::unordered_map<std::string, Compiler::Handler> Compiler::HANDLERS = {
+        {"print", &Compiler::compile_print},
+        {"setq", &Compiler::compile_setq},
+        {"defun", &Compiler::compile_defun},
+        {"eq", &Compiler::compile_eq},
+        {"cond", &Compiler::compile_cond},
+        {"if", &Compiler::compile_if},
+        {"let", &Compiler::compile_let},
+        {"while", &Compiler::compile_while},
+        {"dotimes", &Compiler::compile_dotimes},
+        {"+", &Compiler::compile_add},
+        {"-", &Compiler::compile_subtract},
+        {"*", &Compiler::compile_multiply},
+        {"/", &Compiler::compile_divide},
+        {"<", &Compiler::compile_lt},
+        {">", &Compiler::compile_gt},
+        {"<=", &Compiler::compile_lt_eq},
+        {">=", &Compiler::compile_gt_eq}
+    };
+
+    Ref compile_program(Ref program, Context& context) {
+        auto function = context.alloc<FunctionValue>("program", std::vector<std::string>(), program);
+        auto chunk = std::make_shared<Chunk>();
+        // builtins without an opcode evaluate their `let` forms in the frame of the chunk
+        chunk->reserve_slots(function->get_frame_size());
+        Compiler(context, *chunk).compile_sequence(dynamic_cast<CompoundValue&>(*program).get_contents());
+        chunk->emit(OpCode::Return);
+
+        function->set_code(chunk);
+        return function;
+    }
+
+    std::shared_ptr<Chunk> compile_function(FunctionValue& function, Context& context) {
+        auto chunk = std::make_shared<Chunk>();
+        chunk->reserve_slots(function.get_frame_size());
+        Compiler(context, *chunk).compile(function.get_body(), true);
+        chunk->emit(OpCode::Return);
+        return chunk;
+    }
+}
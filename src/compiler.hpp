@@ -0,0 +1,12 @@
+#pragma once
+
+#include "bytecode.hpp"
+#include "value.hpp"
+
+namespace lisp {
+    // compile a sequence of top-level forms into a function without arguments
+    Ref compile_program(Ref program, Context& context);
+
+    // compile a function body
+    std::shared_ptr<Chunk> compile_function(FunctionValue& function, Context& context);
+}
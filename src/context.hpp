@@ -1,83 +1,340 @@
 #pragma once
 
+#include <algorithm>
 #include <iostream>
 #include <memory>
 
+#include <sys/resource.h>
+
 #include "value.hpp"
+#include "gc.hpp"
+#include "arena.hpp"
+#include "memo.hpp"
 
 namespace lisp {
+    class Profiler;
+    class ThreadPool;
+    class Scheduler;
+
     class Context {
     public:
-        Context() : m_SymbolStack() {
-            this->push();
+        Context() {
+            char marker;
+            m_StackBase = &marker;
+
+            struct rlimit limit;
+            if(getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+                m_StackLimit = std::min<size_t>(limit.rlim_cur, MAX_STACK_LIMIT);
+            m_StackLimit -= STACK_RESERVE;
         }
+
+        // worker contexts evaluate `pcall` and `pmap` tasks on their own thread, with their own
+        // heap, stack and interning tables. they see the globals of `parent`, which stays
+        // unchanged while they run, but their own definitions are local to the running task
+        Context(Context& parent, uint16_t heap_id, size_t stack_size)
+            : m_Parent(&parent), m_StackBase(static_cast<const char*>(__builtin_frame_address(0))),
+              m_StackLimit(stack_size - STACK_RESERVE), m_Version(0), m_Heap(heap_id) {}
         ~Context() {}
 
-        std::optional<std::shared_ptr<Value>> get_symbol(std::string& name) {
-            for(int64_t i = m_SymbolStack.size() - 1; i >= 0; i--) {
-                auto value = m_SymbolStack[i].find(name);
-                if(value != m_SymbolStack[i].end())
-                    return value->second;
-            }
+        bool is_worker() const { return m_Parent; }
+
+        struct MemoCall {
+            FunctionValue* function;
+            std::vector<Ref> key;
+        };
+
+        // everything a coroutine evaluates on, swapped in by the scheduler while it runs
+        struct State {
+            std::vector<Ref> stack;
+            std::vector<size_t> frames;
+            std::vector<MemoCall> memos;
+            const char* stack_base = nullptr;
+            size_t stack_limit = 0;
+        };
+
+        void swap_state(State& state) {
+            std::swap(m_Stack, state.stack);
+            std::swap(m_Frames, state.frames);
+            std::swap(m_Memos, state.memos);
+            std::swap(m_StackBase, state.stack_base);
+            std::swap(m_StackLimit, state.stack_limit);
+        }
+
+        // the native stack of a coroutine, minus the usual reserve
+        static State new_state(const char* stack_base, size_t stack_size) {
+            State state;
+            state.stack_base = stack_base;
+            state.stack_limit = stack_size - STACK_RESERVE;
+            return state;
+        }
+
+        // the values of the innermost function frame, which `spawn` copies into a task
+        std::vector<Ref> get_frame() const {
+            if(m_Frames.empty())
+                return {};
+            return std::vector<Ref>(m_Stack.begin() + m_Frames.back(), m_Stack.end());
+        }
+
+        // measure the stack depth from the top of a native stack of `size` bytes, for contexts
+        // entered from another thread than the one that created them
+        void set_stack(const char* base, size_t size) {
+            m_StackBase = base;
+            m_StackLimit = std::min(size, MAX_STACK_LIMIT) - STACK_RESERVE;
+        }
+
+        // whether the native stack is too deep to enter another function call
+        bool stack_exhausted() const {
+            char marker;
+            return static_cast<size_t>(m_StackBase - &marker) > m_StackLimit;
+        }
+
+        std::optional<Ref> get_symbol(const std::string& name) {
+            auto value = m_Globals.find(name);
+            if(value != m_Globals.end())
+                return value->second;
+            if(m_Parent)
+                return m_Parent->get_symbol(name);
             return std::nullopt;
         }
 
-        void add_symbol(std::string name, std::shared_ptr<Value> value) {
-            m_SymbolStack.back().insert_or_assign(name, value);
+        void add_symbol(std::string name, Ref value) {
+            auto& binding = m_Globals[name];
+            // call sites cache function targets until a function binding changes
+            if(is_function(value) || (binding && is_function(binding)))
+                m_Version++;
+            binding = value;
+        }
+
+        const std::unordered_map<std::string, Ref>& get_globals() const { return m_Globals; }
+
+        // workers add their own definitions to the parent's version, so call sites cached by the
+        // parent only match while a worker hasn't defined any functions
+        uint64_t get_version() const {
+            if(m_Parent)
+                return m_Parent->m_Version + m_Version;
+            return m_Version;
+        }
+
+        // forget the definitions of a worker's previous task
+        void clear_globals() {
+            m_Globals.clear();
+            m_Version = 0;
+        }
+
+        // function frames are fixed-size windows into the value stack holding the arguments
+        void push(Ref value) {
+            m_Stack.push_back(value);
+        }
+
+        Ref pop() {
+            auto value = m_Stack.back();
+            m_Stack.pop_back();
+            return value;
+        }
+
+        // the frame of `size` slots starts with the `arity` arguments on top of the stack, the
+        // rest are `NIL` until the `let` bindings in them are evaluated
+        void push_frame(size_t arity, size_t size) {
+            m_Frames.push_back(m_Stack.size() - arity);
+            resize_frame(size);
+        }
+
+        // drop anything above the first `size` slots of the innermost frame, or add `NIL` slots
+        void resize_frame(size_t size) {
+            m_Stack.resize(m_Frames.back() + size, get_const_val(ConstValue::Kind::Nil));
+        }
+
+        void pop_frame() {
+            m_Stack.resize(m_Frames.back());
+            m_Frames.pop_back();
+        }
+
+        // move the callee and arguments of a tail call, pushed right above the current frame of
+        // `size` slots, into the current frame and return the new callee. the frame holds only
+        // the new arguments until it is resized for the callee
+        Ref replace_frame(size_t size) {
+            size_t base = m_Frames.back();
+            std::move(m_Stack.begin() + base + size, m_Stack.end(), m_Stack.begin() + base - 1);
+            m_Stack.resize(m_Stack.size() - size - 1);
+            return m_Stack[base - 1];
+        }
+
+        Ref& get_local(uint16_t depth, uint16_t slot) {
+            return m_Stack[m_Frames[m_Frames.size() - depth - 1] + slot];
+        }
+
+        std::vector<Ref>& get_stack() { return m_Stack; }
+
+        // memoized calls in progress, keyed by the arguments they were called with, since the
+        // frame's arguments can be reassigned by the time the result is stored
+        void push_memo(FunctionValue* function, std::vector<Ref> key) {
+            m_Memos.push_back({function, std::move(key)});
+        }
+
+        void pop_memo(Ref result) {
+            auto& call = m_Memos.back();
+            // errors like an exceeded stack depth depend on where the call happened
+            if(result.kind() != ValueKind::Error)
+                call.function->get_memo()->insert(std::move(call.key), result);
+            m_Memos.pop_back();
+        }
+
+        template<typename T, typename... Args>
+        T* alloc(Args&&... args) {
+            return m_Heap.alloc<T>(std::forward<Args>(args)...);
+        }
+
+        // values that stay alive independently of the symbols and the stack
+        void add_root(Ref value) {
+            m_Roots.push_back(value);
+        }
+
+        void remove_root(Ref value) {
+            auto root = std::find_if(m_Roots.rbegin(), m_Roots.rend(), [&](Ref other) { return other.bits() == value.bits(); });
+            if(root != m_Roots.rend())
+                m_Roots.erase(std::next(root).base());
+        }
+
+        // collect garbage if enough has been allocated since the last collection
+        void safepoint() {
+            if(m_Heap.should_collect())
+                collect();
+        }
+
+        void collect();
+
+        // pool running `pcall` and `pmap` tasks, created on their first use
+        const std::shared_ptr<ThreadPool>& get_pool() const { return m_Pool; }
+        void set_pool(std::shared_ptr<ThreadPool> pool) { m_Pool = pool; }
+        // forget the pool without joining its threads, which don't exist in a forked child. the
+        // next parallel call starts a new one
+        void detach_pool() { new std::shared_ptr<ThreadPool>(std::move(m_Pool)); }
+
+        // scheduler of `spawn`ed tasks, created on the first spawn
+        const std::shared_ptr<Scheduler>& get_scheduler() const { return m_Scheduler; }
+        void set_scheduler(std::shared_ptr<Scheduler> scheduler) { m_Scheduler = scheduler; }
+
+        // worker threads of the pool, 0 for one per core
+        size_t get_threads() const { return m_Threads; }
+        void set_threads(size_t threads) { m_Threads = threads; }
+
+        // function calls report to the profiler while one is set
+        void set_profiler(Profiler* profiler) { m_Profiler = profiler; }
+        Profiler* get_profiler() const { return m_Profiler; }
+
+        Heap& get_heap() { return m_Heap; }
+        Arena& get_arena() { return m_Arena; }
+
+        // nodes built by the parser, resolver and optimizer. they live in the arena, except
+        // while forms are streamed, where they go on the heap so forms nothing refers to
+        // anymore are collected
+        template<typename T, typename... Args>
+        T* alloc_syntax(Args&&... args) {
+            if(m_StreamSyntax)
+                return alloc<T>(std::forward<Args>(args)...);
+            return m_Arena.alloc<T>(std::forward<Args>(args)...);
+        }
+        // memory resource for the child arrays of `alloc_syntax` nodes
+        std::pmr::memory_resource* syntax_resource() {
+            return m_StreamSyntax ? std::pmr::get_default_resource() : m_Arena.resource();
+        }
+        void set_stream_syntax(bool stream) { m_StreamSyntax = stream; }
+
+        Ref get_const_val(ConstValue::Kind kind) const {
+            return Ref::constant(kind);
         }
 
-        void push() {
-            m_SymbolStack.push_back({});
+        Ref get_number(int64_t number) {
+            if(number >= Ref::FIXNUM_MIN && number <= Ref::FIXNUM_MAX)
+                return Ref::fixnum(number);
+            return alloc<NumberValue>(BigInt(number));
         }
 
-        void pop() {
-            m_SymbolStack.pop_back();
+        // bignum results are boxed only if they don't fit into a fixnum
+        Ref get_number(BigInt number) {
+            if(number.fits_int64())
+                return get_number(number.to_int64());
+            return alloc<NumberValue>(std::move(number));
         }
 
-        const std::shared_ptr<ConstValue> get_const_val(ConstValue::Kind kind) const {
-            return m_ConstVals[kind];
+        Ref get_float(double value) {
+            return alloc<FloatValue>(value);
         }
 
-        const std::shared_ptr<StringValue> get_string(std::string string) {
+        // interned values are never freed, so their keys can view the value's own text.
+        // literals of collectable syntax are collected with it instead
+        Ref get_string(std::string_view string) {
+            if(m_StreamSyntax)
+                return alloc<StringValue>(std::string(string));
+
             auto value = m_Strings.find(string);
             if(value != m_Strings.end())
                 return value->second;
 
-            auto new_ptr = std::make_shared<StringValue>(string);
-            m_Strings.insert_or_assign(string, new_ptr);
+            auto new_ptr = alloc<StringValue>(std::string(string));
+            m_Strings.emplace(new_ptr->get_value(), new_ptr);
             return new_ptr;
         }
 
-        const std::shared_ptr<NumberValue> get_number(int64_t number) {
-            auto value = m_Numbers.find(number);
-            if(value != m_Numbers.end())
+        Ref get_ident(std::string_view name) {
+            auto value = m_Idents.find(name);
+            if(value != m_Idents.end())
                 return value->second;
-            
-            auto new_ptr = std::make_shared<NumberValue>(number);
-            m_Numbers.insert_or_assign(number, new_ptr);
+
+            auto new_ptr = alloc<IdentValue>(std::string(name));
+            m_Idents.emplace(new_ptr->get_name(), new_ptr);
             return new_ptr;
         }
 
-        const std::shared_ptr<IdentValue> get_ident(std::string name) {
-            auto value = m_Idents.find(name);
-            if(value != m_Idents.end())
+        // the fixed messages of the interpreter are interned, so returning one doesn't allocate
+        Ref get_error(const char* reason) {
+            auto value = m_Errors.find(reason);
+            if(value != m_Errors.end())
                 return value->second;
 
-            auto new_ptr = std::make_shared<IdentValue>(name);
-            m_Idents.insert_or_assign(name, new_ptr);
+            auto new_ptr = alloc<ErrorValue>(reason);
+            m_Errors.emplace(reason, new_ptr);
             return new_ptr;
         }
 
+        // messages built at runtime, which may contain user data, are collected like any value
+        Ref get_error(std::string reason) {
+            return alloc<ErrorValue>(std::move(reason));
+        }
+
     private:
-        std::vector<std::unordered_map<std::string, std::shared_ptr<Value>>> m_SymbolStack;
-        std::unordered_map<std::string, std::shared_ptr<StringValue>> m_Strings;
-        std::unordered_map<int64_t, std::shared_ptr<NumberValue>> m_Numbers;
-        std::unordered_map<std::string, std::shared_ptr<IdentValue>> m_Idents;
-
-        const std::shared_ptr<ConstValue> m_ConstVals[3] = {
-            std::make_shared<ConstValue>(ConstValue::Kind::T),
-            std::make_shared<ConstValue>(ConstValue::Kind::F),
-            std::make_shared<ConstValue>(ConstValue::Kind::Nil)
-        };
+        static constexpr size_t MAX_STACK_LIMIT = 64 << 20;
+        // room left for builtins and the evaluation between two function calls
+        static constexpr size_t STACK_RESERVE = 256 << 10;
+
+        static bool is_function(Ref value) {
+            return value.kind() == ValueKind::Function || value.kind() == ValueKind::Native;
+        }
+
+        Context* m_Parent = nullptr;
+        const char* m_StackBase;
+        size_t m_StackLimit = 8 << 20;
+
+        std::unordered_map<std::string, Ref> m_Globals;
+        uint64_t m_Version = 1;
+        std::vector<Ref> m_Stack;
+        std::vector<size_t> m_Frames;
+        std::vector<MemoCall> m_Memos;
+
+        Heap m_Heap;
+        Arena m_Arena;
+        bool m_StreamSyntax = false;
+        Profiler* m_Profiler = nullptr;
+        std::vector<Ref> m_Roots;
+
+        std::unordered_map<std::string_view, StringValue*> m_Strings;
+        std::unordered_map<std::string_view, IdentValue*> m_Idents;
+        std::unordered_map<std::string, ErrorValue*> m_Errors;
+
+        std::shared_ptr<Scheduler> m_Scheduler;
+
+        size_t m_Threads = 0;
+        // destroyed first, joining the workers before anything they can see goes away
+        std::shared_ptr<ThreadPool> m_Pool;
     };
 }
@@ -1,75 +1,292 @@
+#include <mutex>
+
 #include "value.hpp"
 #include "builtin.hpp"
+#include "profiler.hpp"
+#include "resolver.hpp"
 
 namespace lisp {
-    std::shared_ptr<Value> ErrorValue::eval(Context&) {
-        return ERROR(m_Reason);
+    // worker threads can reach calls that weren't evaluated before, the first one resolves them
+    static std::mutex RESOLVE_MUTEX;
+
+    Ref ErrorValue::eval(Context&) {
+        return this;
     }
 
-    std::shared_ptr<Value> EofValue::eval(Context&) {
-        return std::make_shared<EofValue>();
+    Ref StringValue::eval(Context&) {
+        return this;
     }
 
-    std::shared_ptr<Value> StringValue::eval(Context& context) {
-        return context.get_string(m_Value);
+    Ref NumberValue::eval(Context&) {
+        return this;
     }
 
-    std::shared_ptr<Value> NumberValue::eval(Context& context) {
-        return context.get_number(m_Value);
+    Ref FloatValue::eval(Context&) {
+        return this;
     }
 
-    std::shared_ptr<Value> IdentValue::eval(Context& context) {
+    Ref ArrayValue::eval(Context&) {
+        return this;
+    }
+
+    Ref VectorValue::eval(Context&) {
+        return this;
+    }
+
+    Ref MapValue::eval(Context&) {
+        return this;
+    }
+
+    Ref TaskValue::eval(Context&) {
+        return this;
+    }
+
+    Ref ChannelValue::eval(Context&) {
+        return this;
+    }
+
+    Ref PortValue::eval(Context&) {
+        return this;
+    }
+
+    Ref IdentValue::eval(Context& context) {
         if(auto value = context.get_symbol(m_Name))
             return value.value();
         return ERROR("unknown identifier");
     }
 
-    std::shared_ptr<Value> QuoteValue::eval(Context&) {
+    Ref LocalValue::eval(Context& context) {
+        return context.get_local(m_Depth, m_Slot);
+    }
+
+    Ref QuoteValue::eval(Context&) {
         return m_Quoted;
     }
 
-    std::shared_ptr<Value> CompoundValue::eval(Context& context) {
-        if(!m_Contents.empty() && m_Contents[0]->kind() == ValueKind::Ident) {
-            auto name = dynamic_cast<IdentValue&>(*m_Contents[0]);
-            auto builtin = BUILTINS.find(name.get_name());
+    Ref CompoundValue::eval(Context& context) {
+        return evaluate(context, false);
+    }
+
+    Ref CompoundValue::eval_tail(Context& context) {
+        return evaluate(context, true);
+    }
+
+    void CompoundValue::resolve_head() {
+        std::lock_guard<std::mutex> lock(RESOLVE_MUTEX);
+        if(m_Resolved.load(std::memory_order_relaxed))
+            return;
+
+        if(!m_Contents.empty() && m_Contents[0].kind() == ValueKind::Local)
+            m_LocalHead = true;
+        else if(!m_Contents.empty() && m_Contents[0].kind() == ValueKind::Ident) {
+            // identifiers are interned, so the head outlives every collection
+            m_Head = &dynamic_cast<IdentValue&>(*m_Contents[0]);
+            auto& name = m_Head->get_name();
+            auto builtin = BUILTINS.find(name);
             if(builtin != BUILTINS.end())
-                return builtin->second(context, m_Contents);
+                m_Builtin = builtin->second;
+            auto branch = TAIL_BUILTINS.find(name);
+            if(branch != TAIL_BUILTINS.end())
+                m_TailBuiltin = branch->second;
+            auto op = OPERATORS.find(name);
+            if(op != OPERATORS.end() && m_Contents.size() == 3)
+                m_Operator = op->second;
+        }
+        m_Resolved.store(true, std::memory_order_release);
+    }
 
-            if(auto symbol = context.get_symbol(name.get_name())) {
-                if(symbol.value()->kind() != ValueKind::Function)
-                    return ERROR("can only call functions");
-                auto function = dynamic_cast<FunctionValue&>(*symbol.value());
+    void CompoundValue::prepare(Context& context) {
+        if(!m_Resolved.load(std::memory_order_acquire))
+            resolve_head();
+        if(!m_Head || m_Builtin || m_CalleeVersion == context.get_version())
+            return;
+
+        if(auto symbol = context.get_symbol(m_Head->get_name())) {
+            m_Callee = symbol.value();
+            m_CalleeVersion = context.get_version();
+        }
+    }
 
-                if(function.get_arguments().size() != m_Contents.size() - 1)
-                    return ERROR("wrong number of arguments for function call");
-                
-                context.push();
+    Ref CompoundValue::evaluate(Context& context, bool tail) {
+        if(!m_Resolved.load(std::memory_order_acquire))
+            resolve_head();
 
-                for(size_t i = 0; i < function.get_arguments().size(); i++) {
-                    context.add_symbol(function.get_arguments()[i], m_Contents[i + 1]->eval(context));
-                }
+        if(m_Head) {
+            if(m_Operator != Operator::None)
+                return evaluate_operator(context);
+            if(tail && m_TailBuiltin)
+                return m_TailBuiltin(context, m_Contents).eval_tail(context);
+            if(m_Builtin)
+                return m_Builtin(context, m_Contents);
 
-                auto result = function.eval(context);
-                context.pop();
-                return result;
+            if(m_CalleeVersion != context.get_version()) {
+                auto symbol = context.get_symbol(m_Head->get_name());
+                if(!symbol)
+                    return ERROR("could not find function");
+                // the program is shared between worker threads, which leave the cache alone
+                if(context.is_worker())
+                    return call(context, symbol.value(), tail);
+                m_Callee = symbol.value();
+                m_CalleeVersion = context.get_version();
             }
-            return ERROR("could not find function");
-        } 
+            return call(context, m_Callee, tail);
+        }
+
+        if(m_LocalHead)
+            return call(context, m_Contents[0].eval(context), tail);
         
-        std::shared_ptr<Value> result = std::make_shared<CompoundValue>();
-        for(auto& content : m_Contents) {
-            result = content->eval(context);
-            if(result && result->kind() == ValueKind::Error)
+        // `()` evaluates to itself
+        Ref result = this;
+        for(size_t i = 0; i < m_Contents.size(); i++) {
+            if(tail && i == m_Contents.size() - 1)
+                return m_Contents[i].eval_tail(context);
+
+            result = m_Contents[i].eval(context);
+            if(result && result.kind() == ValueKind::Error)
+                return result;
+        }
+        return result;
+    }
+
+    // fixnum operands skip the type checks, anything else goes through `check_operand`
+    Ref CompoundValue::evaluate_operator(Context& context) {
+        auto lhs = m_Contents[1].eval(context);
+        if(m_Operator == Operator::Eq) {
+            if(!lhs.is_heap())
+                return context.get_const_val(lhs.equals(m_Contents[2].eval(context)) ? ConstValue::Kind::T : ConstValue::Kind::F);
+
+            context.push(lhs);
+            bool equal = lhs.equals(m_Contents[2].eval(context));
+            context.pop();
+            return context.get_const_val(equal ? ConstValue::Kind::T : ConstValue::Kind::F);
+        }
+
+        if(lhs.is_fixnum()) {
+            auto rhs = m_Contents[2].eval(context);
+            if(rhs.is_fixnum())
+                return apply_operator(context, m_Operator, lhs.fixnum(), rhs.fixnum());
+            if(auto error = check_operand(context, m_Operator, rhs))
+                return error;
+            return apply_operator(context, m_Operator, lhs, rhs);
+        }
+
+        if(auto error = check_operand(context, m_Operator, lhs))
+            return error;
+        // a bignum `lhs` stays on the stack while evaluating `rhs`, which may collect
+        context.push(lhs);
+        auto rhs = m_Contents[2].eval(context);
+        context.pop();
+        if(auto error = check_operand(context, m_Operator, rhs))
+            return error;
+        return apply_operator(context, m_Operator, lhs, rhs);
+    }
+
+    // evaluate `function` on the callee and arguments on top of the stack, trampolining its tail calls
+    static Ref run(Context& context, FunctionValue* function, Memo* memo) {
+        if(memo) {
+            auto& stack = context.get_stack();
+            std::vector<Ref> key(stack.end() - function->get_arity(), stack.end());
+            if(auto result = memo->find(key)) {
+                stack.resize(stack.size() - function->get_arity() - 1);
+                return result.value();
+            }
+            context.push_memo(function, std::move(key));
+        }
+
+        auto profiler = context.get_profiler();
+        if(profiler)
+            profiler->enter(*function);
+
+        context.push_frame(function->get_arity(), function->get_frame_size());
+        for(;;) {
+            context.safepoint();
+            auto result = function->get_body().eval_tail(context);
+            if(!result.is_tail_call()) {
+                if(profiler)
+                    profiler->leave();
+                context.pop_frame();
+                context.pop();
+                if(memo)
+                    context.pop_memo(result);
                 return result;
+            }
+
+            function = static_cast<FunctionValue*>(context.replace_frame(function->get_frame_size()).get());
+            context.resize_frame(function->get_frame_size());
+            if(profiler)
+                profiler->replace(*function);
         }
+    }
+
+    // native functions get their evaluated arguments, which stay on the stack during the call
+    static Ref call_native(Context& context, NativeValue& native, RefList& contents) {
+        // the host registered them with the main context, whose heap workers can't allocate on
+        if(context.is_worker())
+            return ERROR("can't call native functions in parallel calls");
+
+        auto& stack = context.get_stack();
+        size_t base = stack.size();
+        context.push(&native);
+        for(size_t i = 1; i < contents.size(); i++)
+            context.push(contents[i].eval(context));
+
+        std::vector<Ref> args(stack.begin() + base + 1, stack.end());
+        auto result = native.call(context, args);
+        stack.resize(base);
         return result;
     }
 
-    std::shared_ptr<Value> FunctionValue::eval(Context& context) {
-        return m_Body->eval(context);
+    Ref CompoundValue::call(Context& context, Ref callee, bool tail) {
+        if(callee.kind() == ValueKind::Native)
+            return call_native(context, static_cast<NativeValue&>(*callee), m_Contents);
+        if(callee.kind() != ValueKind::Function)
+            return ERROR("can only call functions");
+        auto function = static_cast<FunctionValue*>(callee.get());
+
+        if(function->get_arity() != m_Contents.size() - 1)
+            return ERROR("wrong number of arguments for function call");
+
+        // memoized functions always get their own frame, to store the result when it returns.
+        // workers don't use memos, which belong to the main context
+        auto memo = context.is_worker() ? nullptr : function->get_memo();
+        if(memo)
+            tail = false;
+
+        if(!tail && context.stack_exhausted())
+            return ERROR("stack depth exceeded");
+
+        // the callee stays on the stack below its arguments to keep it alive
+        context.push(callee);
+        for(size_t i = 1; i < m_Contents.size(); i++)
+            context.push(m_Contents[i].eval(context));
+
+        // let the caller's trampoline replace its frame
+        if(tail)
+            return Ref::tail_call();
+
+        return run(context, function, memo);
+    }
+
+    FunctionValue::FunctionValue(std::string name, std::vector<std::string> arguments, Ref body)
+        : m_Name(name), m_Arguments(arguments), m_Body(body), m_FrameSize(frame_size(body, m_Arguments.size())) {}
+
+    Ref FunctionValue::apply(Context& context, const std::vector<Ref>& arguments) {
+        if(get_arity() != arguments.size())
+            return ERROR("wrong number of arguments for function call");
+        if(context.stack_exhausted())
+            return ERROR("stack depth exceeded");
+
+        context.push(this);
+        for(auto& argument : arguments)
+            context.push(argument);
+        return run(context, this, context.is_worker() ? nullptr : get_memo());
+    }
+
+    Ref FunctionValue::eval(Context& context) {
+        return m_Body.eval(context);
     }
 
-    std::shared_ptr<Value> ConstValue::eval(Context& context) {
-        return context.get_const_val(m_Kind);
+    Ref NativeValue::eval(Context&) {
+        return this;
     }
 }
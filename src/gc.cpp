@@ -0,0 +1,132 @@
+#include "value.hpp"
+#include "gc.hpp"
+#include "bytecode.hpp"
+#include "memo.hpp"
+#include "scheduler.hpp"
+
+namespace lisp {
+    void QuoteValue::trace(Heap& heap) {
+        heap.mark(m_Quoted);
+    }
+
+    void CompoundValue::trace(Heap& heap) {
+        for(auto& value : m_Contents)
+            heap.mark(value);
+        heap.mark(m_Callee);
+    }
+
+    void VectorValue::trace(Heap& heap) {
+        m_Elements.trace(heap);
+    }
+
+    void MapValue::trace(Heap& heap) {
+        m_Entries.trace(heap);
+    }
+
+    void TaskValue::trace(Heap& heap) {
+        heap.mark(m_Expression);
+        heap.mark(m_Result);
+        if(m_Fiber)
+            m_Fiber->trace(heap);
+    }
+
+    void ChannelValue::trace(Heap& heap) {
+        for(auto& value : m_Buffer)
+            heap.mark(value);
+        for(auto& sender : m_Senders)
+            heap.mark(sender.value);
+    }
+
+    void FunctionValue::trace(Heap& heap) {
+        heap.mark(m_Body);
+        if(m_Code) {
+            for(auto& constant : m_Code->get_constants())
+                heap.mark(constant);
+            for(auto& cache : m_Code->get_call_caches())
+                heap.mark(cache.callee);
+        }
+        if(m_Memo)
+            m_Memo->trace(heap);
+    }
+
+    void Context::collect() {
+        m_Heap.begin();
+        for(auto& [_, value] : m_Globals)
+            m_Heap.mark(value);
+        for(auto& value : m_Stack)
+            m_Heap.mark(value);
+        for(auto& value : m_Roots)
+            m_Heap.mark(value);
+        for(auto& call : m_Memos) {
+            m_Heap.mark(call.function);
+            for(auto& value : call.key)
+                m_Heap.mark(value);
+        }
+        for(auto& [_, value] : m_Strings)
+            m_Heap.mark(value);
+        for(auto& [_, value] : m_Idents)
+            m_Heap.mark(value);
+        for(auto& [_, value] : m_Errors)
+            m_Heap.mark(value);
+        // suspended tasks and the state of whoever spawned them
+        if(m_Scheduler)
+            m_Scheduler->trace(m_Heap);
+        m_Heap.finish();
+    }
+
+    void Heap::begin() {
+        m_Start = std::chrono::steady_clock::now();
+    }
+
+    void Heap::finish() {
+        while(!m_Gray.empty()) {
+            auto value = m_Gray.back();
+            m_Gray.pop_back();
+            value->trace(*this);
+            // arena values aren't swept, their marks are cleared separately
+            if(value->m_InArena)
+                m_Arena.push_back(value);
+        }
+
+        size_t live = 0;
+        for(auto& object : m_Objects) {
+            if(object.value->m_Marked) {
+                object.value->m_Marked = false;
+                m_Objects[live++] = object;
+                continue;
+            }
+
+            m_Stats.freed_objects++;
+            m_Stats.freed_bytes += object.size;
+            m_Bytes -= object.size;
+            delete object.value;
+        }
+        m_Objects.resize(live);
+
+        for(auto value : m_Arena)
+            value->m_Marked = false;
+        m_Arena.clear();
+
+        m_Threshold = std::max(m_InitialThreshold, m_Bytes * 2);
+
+        auto pause = std::chrono::steady_clock::now() - m_Start;
+        m_Stats.collections++;
+        m_Stats.pause_total += pause;
+        m_Stats.pause_max = std::max(m_Stats.pause_max, std::chrono::duration_cast<std::chrono::nanoseconds>(pause));
+    }
+
+    std::ostream& Heap::print_stats(std::ostream& stream) const {
+        using std::chrono::duration;
+        using std::milli;
+
+        stream << "[GC]: collections:       " << m_Stats.collections << std::endl
+               << "[GC]: allocated:         " << m_Stats.allocated_objects << " objects, " << m_Stats.allocated_bytes << " bytes" << std::endl
+               << "[GC]: freed:             " << m_Stats.freed_objects << " objects, " << m_Stats.freed_bytes << " bytes" << std::endl
+               << "[GC]: live:              " << m_Objects.size() << " objects, " << m_Bytes << " bytes" << std::endl
+               << "[GC]: peak heap:         " << m_Stats.peak_bytes << " bytes" << std::endl
+               << "[GC]: next collection:   " << m_Threshold << " bytes" << std::endl
+               << "[GC]: pause total / max: " << duration<double, milli>(m_Stats.pause_total).count() << " ms / "
+                                              << duration<double, milli>(m_Stats.pause_max).count() << " ms" << std::endl;
+        return stream;
+    }
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <chrono>
+#include <ostream>
+#include <vector>
+
+#include "value.hpp"
+
+namespace lisp {
+    // Non-moving mark-and-sweep heap for `Value`s.
+    //
+    // Collections only happen at safepoints (function calls and `(gc)`), never inside `alloc`,
+    // so the parser, resolver and compiler can hold unrooted values freely. Code that keeps a
+    // heap `Ref` in a C++ local across an evaluation has to root it, e.g. by pushing it onto
+    // the context's value stack.
+    class Heap {
+    public:
+        static constexpr size_t DEFAULT_THRESHOLD = 4 << 20;
+
+        // worker contexts give their heaps distinct ids, the main context's heap is 0
+        Heap(uint16_t id = 0) : m_Id(id) {}
+        Heap(const Heap&) = delete;
+        ~Heap() {
+            for(auto& object : m_Objects)
+                delete object.value;
+        }
+
+        template<typename T, typename... Args>
+        T* alloc(Args&&... args) {
+            auto value = new T(std::forward<Args>(args)...);
+            value->m_HeapId = m_Id;
+            size_t size = sizeof(T) + value->owned_bytes();
+            m_Objects.push_back({value, size});
+            m_Bytes += size;
+            m_Stats.allocated_objects++;
+            m_Stats.allocated_bytes += size;
+            if(m_Bytes > m_Stats.peak_bytes)
+                m_Stats.peak_bytes = m_Bytes;
+            return value;
+        }
+
+        bool should_collect() const { return m_Bytes >= m_Threshold; }
+        // the live size right after a collection
+        size_t get_bytes() const { return m_Bytes; }
+
+        bool owns(Ref ref) const { return ref.is_heap() && ref.get()->m_HeapId == m_Id; }
+
+        // collect everything that isn't reachable from the marked roots. values of other heaps
+        // are neither marked nor traced, a worker never frees what its parent can reach
+        void begin();
+        void mark(Ref ref) {
+            if(owns(ref) && !ref.get()->m_Marked) {
+                ref.get()->m_Marked = true;
+                m_Gray.push_back(ref.get());
+            }
+        }
+        void finish();
+
+        // distinct for every collection of every heap, lets structures shared between values
+        // be traced once per collection
+        uint64_t get_epoch() const { return (static_cast<uint64_t>(m_Id) << 48) | (m_Stats.collections + 1); }
+
+        // bytes allocated before the first collection, later collections keep the live size below half of it
+        void set_threshold(size_t threshold) {
+            m_InitialThreshold = threshold;
+            m_Threshold = threshold;
+        }
+
+        std::ostream& print_stats(std::ostream& stream) const;
+
+    private:
+        struct Object {
+            Value* value;
+            size_t size;
+        };
+
+        struct Stats {
+            size_t collections = 0;
+            size_t allocated_objects = 0;
+            size_t allocated_bytes = 0;
+            size_t freed_objects = 0;
+            size_t freed_bytes = 0;
+            size_t peak_bytes = 0;
+            std::chrono::nanoseconds pause_total{0};
+            std::chrono::nanoseconds pause_max{0};
+        };
+
+        uint16_t m_Id;
+        std::vector<Object> m_Objects;
+        std::vector<Value*> m_Gray;
+        std::vector<Value*> m_Arena;
+
+        size_t m_Bytes = 0;
+        size_t m_InitialThreshold = DEFAULT_THRESHOLD;
+        size_t m_Threshold = DEFAULT_THRESHOLD;
+
+        std::chrono::steady_clock::time_point m_Start;
+        Stats m_Stats;
+    };
+}
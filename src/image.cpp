@@ -0,0 +1,423 @@
+#include <algorithm>
+#include <unordered_map>
+
+#include "image.hpp"
+#include "binary.hpp"
+#include "context.hpp"
+
+namespace lisp {
+    // bump whenever the encoding of values or the resolution of syntax changes
+    static constexpr uint32_t FORMAT_VERSION = 2;
+    static constexpr char MAGIC[4] = {'L', 'P', 'P', 'I'};
+    // bounds the recursion when writing, which takes a few hundred bytes of stack per level
+    static constexpr unsigned MAX_DEPTH = 1 << 12;
+
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint64_t values;
+        uint64_t globals;
+    };
+
+    enum class Tag : uint8_t {
+        Compound,
+        Ident,
+        String,
+        Error,
+        Number,
+        Float,
+        Quote,
+        Local,
+        Function,
+        Array,
+        Vector,
+        Map
+    };
+
+    // references are the bits of immediates, which always have one of the low two bits set, or
+    // the index of a value plus one shifted past them
+    static constexpr uint64_t reference(uint64_t index) {
+        return (index + 1) << 2;
+    }
+
+    class ImageWriter {
+    public:
+        ImageWriter(Context& context) : m_Context(context) {}
+
+        // the reference to `value`, writing it and everything it references first
+        uint64_t add(Ref value, unsigned depth = 0) {
+            if(!value)
+                return 0;
+            if(!value.is_heap())
+                return value.bits();
+            if(m_Error)
+                return 0;
+
+            auto found = m_Indices.find(value.get());
+            if(found != m_Indices.end())
+                return reference(found->second);
+            if(depth > MAX_DEPTH) {
+                fail("can't dump values nested this deeply");
+                return 0;
+            }
+
+            Writer fields;
+            if(!write(value, fields, depth))
+                return 0;
+
+            m_Writer.output() += fields.output();
+            m_Indices.emplace(value.get(), m_Values);
+            return reference(m_Values++);
+        }
+
+        void add_global(const std::string& name, Ref value) {
+            auto bits = add(value);
+            m_Globals.write_text(name);
+            m_Globals.write(bits);
+            m_GlobalCount++;
+        }
+
+        Ref finish(const std::string& path) {
+            if(m_Error)
+                return m_Error;
+
+            Header header;
+            memcpy(header.magic, MAGIC, sizeof(MAGIC));
+            header.version = FORMAT_VERSION;
+            header.values = m_Values;
+            header.globals = m_GlobalCount;
+
+            Writer writer;
+            writer.write(header);
+            writer.output() += m_Writer.output();
+            writer.output() += m_Globals.output();
+            if(!write_file(path, writer.output()))
+                return m_Context.get_error("can't write the image");
+            return m_Context.get_const_val(ConstValue::Kind::Nil);
+        }
+
+        void fail(std::string reason) {
+            if(!m_Error)
+                m_Error = m_Context.get_error(reason);
+        }
+
+    private:
+        // the tag and fields of `value`, whose references are added before it
+        bool write(Ref value, Writer& fields, unsigned depth) {
+            switch(value.kind()) {
+            case ValueKind::Compound: {
+                auto& contents = dynamic_cast<CompoundValue&>(*value).get_contents();
+                std::vector<uint64_t> references;
+                for(auto& content : contents)
+                    references.push_back(add(content, depth + 1));
+                fields.write(Tag::Compound);
+                fields.write(uint32_t(references.size()));
+                for(auto bits : references)
+                    fields.write(bits);
+            } break;
+            case ValueKind::Ident:
+                fields.write(Tag::Ident);
+                fields.write_text(dynamic_cast<IdentValue&>(*value).get_name());
+                break;
+            case ValueKind::String:
+                fields.write(Tag::String);
+                fields.write_text(dynamic_cast<StringValue&>(*value).get_value());
+                break;
+            case ValueKind::Error:
+                fields.write(Tag::Error);
+                fields.write_text(*value.is_error().value());
+                break;
+            case ValueKind::Number:
+                fields.write(Tag::Number);
+                fields.write_text(dynamic_cast<NumberValue&>(*value).value().to_string());
+                break;
+            case ValueKind::Float:
+                fields.write(Tag::Float);
+                fields.write(dynamic_cast<FloatValue&>(*value).value());
+                break;
+            case ValueKind::Quote: {
+                auto quoted = add(dynamic_cast<QuoteValue&>(*value).get_quoted(), depth + 1);
+                fields.write(Tag::Quote);
+                fields.write(quoted);
+            } break;
+            case ValueKind::Local: {
+                auto& local = dynamic_cast<LocalValue&>(*value);
+                fields.write(Tag::Local);
+                fields.write_text(local.get_name());
+                fields.write(local.get_depth());
+                fields.write(local.get_slot());
+            } break;
+            case ValueKind::Function: {
+                // bytecode is compiled again on the first call
+                auto& function = dynamic_cast<FunctionValue&>(*value);
+                auto body = add(function.get_body(), depth + 1);
+                fields.write(Tag::Function);
+                fields.write_text(function.get_name());
+                fields.write(uint32_t(function.get_arity()));
+                for(auto& argument : function.get_arguments())
+                    fields.write_text(argument);
+                fields.write(body);
+                // memoized functions stay memoized, with an empty memo
+                fields.write(uint64_t(function.get_memo() ? function.get_memo()->get_capacity() : 0));
+            } break;
+            case ValueKind::Array: {
+                auto& array = dynamic_cast<ArrayValue&>(*value);
+                fields.write(Tag::Array);
+                fields.write(uint8_t(array.is_float()));
+                fields.write(uint64_t(array.size()));
+                if(array.is_float())
+                    fields.output().append(reinterpret_cast<const char*>(array.floats().data()), array.size() * sizeof(double));
+                else
+                    fields.output().append(reinterpret_cast<const char*>(array.ints().data()), array.size() * sizeof(int64_t));
+            } break;
+            case ValueKind::Vector: {
+                std::vector<uint64_t> references;
+                dynamic_cast<VectorValue&>(*value).elements().for_each([&](Ref element) {
+                    references.push_back(add(element, depth + 1));
+                });
+                fields.write(Tag::Vector);
+                fields.write(uint64_t(references.size()));
+                for(auto bits : references)
+                    fields.write(bits);
+            } break;
+            case ValueKind::Map: {
+                std::vector<uint64_t> references;
+                dynamic_cast<MapValue&>(*value).entries().for_each([&](Ref key, Ref value) {
+                    references.push_back(add(key, depth + 1));
+                    references.push_back(add(value, depth + 1));
+                });
+                fields.write(Tag::Map);
+                fields.write(uint64_t(references.size() / 2));
+                for(auto bits : references)
+                    fields.write(bits);
+            } break;
+            case ValueKind::Task:
+                fail("can't dump tasks");
+                return false;
+            case ValueKind::Channel:
+                fail("can't dump channels");
+                return false;
+            case ValueKind::Port:
+                fail("can't dump ports");
+                return false;
+            default:
+                fail("can't dump this value");
+                return false;
+            }
+            return !m_Error;
+        }
+
+        Context& m_Context;
+        Writer m_Writer;
+        Writer m_Globals;
+        std::unordered_map<Value*, uint64_t> m_Indices;
+        uint64_t m_Values = 0;
+        uint64_t m_GlobalCount = 0;
+        Ref m_Error;
+    };
+
+    Ref dump_image(const std::string& path, Context& context) {
+        ImageWriter writer(context);
+        for(auto& [name, value] : context.get_globals()) {
+            // the host defines its functions again when it restores an image
+            if(value.kind() == ValueKind::Native)
+                continue;
+            writer.add_global(name, value);
+        }
+        return writer.finish(path);
+    }
+
+    // rebuilds values in the order they were written, relocating references to earlier ones
+    class ImageReader {
+    public:
+        ImageReader(Reader& reader, Context& context) : m_Reader(reader), m_Context(context) {}
+
+        // the value `bits` refers to, failing on anything but an immediate or an earlier value.
+        // the writer never writes null references, so they mark a corrupted image as well
+        Ref resolve(uint64_t bits) {
+            if(bits & 1)
+                return Ref::fixnum(static_cast<int64_t>(bits) >> 1);
+            if((bits & 3) == 2) {
+                auto kind = bits >> 3;
+                if(kind > ConstValue::Kind::Nil) {
+                    m_Reader.fail();
+                    return Ref();
+                }
+                return Ref::constant(static_cast<ConstValue::Kind>(kind));
+            }
+
+            uint64_t index = (bits >> 2) - 1;
+            if(bits == 0 || index >= m_Values.size()) {
+                m_Reader.fail();
+                return Ref();
+            }
+            m_Depth = std::max(m_Depth, m_Depths[index] + 1);
+            return m_Values[index];
+        }
+
+        Ref read_reference() {
+            return resolve(m_Reader.read<uint64_t>());
+        }
+
+        // rebuild the next value, compounds, quotes and locals in the arena like parsed ones
+        void read_value() {
+            auto& arena = m_Context.get_arena();
+            Ref value;
+            m_Depth = 0;
+            switch(static_cast<Tag>(m_Reader.read<uint8_t>())) {
+            case Tag::Compound: {
+                auto size = m_Reader.read<uint32_t>();
+                if(size > m_Reader.remaining() / sizeof(uint64_t))
+                    break;
+                RefList contents(arena.resource());
+                contents.reserve(size);
+                for(uint32_t i = 0; i < size; i++)
+                    contents.push_back(read_reference());
+                value = arena.alloc<CompoundValue>(std::move(contents));
+            } break;
+            case Tag::Ident:
+                value = m_Context.get_ident(m_Reader.read_text());
+                break;
+            case Tag::String:
+                value = m_Context.get_string(m_Reader.read_text());
+                break;
+            case Tag::Error:
+                value = m_Context.get_error(std::string(m_Reader.read_text()));
+                break;
+            case Tag::Number: {
+                auto digits = m_Reader.read_text();
+                bool negative = !digits.empty() && digits[0] == '-';
+                if(negative)
+                    digits.remove_prefix(1);
+                if(digits.empty() || digits.find_first_not_of("0123456789") != std::string_view::npos)
+                    break;
+                auto number = BigInt::parse(digits);
+                value = m_Context.get_number(negative ? BigInt(0) - number : number);
+            } break;
+            case Tag::Float:
+                value = m_Context.get_float(m_Reader.read<double>());
+                break;
+            case Tag::Quote:
+                value = arena.alloc<QuoteValue>(read_reference());
+                break;
+            case Tag::Local: {
+                auto name = m_Reader.read_text();
+                auto depth = m_Reader.read<uint16_t>();
+                auto slot = m_Reader.read<uint16_t>();
+                // functions don't capture their surroundings, locals only refer to the innermost
+                // frame, whose size covers every slot of the function's body
+                if(depth != 0)
+                    break;
+                value = arena.alloc<LocalValue>(std::string(name), depth, slot);
+            } break;
+            case Tag::Function: {
+                auto name = std::string(m_Reader.read_text());
+                auto arity = m_Reader.read<uint32_t>();
+                if(arity > m_Reader.remaining())
+                    break;
+                std::vector<std::string> arguments;
+                for(uint32_t i = 0; i < arity; i++)
+                    arguments.emplace_back(m_Reader.read_text());
+                auto body = read_reference();
+                auto memo = m_Reader.read<uint64_t>();
+                // sizing the frame walks the body
+                if(m_Reader.failed())
+                    break;
+                auto function = m_Context.alloc<FunctionValue>(name, arguments, body);
+                if(memo)
+                    function->set_memo(std::make_shared<Memo>(memo));
+                value = function;
+            } break;
+            case Tag::Array: {
+                bool is_float = m_Reader.read<uint8_t>();
+                auto size = m_Reader.read<uint64_t>();
+                if(size > m_Reader.remaining() / sizeof(int64_t))
+                    break;
+                if(is_float) {
+                    std::vector<double> floats(size);
+                    for(auto& element : floats)
+                        element = m_Reader.read<double>();
+                    value = m_Context.alloc<ArrayValue>(std::move(floats));
+                }
+                else {
+                    std::vector<int64_t> ints(size);
+                    for(auto& element : ints)
+                        element = m_Reader.read<int64_t>();
+                    value = m_Context.alloc<ArrayValue>(std::move(ints));
+                }
+            } break;
+            case Tag::Vector: {
+                auto size = m_Reader.read<uint64_t>();
+                if(size > m_Reader.remaining() / sizeof(uint64_t))
+                    break;
+                PersistentVector elements;
+                size_t allocated = 0;
+                for(uint64_t i = 0; i < size && !m_Reader.failed(); i++)
+                    elements = elements.conj(read_reference(), allocated);
+                value = m_Context.alloc<VectorValue>(elements, elements.bytes());
+            } break;
+            case Tag::Map: {
+                auto size = m_Reader.read<uint64_t>();
+                if(size > m_Reader.remaining() / (2 * sizeof(uint64_t)))
+                    break;
+                PersistentMap entries;
+                size_t allocated = 0;
+                for(uint64_t i = 0; i < size; i++) {
+                    auto key = read_reference();
+                    auto element = read_reference();
+                    // keys are hashed
+                    if(m_Reader.failed())
+                        break;
+                    entries = entries.assoc(key, element, allocated);
+                }
+                value = m_Context.alloc<MapValue>(entries, entries.bytes());
+            } break;
+            }
+
+            // values are walked recursively once they're loaded, bound them like the writer
+            if(!value || m_Reader.failed() || m_Depth > MAX_DEPTH) {
+                m_Reader.fail();
+                return;
+            }
+            m_Values.push_back(value);
+            m_Depths.push_back(m_Depth);
+        }
+
+    private:
+        Reader& m_Reader;
+        Context& m_Context;
+        std::vector<Ref> m_Values;
+        // the nesting depth of every value and of the one being read
+        std::vector<unsigned> m_Depths;
+        unsigned m_Depth = 0;
+    };
+
+    Ref load_image(const std::string& path, Context& context) {
+        auto file = MappedFile::open(path);
+        if(!file)
+            return ERROR("can't open the image");
+
+        auto reader = Reader(file->data(), file->size());
+        auto header = reader.read<Header>();
+        if(reader.failed() || memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != FORMAT_VERSION)
+            return ERROR("not an image of this version");
+
+        // no safepoint is reached while loading, so the values only need to be rooted by the
+        // globals once they're defined
+        ImageReader image(reader, context);
+        for(uint64_t i = 0; i < header.values && !reader.failed(); i++)
+            image.read_value();
+
+        std::vector<std::pair<std::string, Ref>> globals;
+        for(uint64_t i = 0; i < header.globals && !reader.failed(); i++) {
+            auto name = reader.read_text();
+            globals.emplace_back(name, image.read_reference());
+        }
+        if(reader.failed())
+            return ERROR("corrupted image");
+
+        for(auto& [name, value] : globals)
+            context.add_symbol(name, value);
+        return context.get_const_val(ConstValue::Kind::Nil);
+    }
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+
+#include "value.hpp"
+
+namespace lisp {
+    // Heap images (`--dump-image` and `--image`).
+    //
+    // An image holds the globals of a context and every value they reach, so a preloaded library
+    // can be restored without parsing or evaluating it again. Values are written once each,
+    // children before the values referencing them, and references between them are stored as
+    // indices into that sequence. Loading maps the file, rebuilds the values in order and
+    // relocates every reference to the rebuilt value. Immediates are stored as they are.
+    //
+    // Native functions aren't stored, the host defines them again. Tasks and channels can't be.
+
+    // write the globals of `context` to `path`, NIL or an error
+    Ref dump_image(const std::string& path, Context& context);
+
+    // define the globals stored at `path` in `context`, NIL or an error
+    Ref load_image(const std::string& path, Context& context);
+}
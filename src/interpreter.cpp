@@ -0,0 +1,298 @@
+#include <sstream>
+
+#include "interpreter.hpp"
+#include "context.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "resolver.hpp"
+#include "optimizer.hpp"
+#include "compiler.hpp"
+#include "vm.hpp"
+#include "scheduler.hpp"
+#include "cache.hpp"
+#include "image.hpp"
+
+namespace lisp {
+    Interpreter::Interpreter(Options options) : m_Options(options), m_Context(std::make_unique<Context>()) {
+        m_Context->get_heap().set_threshold(options.heap_size);
+        m_Context->set_threads(options.threads);
+    }
+
+    Interpreter::~Interpreter() {}
+
+    Interpreter::Entry::Entry(Interpreter& interpreter) : m_Interpreter(interpreter) {
+        if(m_Interpreter.m_Depth++ > 0)
+            return;
+
+        auto thread = pthread_self();
+        if(m_Interpreter.m_HasThread && pthread_equal(thread, m_Interpreter.m_Thread))
+            return;
+
+        pthread_attr_t attributes;
+        if(pthread_getattr_np(thread, &attributes) != 0)
+            return;
+        void* stack;
+        size_t size;
+        if(pthread_attr_getstack(&attributes, &stack, &size) == 0) {
+            m_Interpreter.m_Context->set_stack(static_cast<const char*>(stack) + size, size);
+            m_Interpreter.m_Thread = thread;
+            m_Interpreter.m_HasThread = true;
+        }
+        pthread_attr_destroy(&attributes);
+    }
+
+    Interpreter::Entry::~Entry() {
+        m_Interpreter.m_Depth--;
+    }
+
+    Ref Interpreter::eval(std::string_view source) {
+        auto program = load(source);
+        if(program.kind() == ValueKind::Error)
+            return program;
+        return run(program);
+    }
+
+    // an embedder evaluates source after source, its syntax has to be collectable like a streamed form's
+    Ref Interpreter::load(std::string_view source) {
+        m_Context->set_stream_syntax(true);
+        auto program = parse(source);
+        if(program.kind() != ValueKind::Error)
+            program = prepare(program);
+        m_Context->set_stream_syntax(false);
+        return program;
+    }
+
+    Ref Interpreter::load_form(std::string_view text) {
+        return load(text);
+    }
+
+    Ref Interpreter::load(std::string_view source, const char* filename, const std::string& cache) {
+        if(cache.empty()) {
+            auto program = parse(source);
+            if(program.kind() == ValueKind::Error)
+                return program;
+            return prepare(program);
+        }
+
+        if(auto program = read_cache(cache, filename, source, *m_Context)) {
+            m_Context->add_root(program.value());
+            return prepare(program.value());
+        }
+
+        auto program = parse(source);
+        if(program.kind() == ValueKind::Error)
+            return program;
+        // an unwritable cache only costs the next start its speed
+        write_cache(cache, filename, source, program);
+        return prepare(program);
+    }
+
+    Ref Interpreter::parse(std::string_view source) {
+        auto& context = *m_Context;
+        auto program = context.alloc<CompoundValue>();
+        context.add_root(program);
+
+        auto lexer = Lexer(source);
+        while(true) {
+            auto result = lisp::parse(lexer, context);
+            if(result.is_error()) {
+                context.remove_root(program);
+                return ERROR(*result.is_error().value());
+            }
+
+            if(result.is_eof())
+                break;
+            resolve(result, context);
+            program->add_value(result);
+        }
+        return program;
+    }
+
+    Ref Interpreter::prepare(Ref program) {
+        if(m_Options.optimize)
+            optimize(program, *m_Context);
+        return program;
+    }
+
+    Ref Interpreter::run(Ref program) {
+        Entry entry(*this);
+        auto& context = *m_Context;
+        Ref result = nil();
+        if(m_Options.use_vm)
+            result = VM(context).run(compile_program(program, context));
+        else {
+            // top-level `let` forms bind slots of a frame of the program's own
+            size_t frame = frame_size(program, 0);
+            if(frame)
+                context.push_frame(0, frame);
+            // evaluated one by one, as a compound a program starting with a symbol would call it
+            for(auto& form : dynamic_cast<CompoundValue&>(*program).get_contents()) {
+                // forms that call no function would never reach a safepoint otherwise
+                context.safepoint();
+                result = form.eval(context);
+                if(result && result.kind() == ValueKind::Error)
+                    break;
+            }
+            if(frame)
+                context.pop_frame();
+        }
+
+        // tasks nothing waited for run once the outermost evaluation is done
+        if(m_Depth == 1 && context.get_scheduler()) {
+            context.push(result);
+            context.get_scheduler()->run();
+            result = context.pop();
+        }
+
+        // functions the program defined keep their own bodies alive
+        context.remove_root(program);
+        // the rest of a streamed form's syntax is garbage now, collect it before the next form
+        if(m_Depth == 1) {
+            context.push(result);
+            context.safepoint();
+            result = context.pop();
+        }
+        return result;
+    }
+
+    Ref Interpreter::call(Ref function, const std::vector<Ref>& args) {
+        Entry entry(*this);
+        auto& context = *m_Context;
+        if(function.kind() == ValueKind::Native) {
+            std::vector<Ref> copy(args);
+            return static_cast<NativeValue&>(*function).call(context, copy);
+        }
+        if(function.kind() != ValueKind::Function)
+            return ERROR("can only call functions");
+        return static_cast<FunctionValue&>(*function).apply(context, args);
+    }
+
+    Ref Interpreter::call(const std::string& name, const std::vector<Ref>& args) {
+        auto& context = *m_Context;
+        auto function = context.get_symbol(name);
+        if(!function)
+            return ERROR("could not find function");
+        return call(function.value(), args);
+    }
+
+    void Interpreter::define(const std::string& name, HostFunction function) {
+        auto native = m_Context->alloc<NativeValue>(name, [this, function](Context&, std::vector<Ref>& args) {
+            return function(*this, args);
+        });
+        m_Context->add_symbol(name, native);
+    }
+
+    Ref Interpreter::dump_image(const std::string& path) {
+        return lisp::dump_image(path, *m_Context);
+    }
+
+    Ref Interpreter::load_image(const std::string& path) {
+        return lisp::load_image(path, *m_Context);
+    }
+
+    void Interpreter::set(const std::string& name, Ref value) {
+        m_Context->add_symbol(name, value);
+    }
+
+    Ref Interpreter::lookup(const std::string& name) {
+        if(auto value = m_Context->get_symbol(name))
+            return value.value();
+        return nil();
+    }
+
+    void Interpreter::pin(Ref value) {
+        m_Context->add_root(value);
+    }
+
+    void Interpreter::unpin(Ref value) {
+        m_Context->remove_root(value);
+    }
+
+    Ref Interpreter::integer(int64_t number) {
+        return m_Context->get_number(number);
+    }
+
+    Ref Interpreter::real(double number) {
+        return m_Context->get_float(number);
+    }
+
+    // not interned, the host may pass a new string on every call
+    Ref Interpreter::string(std::string_view string) {
+        return m_Context->alloc<StringValue>(std::string(string));
+    }
+
+    Ref Interpreter::symbol(std::string_view name) {
+        return m_Context->get_ident(name);
+    }
+
+    Ref Interpreter::list(const std::vector<Ref>& elements) {
+        return m_Context->alloc<CompoundValue>(RefList(elements.begin(), elements.end()));
+    }
+
+    Ref Interpreter::boolean(bool value) {
+        return m_Context->get_const_val(value ? ConstValue::Kind::T : ConstValue::Kind::F);
+    }
+
+    Ref Interpreter::nil() {
+        return m_Context->get_const_val(ConstValue::Kind::Nil);
+    }
+
+    Ref Interpreter::error(std::string reason) {
+        return m_Context->get_error(std::move(reason));
+    }
+
+    bool Interpreter::is_nil(Ref value) {
+        return value.kind() == ValueKind::Const && value.const_kind() == ConstValue::Kind::Nil;
+    }
+
+    bool Interpreter::to_integer(Ref value, int64_t& number) {
+        if(value.is_fixnum()) {
+            number = value.fixnum();
+            return true;
+        }
+        if(value.kind() != ValueKind::Number || !dynamic_cast<NumberValue&>(*value).value().fits_int64())
+            return false;
+        number = dynamic_cast<NumberValue&>(*value).value().to_int64();
+        return true;
+    }
+
+    bool Interpreter::to_real(Ref value, double& number) {
+        if(value.kind() == ValueKind::Float) {
+            number = dynamic_cast<FloatValue&>(*value).value();
+            return true;
+        }
+        if(value.is_fixnum()) {
+            number = value.fixnum();
+            return true;
+        }
+        if(value.kind() != ValueKind::Number)
+            return false;
+        number = dynamic_cast<NumberValue&>(*value).value().to_double();
+        return true;
+    }
+
+    bool Interpreter::to_string(Ref value, std::string& string) {
+        if(value.kind() != ValueKind::String)
+            return false;
+        string = dynamic_cast<StringValue&>(*value).get_value();
+        return true;
+    }
+
+    bool Interpreter::to_list(Ref value, std::vector<Ref>& elements) {
+        if(is_nil(value)) {
+            elements.clear();
+            return true;
+        }
+        if(value.kind() != ValueKind::Compound)
+            return false;
+        auto& contents = dynamic_cast<CompoundValue&>(*value).get_contents();
+        elements.assign(contents.begin(), contents.end());
+        return true;
+    }
+
+    std::string Interpreter::print(Ref value) {
+        std::ostringstream stream;
+        value.print(stream);
+        return stream.str();
+    }
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <pthread.h>
+
+#include "value.hpp"
+#include "gc.hpp"
+
+namespace lisp {
+    // Interpreter instance for programs embedding the language, see `liblisppp.a`.
+    //
+    // Every instance has its own heap, globals and interning tables, so separate instances can
+    // evaluate on separate threads at the same time. An instance itself isn't thread-safe and its
+    // values can't be passed to another one. Values returned to the host are only guaranteed to
+    // stay alive until the next `eval` or `call` collects garbage, unless they are pinned.
+    class Interpreter {
+    public:
+        struct Options {
+            // compile to bytecode and run on the VM instead of walking the tree
+            bool use_vm = false;
+            bool optimize = true;
+            size_t heap_size = Heap::DEFAULT_THRESHOLD;
+            // workers for `pcall` and `pmap`, 0 for one per core
+            size_t threads = 0;
+        };
+
+        // called with the evaluated arguments, the returned value may be an error
+        using HostFunction = std::function<Ref(Interpreter& interpreter, const std::vector<Ref>& args)>;
+
+        Interpreter() : Interpreter(Options()) {}
+        Interpreter(Options options);
+        Interpreter(const Interpreter&) = delete;
+        ~Interpreter();
+
+        // parse and evaluate every top-level form of `source`, returning the last result.
+        // syntax errors are returned as an error value without evaluating anything
+        Ref eval(std::string_view source);
+
+        // the two steps of `eval`: parse, resolve and optimize `source` into a program, which
+        // stays alive until it is run once. its nodes are allocated on the heap, so evaluating
+        // source after source collects the syntax of the ones that ran
+        Ref load(std::string_view source);
+        Ref run(Ref program);
+
+        // `load` a single top-level form read by a `FormReader`, collected once nothing refers to
+        // it anymore, so streaming a long input doesn't keep all of it alive
+        Ref load_form(std::string_view text);
+
+        // `load` the source file `filename` through its program cache at `cache`, which is
+        // written if it doesn't match the source, see cache.hpp. an empty `cache` parses without
+        // one. a file is loaded once, its nodes live in the arena as long as the instance
+        Ref load(std::string_view source, const char* filename, const std::string& cache);
+
+        // call a function value with evaluated arguments
+        Ref call(Ref function, const std::vector<Ref>& args);
+        Ref call(const std::string& name, const std::vector<Ref>& args);
+
+        // bind a global the program can call like a function defined with `defun`.
+        // host functions aren't available in `pcall` and `pmap`
+        void define(const std::string& name, HostFunction function);
+
+        // store the globals in a heap image and define the globals of one, NIL or an error.
+        // host functions have to be defined again after loading an image, see image.hpp
+        Ref dump_image(const std::string& path);
+        Ref load_image(const std::string& path);
+
+        void set(const std::string& name, Ref value);
+        // the value of a global, NIL if it isn't bound
+        Ref lookup(const std::string& name);
+
+        // keep a value alive across evaluations until it is unpinned as often as it was pinned
+        void pin(Ref value);
+        void unpin(Ref value);
+
+        Ref integer(int64_t number);
+        Ref real(double number);
+        Ref string(std::string_view string);
+        Ref symbol(std::string_view name);
+        Ref list(const std::vector<Ref>& elements);
+        Ref boolean(bool value);
+        Ref nil();
+        Ref error(std::string reason);
+
+        static bool is_integer(Ref value) { return value.kind() == ValueKind::Number; }
+        static bool is_real(Ref value) { return value.kind() == ValueKind::Float; }
+        static bool is_string(Ref value) { return value.kind() == ValueKind::String; }
+        static bool is_error(Ref value) { return value.kind() == ValueKind::Error; }
+        static bool is_nil(Ref value);
+
+        // false for bignums outside of the range of `int64_t`
+        static bool to_integer(Ref value, int64_t& number);
+        // integers are converted as well
+        static bool to_real(Ref value, double& number);
+        static bool to_string(Ref value, std::string& string);
+        // the elements of a list, NIL is the empty list
+        static bool to_list(Ref value, std::vector<Ref>& elements);
+        // the text `print` would write
+        static std::string print(Ref value);
+
+        Context& get_context() { return *m_Context; }
+
+    private:
+        // the host may call in from any thread, the outermost entry measures the stack of the
+        // thread it runs on for the stack depth check
+        class Entry {
+        public:
+            Entry(Interpreter& interpreter);
+            ~Entry();
+
+        private:
+            Interpreter& m_Interpreter;
+        };
+
+        // parse and resolve a rooted program
+        Ref parse(std::string_view source);
+        // optimize a parsed program
+        Ref prepare(Ref program);
+
+        Options m_Options;
+        std::unique_ptr<Context> m_Context;
+        size_t m_Depth = 0;
+        pthread_t m_Thread;
+        bool m_HasThread = false;
+    };
+}
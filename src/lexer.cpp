@@ -0,0 +1,95 @@
+#include <array>
+
+#include "lexer.hpp"
+
+namespace lisp {
+    enum CharClass : uint8_t {
+        Other = 0,
+        Space = 1,
+        Digit = 2,
+        IdentChar = 4
+    };
+
+    static constexpr std::array<uint8_t, 256> make_char_classes() {
+        std::array<uint8_t, 256> classes {};
+        for(auto c : {' ', '\t', '\n', '\v', '\f', '\r'})
+            classes[static_cast<uint8_t>(c)] = Space;
+        for(int c = '0'; c <= '9'; c++)
+            classes[c] = Digit | IdentChar;
+        for(int c = 'a'; c <= 'z'; c++)
+            classes[c] = IdentChar;
+        for(int c = 'A'; c <= 'Z'; c++)
+            classes[c] = IdentChar;
+        for(auto c : {'?', '_', '-', '!', '+', '*', '/', '%', '>', '<', '='})
+            classes[static_cast<uint8_t>(c)] = IdentChar;
+        return classes;
+    }
+
+    static constexpr auto CHAR_CLASSES = make_char_classes();
+
+    static inline bool is_class(char c, CharClass char_class) {
+        return CHAR_CLASSES[static_cast<uint8_t>(c)] & char_class;
+    }
+
+    Token Lexer::next() {
+        const char* text = m_Text.data();
+        size_t size = m_Text.size();
+
+        while(m_Position < size && is_class(text[m_Position], Space))
+            m_Position++;
+        if(m_Position >= size)
+            return {TokenKind::Eof, {}};
+
+        size_t start = m_Position++;
+        switch(text[start]) {
+        case '(':
+            return {TokenKind::LParen, m_Text.substr(start, 1)};
+        case ')':
+            return {TokenKind::RParen, m_Text.substr(start, 1)};
+        case '\'':
+            return {TokenKind::Quote, m_Text.substr(start, 1)};
+        case '"': {
+            while(m_Position < size && text[m_Position] != '"')
+                m_Position++;
+            if(m_Position >= size)
+                return {TokenKind::Error, "unclosed string literal"};
+            return {TokenKind::String, m_Text.substr(start + 1, m_Position++ - start - 1)};
+        }
+        case '0'...'9': {
+            auto skip_digits = [&] {
+                while(m_Position < size && is_class(text[m_Position], Digit))
+                    m_Position++;
+            };
+            skip_digits();
+
+            // a fraction or an exponent make it a float, `1.5`, `1e9` or `2.5e-3`
+            auto kind = TokenKind::Number;
+            if(m_Position + 1 < size && text[m_Position] == '.' && is_class(text[m_Position + 1], Digit)) {
+                m_Position++;
+                skip_digits();
+                kind = TokenKind::Float;
+            }
+            if(m_Position < size && (text[m_Position] == 'e' || text[m_Position] == 'E')) {
+                size_t exponent = m_Position + 1;
+                if(exponent < size && (text[exponent] == '+' || text[exponent] == '-'))
+                    exponent++;
+                if(exponent < size && is_class(text[exponent], Digit)) {
+                    m_Position = exponent;
+                    skip_digits();
+                    kind = TokenKind::Float;
+                }
+            }
+
+            if(m_Position < size && !is_class(text[m_Position], Space) && text[m_Position] != ')')
+                return {TokenKind::Error, "unexpected character after number literal"};
+            return {kind, m_Text.substr(start, m_Position - start)};
+        }
+        default:
+            if(!is_class(text[start], IdentChar))
+                return {TokenKind::Error, "unexpected character"};
+            while(m_Position < size && is_class(text[m_Position], IdentChar))
+                m_Position++;
+            return {TokenKind::Ident, m_Text.substr(start, m_Position - start)};
+        }
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+namespace lisp {
+    enum class TokenKind : uint8_t {
+        LParen,
+        RParen,
+        Quote,
+        String,     // text excludes the quotes
+        Number,
+        Float,
+        Ident,
+        Error,      // text holds the reason
+        Eof
+    };
+
+    // tokens are slices of the source text, nothing is copied while lexing
+    struct Token {
+        TokenKind kind;
+        std::string_view text;
+    };
+
+    class Lexer {
+    public:
+        Lexer(std::string_view text) : m_Text(text) {}
+        ~Lexer() {}
+
+        Token next();
+
+        size_t position() const { return m_Position; }
+
+    private:
+        std::string_view m_Text;
+        size_t m_Position = 0;
+    };
+}
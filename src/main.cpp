@@ -1,41 +1,220 @@
 #include <cerrno>
+#include <chrono>
 #include <cstring>
+#include <fstream>
 
-#include "parser.hpp"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "source.hpp"
+#include "interpreter.hpp"
 #include "context.hpp"
-#include "value.hpp"
+#include "profiler.hpp"
+#include "cache.hpp"
+#include "server.hpp"
+#include "port.hpp"
+
+static const char* USAGE = "Expected [--vm] [--no-opt] [--gc-stats] [--parse-stats] [--heap-size <bytes>] [--threads <n>] [--profile <output>] [--no-cache] [--cache-dir <dir>] [--image <file>] [--dump-image <file>] [--serve <socket> [--time-limit <ms>] [--memory-limit <bytes>] [--workers <n>]] [--stream] [<file | ->]";
 
 void panic(const char* msg) {
+    lisp::FilePort::standard_output().flush();
     std::cerr << "[Panic]: " << msg << std::endl;
     std::exit(1);
 }
 
+// evaluate a program one top-level form at a time as it is read. the REPL prints every result and
+// carries on after errors, a streamed program stops at the first one like a parsed program does
+static void stream_forms(lisp::Interpreter& interpreter, int fd, bool repl) {
+    lisp::FormReader reader(fd);
+    bool prompt = repl && isatty(fd);
+    auto& output = lisp::FilePort::standard_output();
+    reader.set_wait([&](bool partial) {
+        if(prompt)
+            output.write(partial ? "  " : "> ");
+        // the output of the forms so far shows up while waiting for the next one
+        output.flush();
+    });
+
+    while(auto text = reader.next()) {
+        auto program = interpreter.load_form(text.value());
+        if(program.kind() == lisp::ValueKind::Error) {
+            if(!repl)
+                panic(program.is_error().value()->c_str());
+            std::cerr << "[Error]: " << *program.is_error().value() << std::endl;
+            continue;
+        }
+
+        auto result = interpreter.run(program);
+        if(repl && !lisp::Interpreter::is_nil(result)) {
+            result.print(output.stream());
+            output.write("\n");
+            output.commit();
+        }
+        else if(!repl && result.kind() == lisp::ValueKind::Error)
+            break;
+    }
+    if(reader.failed())
+        panic(strerror(errno));
+    if(prompt)
+        output.write("\n");
+}
+
 int main(int argc, char* argv[]) {
-    if(argc != 2) {
-        panic("Expected <file>");
+    const char* filename = nullptr;
+    bool use_vm = false;
+    bool optimize = true;
+    bool gc_stats = false;
+    bool parse_stats = false;
+    size_t heap_size = lisp::Heap::DEFAULT_THRESHOLD;
+    size_t threads = 0;
+    const char* profile_output = nullptr;
+    bool use_cache = true;
+    std::string cache_dir;
+    const char* image = nullptr;
+    const char* dump_image = nullptr;
+    const char* serve = nullptr;
+    bool stream = false;
+    lisp::Server::Options server_options;
+
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--vm") == 0)
+            use_vm = true;
+        else if(strcmp(argv[i], "--no-opt") == 0)
+            optimize = false;
+        else if(strcmp(argv[i], "--gc-stats") == 0)
+            gc_stats = true;
+        else if(strcmp(argv[i], "--parse-stats") == 0)
+            parse_stats = true;
+        else if(strcmp(argv[i], "--heap-size") == 0 && i + 1 < argc)
+            heap_size = std::strtoull(argv[++i], nullptr, 10);
+        else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            threads = std::strtoull(argv[++i], nullptr, 10);
+        else if(strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+            profile_output = argv[++i];
+        else if(strcmp(argv[i], "--no-cache") == 0)
+            use_cache = false;
+        else if(strcmp(argv[i], "--cache-dir") == 0 && i + 1 < argc)
+            cache_dir = argv[++i];
+        else if(strcmp(argv[i], "--image") == 0 && i + 1 < argc)
+            image = argv[++i];
+        else if(strcmp(argv[i], "--dump-image") == 0 && i + 1 < argc)
+            dump_image = argv[++i];
+        else if(strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+            serve = argv[++i];
+        else if(strcmp(argv[i], "--time-limit") == 0 && i + 1 < argc)
+            server_options.time_limit_ms = std::strtoull(argv[++i], nullptr, 10);
+        else if(strcmp(argv[i], "--memory-limit") == 0 && i + 1 < argc)
+            server_options.memory_limit = std::strtoull(argv[++i], nullptr, 10);
+        else if(strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+            server_options.workers = std::strtoull(argv[++i], nullptr, 10);
+        else if(strcmp(argv[i], "--stream") == 0)
+            stream = true;
+        else if(!filename)
+            filename = argv[i];
+        else
+            panic(USAGE);
     }
 
-    auto filename = argv[1];
-    std::ifstream file(filename);
-    if(file.fail()) {
-        panic(strerror(errno));
+    // without a file the program is read interactively from stdin
+    bool repl = !filename;
+    if(repl && serve) {
+        panic(USAGE);
     }
-    
-    auto context = lisp::Context();
-    auto root = std::make_unique<lisp::CompoundValue>();
 
-    while(true) {
-        auto result = lisp::parse(file, context);
-        if(auto error = result->is_error())
-            panic(error.value()->c_str());
+    lisp::Interpreter::Options options;
+    options.use_vm = use_vm;
+    options.optimize = optimize;
+    options.heap_size = heap_size;
+    options.threads = threads;
+    auto interpreter = lisp::Interpreter(options);
+    auto& context = interpreter.get_context();
 
-        if(result->is_eof())
-            break;
-        root->add_value(result);
+    // the globals of a preloaded environment, which the program runs on top of
+    if(image) {
+        auto result = interpreter.load_image(image);
+        if(result.kind() == lisp::ValueKind::Error)
+            panic(result.is_error().value()->c_str());
+    }
+
+    // streamed programs are parsed form by form while they run
+    int fd = -1;
+    lisp::Ref program;
+    if(repl || (stream && strcmp(filename, "-") == 0))
+        fd = STDIN_FILENO;
+    else if(stream) {
+        fd = open(filename, O_RDONLY | O_CLOEXEC);
+        if(fd < 0)
+            panic(strerror(errno));
     }
+    else {
+        // `-` reads the program from stdin
+        auto source = strcmp(filename, "-") == 0 ? lisp::Source::read(std::cin) : lisp::Source::open(filename);
+        if(!source) {
+            panic(strerror(errno));
+        }
 
-    root->eval(context);
+        auto parse_start = std::chrono::steady_clock::now();
+        // programs read from stdin have no file to cache them for
+        std::string cache;
+        if(use_cache && strcmp(filename, "-") != 0) {
+            if(!cache_dir.empty())
+                mkdir(cache_dir.c_str(), 0755);
+            cache = lisp::cache_path(filename, cache_dir);
+        }
+        program = interpreter.load(source->text(), filename, cache);
+        if(program.kind() == lisp::ValueKind::Error)
+            panic(program.is_error().value()->c_str());
+
+        if(parse_stats) {
+            std::chrono::duration<double> time = std::chrono::steady_clock::now() - parse_start;
+            std::cerr << "[Parse]: " << source->size() << " bytes in " << time.count() * 1000 << " ms ("
+                      << source->size() / time.count() / (1 << 20) << " MB/s)" << std::endl;
+        }
+    }
+
+    std::unique_ptr<lisp::Profiler> profiler;
+    if(profile_output) {
+        profiler = std::make_unique<lisp::Profiler>();
+        context.set_profiler(profiler.get());
+        profiler->start();
+    }
+
+    if(fd >= 0)
+        stream_forms(interpreter, fd, repl);
+    else
+        interpreter.run(program);
+    // before the statistics on stderr
+    lisp::FilePort::standard_output().flush();
+
+    // the file was the prelude every request runs on top of
+    if(serve) {
+        auto server = lisp::Server(interpreter, server_options);
+        if(!server.serve(serve))
+            panic(strerror(errno));
+    }
+
+    if(dump_image) {
+        auto result = interpreter.dump_image(dump_image);
+        if(result.kind() == lisp::ValueKind::Error)
+            panic(result.is_error().value()->c_str());
+    }
+
+    if(profiler) {
+        profiler->stop();
+        context.set_profiler(nullptr);
+
+        std::ofstream output(profile_output);
+        if(output.fail())
+            panic(strerror(errno));
+        profiler->write_collapsed(output);
+        profiler->print_report(std::cerr);
+    }
+
+    if(gc_stats) {
+        context.get_heap().print_stats(std::cerr);
+        context.get_arena().print_stats(std::cerr);
+    }
 
-    file.close();
     return 0;
 }
\ No newline at end of file
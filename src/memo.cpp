@@ -0,0 +1,111 @@
+#include <functional>
+
+#include "value.hpp"
+#include "memo.hpp"
+#include "gc.hpp"
+
+namespace lisp {
+    size_t hash_value(Ref value) {
+        switch(value.kind()) {
+        case ValueKind::Number:
+            if(value.is_fixnum())
+                return std::hash<int64_t>()(value.fixnum());
+            return dynamic_cast<NumberValue&>(*value).value().hash();
+        case ValueKind::Float:
+            return std::hash<double>()(dynamic_cast<FloatValue&>(*value).value());
+        case ValueKind::String:
+            return std::hash<std::string>()(dynamic_cast<StringValue&>(*value).get_value());
+        case ValueKind::Ident:
+            return std::hash<std::string>()(dynamic_cast<IdentValue&>(*value).get_name());
+        case ValueKind::Function:
+            return std::hash<std::string>()(dynamic_cast<FunctionValue&>(*value).get_name());
+        case ValueKind::Error:
+            return std::hash<std::string>()(*value.is_error().value());
+        case ValueKind::Quote:
+            return hash_value(dynamic_cast<QuoteValue&>(*value).get_quoted()) * 31 + 1;
+        case ValueKind::Compound: {
+            // compounds compare their contents by identity
+            size_t hash = 7;
+            for(auto& content : dynamic_cast<CompoundValue&>(*value).get_contents())
+                hash = hash * 31 + std::hash<uint64_t>()(content.bits());
+            return hash;
+        }
+        case ValueKind::Vector: {
+            size_t hash = 11;
+            dynamic_cast<VectorValue&>(*value).elements().for_each([&](Ref element) {
+                hash = hash * 31 + hash_value(element);
+            });
+            return hash;
+        }
+        case ValueKind::Map: {
+            // keys with equal hashes are iterated in insertion order, so combine independent of it
+            size_t hash = 13;
+            dynamic_cast<MapValue&>(*value).entries().for_each([&](Ref key, Ref value) {
+                hash += hash_value(key) ^ (hash_value(value) * 31);
+            });
+            return hash;
+        }
+        case ValueKind::Const:
+        case ValueKind::Eof:
+            return std::hash<uint64_t>()(value.bits());
+        default:
+            return static_cast<size_t>(value.kind());
+        }
+    }
+
+    size_t Memo::KeyHash::operator()(const std::vector<Ref>* key) const {
+        size_t hash = key->size();
+        for(auto& value : *key)
+            hash = hash * 31 + hash_value(value);
+        return hash;
+    }
+
+    bool Memo::KeyEqual::operator()(const std::vector<Ref>* lhs, const std::vector<Ref>* rhs) const {
+        if(lhs->size() != rhs->size())
+            return false;
+        for(size_t i = 0; i < lhs->size(); i++) {
+            if(!(*lhs)[i].equals((*rhs)[i]))
+                return false;
+        }
+        return true;
+    }
+
+    std::optional<Ref> Memo::find(const std::vector<Ref>& key) {
+        auto entry = m_Index.find(&key);
+        if(entry == m_Index.end()) {
+            m_Misses++;
+            return std::nullopt;
+        }
+
+        m_Hits++;
+        m_Entries.splice(m_Entries.begin(), m_Entries, entry->second);
+        return entry->second->result;
+    }
+
+    void Memo::insert(std::vector<Ref> key, Ref result) {
+        // a recursive call with the same arguments may have stored it already
+        auto existing = m_Index.find(&key);
+        if(existing != m_Index.end()) {
+            existing->second->result = result;
+            m_Entries.splice(m_Entries.begin(), m_Entries, existing->second);
+            return;
+        }
+
+        if(m_Entries.size() >= m_Capacity) {
+            m_Index.erase(&m_Entries.back().key);
+            m_Entries.pop_back();
+            m_Evictions++;
+        }
+
+        m_Entries.push_front({std::move(key), result});
+        m_Index.emplace(&m_Entries.front().key, m_Entries.begin());
+    }
+
+    void Memo::trace(Heap& heap) {
+        for(auto& entry : m_Entries) {
+            for(auto& value : entry.key)
+                heap.mark(value);
+            heap.mark(entry.result);
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <list>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "value.hpp"
+
+namespace lisp {
+    // Results of a memoized function keyed by its argument values, see `memoize`.
+    //
+    // Keys are compared with `Ref::equals`, like `eq` does. Once `capacity` results are stored,
+    // inserting another evicts the least recently used one.
+    class Memo {
+    public:
+        static constexpr size_t DEFAULT_CAPACITY = 1024;
+
+        Memo(size_t capacity) : m_Capacity(capacity) {}
+        Memo(const Memo&) = delete;
+        ~Memo() {}
+
+        std::optional<Ref> find(const std::vector<Ref>& key);
+        void insert(std::vector<Ref> key, Ref result);
+
+        void trace(Heap& heap);
+
+        size_t get_capacity() const { return m_Capacity; }
+        size_t get_size() const { return m_Entries.size(); }
+        uint64_t get_hits() const { return m_Hits; }
+        uint64_t get_misses() const { return m_Misses; }
+        uint64_t get_evictions() const { return m_Evictions; }
+
+    private:
+        struct Entry {
+            std::vector<Ref> key;
+            Ref result;
+        };
+
+        struct KeyHash {
+            size_t operator()(const std::vector<Ref>* key) const;
+        };
+
+        struct KeyEqual {
+            bool operator()(const std::vector<Ref>* lhs, const std::vector<Ref>* rhs) const;
+        };
+
+        size_t m_Capacity;
+        // most recently used first, the index points into the entries' own keys
+        std::list<Entry> m_Entries;
+        std::unordered_map<const std::vector<Ref>*, std::list<Entry>::iterator, KeyHash, KeyEqual> m_Index;
+
+        uint64_t m_Hits = 0;
+        uint64_t m_Misses = 0;
+        uint64_t m_Evictions = 0;
+    };
+}
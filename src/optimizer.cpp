@@ -0,0 +1,259 @@
+#include <unordered_set>
+
+#include "optimizer.hpp"
+#include "builtin.hpp"
+#include "value.hpp"
+
+namespace lisp {
+    // builtins without side effects, folded when all their operands are literals
+    static const std::unordered_set<std::string> PURE_BUILTINS = {
+        "+", "-", "*", "/", "<", ">", "<=", ">=", "eq"
+    };
+
+    // bodies with more nodes than this are called instead of inlined
+    static constexpr size_t MAX_INLINE_SIZE = 16;
+
+    static bool is_literal(Ref value) {
+        switch(value.kind()) {
+        case ValueKind::Number:
+        case ValueKind::Float:
+        case ValueKind::String:
+        case ValueKind::Const:
+        case ValueKind::Quote:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    static const std::string* head_name(RefList& contents) {
+        if(contents.empty() || contents[0].kind() != ValueKind::Ident)
+            return nullptr;
+        return &dynamic_cast<IdentValue&>(*contents[0]).get_name();
+    }
+
+    class Optimizer {
+    public:
+        Optimizer(Context& context) : m_Context(context) {}
+        ~Optimizer() {}
+
+        void optimize_program(RefList& forms) {
+            for(auto& form : forms)
+                count_definitions(form);
+
+            // functions can only be inlined into the forms evaluated after their definition
+            for(auto& form : forms) {
+                optimize(form, true);
+                record_function(form);
+            }
+        }
+
+    private:
+        struct Function {
+            size_t arity;
+            Ref body;
+        };
+
+        Context& m_Context;
+        std::unordered_map<std::string, size_t> m_Definitions;
+        std::unordered_map<std::string, Function> m_Inlines;
+
+        // count the global bindings of every name, only names bound exactly once can be inlined
+        void count_definitions(Ref value) {
+            if(value.kind() != ValueKind::Compound)
+                return;
+
+            auto& contents = dynamic_cast<CompoundValue&>(*value).get_contents();
+            auto name = head_name(contents);
+            if(name && (*name == "defun" || *name == "defun-memo" || *name == "setq") && contents.size() > 1 && contents[1].kind() == ValueKind::Ident)
+                m_Definitions[dynamic_cast<IdentValue&>(*contents[1]).get_name()]++;
+            // memoized functions have to stay calls to use their memo
+            if(name && *name == "memoize" && contents.size() > 1) {
+                auto target = contents[1];
+                if(target.kind() == ValueKind::Quote)
+                    target = dynamic_cast<QuoteValue&>(*target).get_quoted();
+                if(target.kind() == ValueKind::Ident)
+                    m_Definitions[dynamic_cast<IdentValue&>(*target).get_name()]++;
+            }
+
+            for(auto& content : contents)
+                count_definitions(content);
+        }
+
+        void record_function(Ref form) {
+            if(form.kind() != ValueKind::Compound)
+                return;
+
+            auto& contents = dynamic_cast<CompoundValue&>(*form).get_contents();
+            auto name = head_name(contents);
+            if(!name || *name != "defun" || contents.size() != 4 || contents[1].kind() != ValueKind::Ident || contents[2].kind() != ValueKind::Compound)
+                return;
+
+            auto& function = dynamic_cast<IdentValue&>(*contents[1]).get_name();
+            if(m_Definitions[function] != 1 || BUILTINS.find(function) != BUILTINS.end())
+                return;
+
+            size_t size = 0;
+            if(inlinable(contents[3], function, size))
+                m_Inlines[function] = {dynamic_cast<CompoundValue&>(*contents[2]).get_contents().size(), contents[3]};
+        }
+
+        // small, non-recursive bodies that don't assign or call their arguments, define functions or
+        // bind slots beyond the arguments, which the call site has no room for
+        bool inlinable(Ref value, const std::string& function, size_t& size) {
+            if(++size > MAX_INLINE_SIZE)
+                return false;
+
+            switch(value.kind()) {
+            case ValueKind::Ident:
+                return dynamic_cast<IdentValue&>(*value).get_name() != function;
+            case ValueKind::Local:
+                return dynamic_cast<LocalValue&>(*value).get_depth() == 0;
+            case ValueKind::Compound: {
+                auto& contents = dynamic_cast<CompoundValue&>(*value).get_contents();
+                auto name = head_name(contents);
+                if(name && (*name == "defun" || *name == "defun-memo" || *name == "let" || *name == "dotimes"))
+                    return false;
+                if(name && *name == "setq" && contents.size() > 1 && contents[1].kind() == ValueKind::Local)
+                    return false;
+                // calling an argument depends on it evaluating to a function
+                if(!contents.empty() && contents[0].kind() == ValueKind::Local)
+                    return false;
+
+                for(auto& content : contents) {
+                    if(!inlinable(content, function, size))
+                        return false;
+                }
+                return true;
+            }
+            default:
+                return true;
+            }
+        }
+
+        void optimize(Ref& value, bool inline_calls) {
+            if(value.kind() != ValueKind::Compound)
+                return;
+
+            auto& contents = dynamic_cast<CompoundValue&>(*value).get_contents();
+            auto name = head_name(contents);
+            if(name && (*name == "defun" || *name == "defun-memo")) {
+                if(contents.size() == 4)
+                    optimize(contents[3], inline_calls);
+                return;
+            }
+
+            // leave the head and the target of `setq` alone
+            size_t first = 0;
+            if(name && *name == "setq")
+                first = 2;
+            else if(name || (!contents.empty() && contents[0].kind() == ValueKind::Local))
+                first = 1;
+
+            for(size_t i = first; i < contents.size(); i++)
+                optimize(contents[i], inline_calls);
+
+            if(!name)
+                return;
+            if(*name == "if")
+                return prune_if(value, contents);
+            if(*name == "cond")
+                return prune_cond(value, contents);
+            if(PURE_BUILTINS.find(*name) != PURE_BUILTINS.end())
+                return fold(value, contents, *name);
+            if(inline_calls && BUILTINS.find(*name) == BUILTINS.end())
+                inline_call(value, contents, *name);
+        }
+
+        void fold(Ref& value, RefList& contents, const std::string& name) {
+            for(size_t i = 1; i < contents.size(); i++) {
+                if(!is_literal(contents[i]))
+                    return;
+                // division by zero is left to happen at runtime, if the code is reached
+                if(name == "/" && i > 1 && contents[i].kind() == ValueKind::Number && contents[i].number() == 0)
+                    return;
+            }
+
+            // errors are kept unfolded, to be reported where they occur
+            auto result = BUILTINS.at(name)(m_Context, contents);
+            if(result.kind() != ValueKind::Error)
+                value = result;
+        }
+
+        void prune_if(Ref& value, RefList& contents) {
+            if(contents.size() != 4 || contents[1].kind() != ValueKind::Const)
+                return;
+            value = contents[1].is_truthy() ? contents[2] : contents[3];
+        }
+
+        void prune_cond(Ref& value, RefList& contents) {
+            if(contents.size() < 4 || contents.size() % 2 == 1)
+                return;
+
+            RefList kept({contents[0]}, m_Context.syntax_resource());
+            bool taken = false;
+            for(size_t i = 1; i < contents.size() - 1 && !taken; i += 2) {
+                if(contents[i].kind() != ValueKind::Const) {
+                    kept.push_back(contents[i]);
+                    kept.push_back(contents[i + 1]);
+                }
+                // a constant true condition makes its branch the last one
+                else if(contents[i].is_truthy()) {
+                    if(kept.size() == 1) {
+                        value = contents[i + 1];
+                        return;
+                    }
+                    kept.push_back(contents[i + 1]);
+                    taken = true;
+                }
+            }
+
+            if(kept.size() == 1) {
+                value = contents.back();
+                return;
+            }
+            if(!taken)
+                kept.push_back(contents.back());
+            if(kept.size() != contents.size())
+                value = m_Context.alloc_syntax<CompoundValue>(std::move(kept));
+        }
+
+        // arguments are only substituted when evaluating them again has no effect
+        void inline_call(Ref& value, RefList& contents, const std::string& name) {
+            auto function = m_Inlines.find(name);
+            if(function == m_Inlines.end() || function->second.arity != contents.size() - 1)
+                return;
+
+            for(size_t i = 1; i < contents.size(); i++) {
+                if(!is_literal(contents[i]) && contents[i].kind() != ValueKind::Local)
+                    return;
+            }
+
+            auto body = substitute(function->second.body, contents);
+            optimize(body, false);
+            value = body;
+        }
+
+        Ref substitute(Ref value, RefList& arguments) {
+            switch(value.kind()) {
+            case ValueKind::Local:
+                return arguments[dynamic_cast<LocalValue&>(*value).get_slot() + 1];
+            case ValueKind::Compound: {
+                auto& contents = dynamic_cast<CompoundValue&>(*value).get_contents();
+
+                RefList copy(m_Context.syntax_resource());
+                copy.reserve(contents.size());
+                for(auto& content : contents)
+                    copy.push_back(substitute(content, arguments));
+                return m_Context.alloc_syntax<CompoundValue>(std::move(copy));
+            }
+            default:
+                return value;
+            }
+        }
+    };
+
+    void optimize(Ref program, Context& context) {
+        Optimizer(context).optimize_program(dynamic_cast<CompoundValue&>(*program).get_contents());
+    }
+}
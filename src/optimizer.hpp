@@ -0,0 +1,9 @@
+#pragma once
+
+#include "value.hpp"
+
+namespace lisp {
+    // fold constant builtin calls, prune `if`/`cond` branches with constant conditions and inline
+    // small non-recursive functions into the resolved top-level forms of `program`
+    void optimize(Ref program, Context& context);
+}
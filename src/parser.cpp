@@ -1,91 +1,96 @@
-#include <sstream>
-
 #include "parser.hpp"
 #include "value.hpp"
 
+#include <charconv>
+
 namespace lisp {
-    inline bool is_ident_char(char c) {
-        return std::isalnum(c) || c == '?' || c == '_' || c == '-' || c == '!' || c == '+' || c == '*' || c == '/' || c == '%' || c == '>' || c == '<' || c == '=';
-    }
+    Ref parse_number(std::string_view text, Context& context) {
+        // anything longer than 18 digits may not fit into 64 bits
+        if(text.size() > 18)
+            return context.get_number(BigInt::parse(text));
 
-    std::shared_ptr<Value> parse_number(char c, std::ifstream& input, Context& context) {
-        int64_t value = (c - '0');
-        while(std::isdigit(input.peek())) {
+        int64_t value = 0;
+        for(char c : text) {
             value *= 10;
-            value += input.get() - '0';
+            value += c - '0';
         }
-        c = input.peek();
-        if(std::isspace(c) || c == ')' || input.eof())
-            return context.get_number(value);
-        return std::make_shared<ErrorValue>("unexpected character after number literal");
+        return context.get_number(value);
     }
 
-    std::shared_ptr<Value> parse_string(std::ifstream& input, Context& context) {
-        auto string = std::ostringstream();
-
-        char c = input.get();
-        while(c != '"' && !input.eof()) {
-            string << c;
-            c = input.get();
-        }
-        if(input.eof())
-            return std::make_shared<ErrorValue>("unclosed string literal");
-        return context.get_string(string.str());
+    Ref parse_float(std::string_view text, Context& context) {
+        double value = 0;
+        std::from_chars(text.data(), text.data() + text.size(), value);
+        return context.get_float(value);
     }
 
-    std::shared_ptr<Value> parse_ident(char c, std::ifstream& input, Context& context) {
-        auto name = std::ostringstream();
-        name << c;
-
-        while(is_ident_char(input.peek())) {
-            name << (char) input.get();
+    Ref parse_ident(std::string_view text, Context& context) {
+        // `t`, `f` and `nil`, skipping the lookup for longer names
+        if(text.size() <= 3) {
+            auto kv = CONSTVALUE_IDENTS.find(text);
+            if(kv != CONSTVALUE_IDENTS.end())
+                return context.get_const_val(kv->second);
         }
-        auto str = name.str();
-        auto kv = CONSTVALUE_IDENTS.find(str);
-        if(kv != CONSTVALUE_IDENTS.end())
-            return context.get_const_val(kv->second);
 
-        return context.get_ident(str);
+        return context.get_ident(text);
     }
 
-    std::shared_ptr<Value> parse_compound(std::ifstream& input, Context& context) {
-        std::vector<std::shared_ptr<Value>> values;
+    // elements of the compounds being parsed, copied into a syntax node once a compound is closed
+    using Scratch = std::vector<Ref>;
+
+    Ref parse_value(Token token, Lexer& lexer, Scratch& scratch, Context& context);
+
+    Ref parse_compound(Lexer& lexer, Scratch& scratch, Context& context) {
+        size_t start = scratch.size();
 
-        while(input.peek() != ')' && !input.eof())
-        {
-            values.push_back(parse(input, context));
-            while(std::isspace(input.peek())) {
-                input.get();
+        for(;;) {
+            auto token = lexer.next();
+            if(token.kind == TokenKind::Eof)
+                return context.get_error("unclosed compound literal");
+            if(token.kind == TokenKind::RParen) {
+                auto compound = context.alloc_syntax<CompoundValue>(RefList(scratch.begin() + start, scratch.end(), context.syntax_resource()));
+                scratch.resize(start);
+                return compound;
             }
-        }        
-        if(input.get() == ')')
-            return std::make_shared<CompoundValue>(values);
-        return std::make_shared<ErrorValue>("unclosed compound literal");
+
+            auto value = parse_value(token, lexer, scratch, context);
+            if(value.kind() == ValueKind::Error)
+                return value;
+            scratch.push_back(value);
+        }
     }
 
-    std::shared_ptr<Value> parse(std::ifstream& input, Context& context) {
-        char c = 0;
-        input >> c;
-        switch(c) {
-        case '\0':
-            return std::make_shared<EofValue>();
-        case '(':
-            return parse_compound(input, context);
-        case '"':
-            return parse_string(input, context);
-        case '\'':
-            return std::make_shared<QuoteValue>(parse(input, context));
-        case '0'...'9':
-            return parse_number(c, input, context);
-        default:
-            if(is_ident_char(c)) {
-                return parse_ident(c, input, context);
-            }
-            if(input.eof()) {
-                return std::make_shared<EofValue>();
-            }
+    Ref parse_value(Token token, Lexer& lexer, Scratch& scratch, Context& context) {
+        switch(token.kind) {
+        case TokenKind::Eof:
+            return Ref::eof();
+        case TokenKind::LParen:
+            return parse_compound(lexer, scratch, context);
+        case TokenKind::String:
+            return context.get_string(token.text);
+        case TokenKind::Quote: {
+            auto quoted = parse_value(lexer.next(), lexer, scratch, context);
+            if(quoted.kind() == ValueKind::Error)
+                return quoted;
+            if(quoted.is_eof())
+                return context.get_error("expect value after quote");
+            return context.alloc_syntax<QuoteValue>(quoted);
         }
-        std::cout << c << std::endl;
-        return std::make_shared<ErrorValue>("unexpected character");
+        case TokenKind::Number:
+            return parse_number(token.text, context);
+        case TokenKind::Float:
+            return parse_float(token.text, context);
+        case TokenKind::Ident:
+            return parse_ident(token.text, context);
+        case TokenKind::Error:
+            return context.get_error(std::string(token.text));
+        case TokenKind::RParen:
+            break;
+        }
+        return context.get_error("unexpected character");
+    }
+
+    Ref parse(Lexer& lexer, Context& context) {
+        Scratch scratch;
+        return parse_value(lexer.next(), lexer, scratch, context);
     }
 }
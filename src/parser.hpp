@@ -1,8 +1,9 @@
 #pragma once
 
-#include <fstream>
+#include "lexer.hpp"
 #include "value.hpp"
 
 namespace lisp {
-    std::shared_ptr<Value> parse(std::ifstream& input, Context& context);
+    // parse the next top-level value, returning `Ref::eof()` once the input is consumed
+    Ref parse(Lexer& lexer, Context& context);
 }
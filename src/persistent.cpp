@@ -0,0 +1,355 @@
+#include <atomic>
+#include <vector>
+
+#include "persistent.hpp"
+#include "value.hpp"
+#include "gc.hpp"
+
+namespace lisp {
+    // nodes are shared by all versions of a collection and by collections of different heaps,
+    // each collection only traces them the first time it reaches them
+    struct TraceEpoch {
+        TraceEpoch() {}
+        TraceEpoch(const TraceEpoch&) {}
+
+        bool visit(uint64_t epoch) const {
+            return m_Epoch.exchange(epoch, std::memory_order_relaxed) != epoch;
+        }
+
+    private:
+        mutable std::atomic<uint64_t> m_Epoch = 0;
+    };
+
+    static constexpr unsigned BITS = 5;
+    static constexpr size_t WIDTH = 1 << BITS;
+    static constexpr size_t MASK = WIDTH - 1;
+
+    // branches hold children, leaves and the tail hold up to 32 elements
+    struct VectorNode {
+        std::vector<std::shared_ptr<const VectorNode>> children;
+        std::vector<Ref> values;
+        // whether a heap value is stored below, subtrees of only fixnums and constants aren't traced
+        bool has_heap = false;
+        TraceEpoch traced;
+
+        size_t bytes() const {
+            return sizeof(VectorNode) + children.capacity() * sizeof(children[0]) + values.capacity() * sizeof(Ref);
+        }
+
+        // called once a new node is filled in
+        void seal(size_t& allocated) {
+            has_heap = false;
+            for(auto& child : children)
+                has_heap |= child->has_heap;
+            for(auto& value : values)
+                has_heap |= value.is_heap();
+            allocated += bytes();
+        }
+    };
+
+    static const std::shared_ptr<const VectorNode>& empty_vector_node() {
+        static const std::shared_ptr<const VectorNode> empty = std::make_shared<const VectorNode>();
+        return empty;
+    }
+
+    // `node` below `level / BITS` single-child branches
+    static std::shared_ptr<const VectorNode> new_path(unsigned level, std::shared_ptr<const VectorNode> node, size_t& allocated) {
+        if(level == 0)
+            return node;
+        auto branch = std::make_shared<VectorNode>();
+        branch->children.push_back(new_path(level - BITS, node, allocated));
+        branch->seal(allocated);
+        return branch;
+    }
+
+    // add the full tail of a vector with `size` elements as the last leaf below `parent`
+    static std::shared_ptr<const VectorNode> push_tail(size_t size, unsigned level, const VectorNode* parent,
+                                                       std::shared_ptr<const VectorNode> leaf, size_t& allocated) {
+        size_t index = ((size - 1) >> level) & MASK;
+        auto branch = std::make_shared<VectorNode>(*parent);
+
+        std::shared_ptr<const VectorNode> child;
+        if(level == BITS)
+            child = leaf;
+        else if(index < parent->children.size())
+            child = push_tail(size, level - BITS, parent->children[index].get(), leaf, allocated);
+        else
+            child = new_path(level - BITS, leaf, allocated);
+
+        if(index < branch->children.size())
+            branch->children[index] = child;
+        else
+            branch->children.push_back(child);
+        branch->seal(allocated);
+        return branch;
+    }
+
+    static std::shared_ptr<const VectorNode> assoc_path(unsigned level, const VectorNode* node, size_t index, Ref value, size_t& allocated) {
+        auto copy = std::make_shared<VectorNode>(*node);
+        if(level == 0)
+            copy->values[index & MASK] = value;
+        else {
+            auto& child = copy->children[(index >> level) & MASK];
+            child = assoc_path(level - BITS, child.get(), index, value, allocated);
+        }
+        copy->seal(allocated);
+        return copy;
+    }
+
+    static void visit(const VectorNode* node, unsigned level, const std::function<void(Ref)>& function) {
+        if(level == 0) {
+            for(auto& value : node->values)
+                function(value);
+            return;
+        }
+        for(auto& child : node->children)
+            visit(child.get(), level - BITS, function);
+    }
+
+    static size_t node_bytes(const VectorNode* node) {
+        size_t bytes = node->bytes();
+        for(auto& child : node->children)
+            bytes += node_bytes(child.get());
+        return bytes;
+    }
+
+    PersistentVector::PersistentVector() : m_Shift(BITS), m_Root(empty_vector_node()), m_Tail(empty_vector_node()) {}
+
+    size_t PersistentVector::tail_offset() const {
+        if(m_Size < WIDTH)
+            return 0;
+        return ((m_Size - 1) >> BITS) << BITS;
+    }
+
+    Ref PersistentVector::get(size_t index) const {
+        size_t offset = tail_offset();
+        if(index >= offset)
+            return m_Tail->values[index - offset];
+
+        auto node = m_Root.get();
+        for(unsigned level = m_Shift; level > 0; level -= BITS)
+            node = node->children[(index >> level) & MASK].get();
+        return node->values[index & MASK];
+    }
+
+    PersistentVector PersistentVector::assoc(size_t index, Ref value, size_t& allocated) const {
+        if(index == m_Size)
+            return conj(value, allocated);
+
+        PersistentVector result = *this;
+        size_t offset = tail_offset();
+        if(index >= offset) {
+            auto tail = std::make_shared<VectorNode>(*m_Tail);
+            tail->values[index - offset] = value;
+            tail->seal(allocated);
+            result.m_Tail = tail;
+        }
+        else
+            result.m_Root = assoc_path(m_Shift, m_Root.get(), index, value, allocated);
+        return result;
+    }
+
+    PersistentVector PersistentVector::conj(Ref value, size_t& allocated) const {
+        PersistentVector result = *this;
+        result.m_Size++;
+
+        if(m_Size - tail_offset() < WIDTH) {
+            auto tail = std::make_shared<VectorNode>(*m_Tail);
+            tail->values.push_back(value);
+            tail->seal(allocated);
+            result.m_Tail = tail;
+            return result;
+        }
+
+        // the full tail becomes a leaf, adding a level once the root is full
+        if((m_Size >> BITS) > (size_t(1) << m_Shift)) {
+            auto root = std::make_shared<VectorNode>();
+            root->children = {m_Root, new_path(m_Shift, m_Tail, allocated)};
+            root->seal(allocated);
+            result.m_Root = root;
+            result.m_Shift += BITS;
+        }
+        else
+            result.m_Root = push_tail(m_Size, m_Shift, m_Root.get(), m_Tail, allocated);
+
+        auto tail = std::make_shared<VectorNode>();
+        tail->values.push_back(value);
+        tail->seal(allocated);
+        result.m_Tail = tail;
+        return result;
+    }
+
+    void PersistentVector::for_each(const std::function<void(Ref)>& function) const {
+        visit(m_Root.get(), m_Shift, function);
+        for(auto& value : m_Tail->values)
+            function(value);
+    }
+
+    static void trace_node(const VectorNode* node, Heap& heap) {
+        if(!node->has_heap || !node->traced.visit(heap.get_epoch()))
+            return;
+        for(auto& child : node->children)
+            trace_node(child.get(), heap);
+        for(auto& value : node->values)
+            heap.mark(value);
+    }
+
+    void PersistentVector::trace(Heap& heap) const {
+        trace_node(m_Root.get(), heap);
+        trace_node(m_Tail.get(), heap);
+    }
+
+    size_t PersistentVector::bytes() const {
+        return node_bytes(m_Root.get()) + m_Tail->bytes();
+    }
+
+    // hashes are consumed 5 bits per level, keys with equal hashes end up in a collision node
+    // holding a plain list of entries
+    static constexpr unsigned HASH_BITS = sizeof(size_t) * 8;
+
+    struct MapNode {
+        // entries with a child hold the subtree of the keys sharing this level's hash bits
+        struct Entry {
+            Ref key;
+            Ref value;
+            std::shared_ptr<const MapNode> child;
+        };
+
+        // the hash slices present in `entries`, unused by collision nodes
+        uint32_t bitmap = 0;
+        std::vector<Entry> entries;
+
+        bool has_heap = false;
+        TraceEpoch traced;
+
+        size_t bytes() const {
+            return sizeof(MapNode) + entries.capacity() * sizeof(Entry);
+        }
+
+        void seal(size_t& allocated) {
+            has_heap = false;
+            for(auto& entry : entries)
+                has_heap |= entry.child ? entry.child->has_heap : entry.key.is_heap() || entry.value.is_heap();
+            allocated += bytes();
+        }
+    };
+
+    static std::shared_ptr<const MapNode> assoc_node(const MapNode* node, unsigned shift, size_t hash, Ref key, Ref value,
+                                                     bool& added, size_t& allocated) {
+        auto copy = node ? std::make_shared<MapNode>(*node) : std::make_shared<MapNode>();
+
+        if(shift >= HASH_BITS) {
+            auto entry = copy->entries.begin();
+            while(entry != copy->entries.end() && !entry->key.equals(key))
+                entry++;
+            if(entry != copy->entries.end())
+                entry->value = value;
+            else {
+                copy->entries.push_back({key, value, nullptr});
+                added = true;
+            }
+        }
+        else {
+            uint32_t bit = uint32_t(1) << ((hash >> shift) & MASK);
+            size_t index = __builtin_popcount(copy->bitmap & (bit - 1));
+
+            if(!(copy->bitmap & bit)) {
+                copy->entries.insert(copy->entries.begin() + index, {key, value, nullptr});
+                copy->bitmap |= bit;
+                added = true;
+            }
+            else {
+                auto& entry = copy->entries[index];
+                if(entry.child)
+                    entry.child = assoc_node(entry.child.get(), shift + BITS, hash, key, value, added, allocated);
+                else if(entry.key.equals(key))
+                    entry.value = value;
+                else {
+                    // two keys in the same slice move one level down
+                    bool moved = false;
+                    auto child = assoc_node(nullptr, shift + BITS, hash_value(entry.key), entry.key, entry.value, moved, allocated);
+                    entry = {Ref(), Ref(), assoc_node(child.get(), shift + BITS, hash, key, value, added, allocated)};
+                }
+            }
+        }
+
+        copy->seal(allocated);
+        return copy;
+    }
+
+    static void visit(const MapNode* node, const std::function<void(Ref, Ref)>& function) {
+        for(auto& entry : node->entries) {
+            if(entry.child)
+                visit(entry.child.get(), function);
+            else
+                function(entry.key, entry.value);
+        }
+    }
+
+    static size_t node_bytes(const MapNode* node) {
+        size_t bytes = node->bytes();
+        for(auto& entry : node->entries) {
+            if(entry.child)
+                bytes += node_bytes(entry.child.get());
+        }
+        return bytes;
+    }
+
+    const Ref* PersistentMap::find(Ref key) const {
+        size_t hash = hash_value(key);
+        auto node = m_Root.get();
+        for(unsigned shift = 0; node; shift += BITS) {
+            if(shift >= HASH_BITS) {
+                for(auto& entry : node->entries) {
+                    if(entry.key.equals(key))
+                        return &entry.value;
+                }
+                return nullptr;
+            }
+
+            uint32_t bit = uint32_t(1) << ((hash >> shift) & MASK);
+            if(!(node->bitmap & bit))
+                return nullptr;
+            auto& entry = node->entries[__builtin_popcount(node->bitmap & (bit - 1))];
+            if(!entry.child)
+                return entry.key.equals(key) ? &entry.value : nullptr;
+            node = entry.child.get();
+        }
+        return nullptr;
+    }
+
+    PersistentMap PersistentMap::assoc(Ref key, Ref value, size_t& allocated) const {
+        bool added = false;
+        PersistentMap result;
+        result.m_Root = assoc_node(m_Root.get(), 0, hash_value(key), key, value, added, allocated);
+        result.m_Size = m_Size + added;
+        return result;
+    }
+
+    void PersistentMap::for_each(const std::function<void(Ref, Ref)>& function) const {
+        if(m_Root)
+            visit(m_Root.get(), function);
+    }
+
+    static void trace_node(const MapNode* node, Heap& heap) {
+        if(!node->has_heap || !node->traced.visit(heap.get_epoch()))
+            return;
+        for(auto& entry : node->entries) {
+            if(entry.child)
+                trace_node(entry.child.get(), heap);
+            else {
+                heap.mark(entry.key);
+                heap.mark(entry.value);
+            }
+        }
+    }
+
+    void PersistentMap::trace(Heap& heap) const {
+        if(m_Root)
+            trace_node(m_Root.get(), heap);
+    }
+
+    size_t PersistentMap::bytes() const {
+        return m_Root ? node_bytes(m_Root.get()) : 0;
+    }
+}
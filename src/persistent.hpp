@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace lisp {
+    class Ref;
+    class Heap;
+    struct VectorNode;
+    struct MapNode;
+
+    // Immutable collections behind `vector` and `hash-map`. Updates copy the O(log32 n) nodes on
+    // the path to the change and share everything else with the original.
+    //
+    // Nodes are reference counted, the elements they hold are marked through the collection
+    // values referencing them. `allocated` counts the bytes of new nodes, which the heap adds to
+    // the size of the value built from the result.
+
+    // 32-way trie of the elements (Clojure's persistent vector), the last up to 32 elements are
+    // kept in a separate tail so appending rarely touches the trie
+    class PersistentVector {
+    public:
+        PersistentVector();
+
+        size_t size() const { return m_Size; }
+
+        // `index` has to be less than `size()`
+        Ref get(size_t index) const;
+        // `index` may be `size()` to append
+        PersistentVector assoc(size_t index, Ref value, size_t& allocated) const;
+        PersistentVector conj(Ref value, size_t& allocated) const;
+
+        void for_each(const std::function<void(Ref)>& function) const;
+        void trace(Heap& heap) const;
+        // size of all nodes, to account for a vector built from scratch
+        size_t bytes() const;
+
+    private:
+        size_t tail_offset() const;
+
+        size_t m_Size = 0;
+        // bits of the index consumed by the root's level
+        unsigned m_Shift;
+        std::shared_ptr<const VectorNode> m_Root;
+        std::shared_ptr<const VectorNode> m_Tail;
+    };
+
+    // hash array mapped trie, keys are hashed with `hash_value` and compared with `Ref::equals`
+    class PersistentMap {
+    public:
+        PersistentMap() {}
+
+        size_t size() const { return m_Size; }
+
+        const Ref* find(Ref key) const;
+        PersistentMap assoc(Ref key, Ref value, size_t& allocated) const;
+
+        void for_each(const std::function<void(Ref, Ref)>& function) const;
+        void trace(Heap& heap) const;
+        size_t bytes() const;
+
+    private:
+        size_t m_Size = 0;
+        std::shared_ptr<const MapNode> m_Root;
+    };
+}
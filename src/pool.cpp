@@ -0,0 +1,222 @@
+#include <unordered_set>
+
+#include "value.hpp"
+#include "pool.hpp"
+
+namespace lisp {
+    // cache the call targets of everything `value` can evaluate, so workers don't look them up
+    static void prepare(Ref value, Context& context, std::unordered_set<Value*>& visited) {
+        if(!value.is_heap() || !visited.insert(value.get()).second)
+            return;
+
+        switch(value.kind()) {
+        case ValueKind::Ident:
+            // functions can be passed around by name
+            if(auto symbol = context.get_symbol(dynamic_cast<IdentValue&>(*value).get_name()))
+                prepare(symbol.value(), context, visited);
+            break;
+        case ValueKind::Function:
+            prepare(dynamic_cast<FunctionValue&>(*value).get_body(), context, visited);
+            break;
+        case ValueKind::Compound: {
+            auto& compound = dynamic_cast<CompoundValue&>(*value);
+            compound.prepare(context);
+            for(auto& content : compound.get_contents())
+                prepare(content, context, visited);
+        } break;
+        default:
+            break;
+        }
+    }
+
+    // copy a result out of a worker's heap, values of the parent are shared as they are
+    static Ref transfer(Ref value, Context& worker, Context& context) {
+        if(!worker.get_heap().owns(value))
+            return value;
+
+        switch(value.kind()) {
+        case ValueKind::Number:
+            return context.get_number(dynamic_cast<NumberValue&>(*value).value());
+        case ValueKind::Float:
+            return context.get_float(dynamic_cast<FloatValue&>(*value).value());
+        case ValueKind::Array: {
+            auto& array = dynamic_cast<ArrayValue&>(*value);
+            if(array.is_float())
+                return context.alloc<ArrayValue>(array.floats());
+            return context.alloc<ArrayValue>(array.ints());
+        }
+        case ValueKind::String:
+            return context.get_string(dynamic_cast<StringValue&>(*value).get_value());
+        case ValueKind::Ident:
+            return context.get_ident(dynamic_cast<IdentValue&>(*value).get_name());
+        case ValueKind::Error:
+            return context.get_error(*value.is_error().value());
+        case ValueKind::Quote:
+            return context.alloc<QuoteValue>(transfer(dynamic_cast<QuoteValue&>(*value).get_quoted(), worker, context));
+        case ValueKind::Compound: {
+            RefList contents;
+            for(auto& content : dynamic_cast<CompoundValue&>(*value).get_contents())
+                contents.push_back(transfer(content, worker, context));
+            return context.alloc<CompoundValue>(std::move(contents));
+        }
+        case ValueKind::Vector: {
+            PersistentVector elements;
+            size_t copied = 0;
+            dynamic_cast<VectorValue&>(*value).elements().for_each([&](Ref element) {
+                elements = elements.conj(transfer(element, worker, context), copied);
+            });
+            return context.alloc<VectorValue>(elements, elements.bytes());
+        }
+        case ValueKind::Map: {
+            PersistentMap entries;
+            size_t copied = 0;
+            dynamic_cast<MapValue&>(*value).entries().for_each([&](Ref key, Ref value) {
+                entries = entries.assoc(transfer(key, worker, context), transfer(value, worker, context), copied);
+            });
+            return context.alloc<MapValue>(entries, entries.bytes());
+        }
+        case ValueKind::Function: {
+            // bodies are part of the program, which the parent owns
+            auto& function = dynamic_cast<FunctionValue&>(*value);
+            return context.alloc<FunctionValue>(function.get_name(), function.get_arguments(), function.get_body());
+        }
+        default:
+            return ERROR("can't return this value from a parallel call");
+        }
+    }
+
+    ThreadPool::ThreadPool(Context& parent, size_t threads) : m_Parent(parent) {
+        pthread_attr_t attributes;
+        pthread_attr_init(&attributes);
+        pthread_attr_setstacksize(&attributes, STACK_SIZE);
+
+        for(size_t i = 0; i < threads; i++) {
+            auto worker = std::make_unique<Worker>();
+            worker->pool = this;
+            worker->id = i + 1;
+            if(pthread_create(&worker->thread, &attributes, start, worker.get()) != 0)
+                break;
+            m_Workers.push_back(std::move(worker));
+        }
+        pthread_attr_destroy(&attributes);
+
+        // worker contexts are created on their own threads, to measure their stacks
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_Done.wait(lock, [&] { return m_Ready == m_Workers.size(); });
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Stop = true;
+        }
+        m_Wake.notify_all();
+        for(auto& worker : m_Workers)
+            pthread_join(worker->thread, nullptr);
+    }
+
+    void* ThreadPool::start(void* worker) {
+        auto self = static_cast<Worker*>(worker);
+        self->pool->work(*self);
+        return nullptr;
+    }
+
+    void ThreadPool::work(Worker& worker) {
+        Context context(m_Parent, worker.id, STACK_SIZE);
+        uint64_t batch = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            worker.context = &context;
+            m_Ready++;
+        }
+        m_Done.notify_all();
+
+        for(;;) {
+            {
+                std::unique_lock<std::mutex> lock(m_Mutex);
+                m_Wake.wait(lock, [&] { return m_Stop || m_Batch != batch; });
+                if(m_Stop)
+                    return;
+                batch = m_Batch;
+            }
+
+            while(auto task = next(worker)) {
+                context.clear_globals();
+                task->result = m_Function->apply(context, {task->argument});
+                task->worker = &worker;
+                // keep the result alive until the caller copied it
+                context.push(task->result);
+
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                if(--m_Pending == 0)
+                    m_Done.notify_all();
+            }
+        }
+    }
+
+    ThreadPool::Task* ThreadPool::next(Worker& worker) {
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            if(!worker.queue.empty()) {
+                auto task = worker.queue.back();
+                worker.queue.pop_back();
+                return task;
+            }
+        }
+
+        for(size_t i = 1; i < m_Workers.size(); i++) {
+            auto& victim = *m_Workers[(worker.id - 1 + i) % m_Workers.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if(!victim.queue.empty()) {
+                auto task = victim.queue.front();
+                victim.queue.pop_front();
+                return task;
+            }
+        }
+        return nullptr;
+    }
+
+    std::vector<Ref> ThreadPool::map(FunctionValue& function, const std::vector<Ref>& arguments) {
+        auto& context = m_Parent;
+        std::vector<Ref> results;
+        if(arguments.empty())
+            return results;
+        if(m_Workers.empty()) {
+            results.assign(arguments.size(), ERROR("could not start worker threads"));
+            return results;
+        }
+
+        std::unordered_set<Value*> visited;
+        prepare(&function, context, visited);
+        for(auto& argument : arguments)
+            prepare(argument, context, visited);
+
+        // set before queueing, workers still looking for tasks of the last batch can take them
+        std::vector<Task> tasks(arguments.size());
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Function = &function;
+            m_Pending = tasks.size();
+        }
+        for(size_t i = 0; i < tasks.size(); i++) {
+            tasks[i].argument = arguments[i];
+            auto& worker = *m_Workers[i % m_Workers.size()];
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.queue.push_back(&tasks[i]);
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_Batch++;
+            m_Wake.notify_all();
+            m_Done.wait(lock, [&] { return m_Pending == 0; });
+        }
+
+        // the workers are idle until the next batch, so their heaps can be read and released
+        for(auto& task : tasks)
+            results.push_back(transfer(task.result, *task.worker->context, context));
+        for(auto& worker : m_Workers)
+            worker->context->get_stack().clear();
+        return results;
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <pthread.h>
+
+#include "value.hpp"
+
+namespace lisp {
+    // Work-stealing thread pool for `pcall` and `pmap`.
+    //
+    // Every worker thread owns a worker `Context` and a queue of tasks. A batch is spread over
+    // the queues, workers take tasks from the back of their own queue and steal from the front
+    // of the others' once it runs dry. The calling thread blocks until the batch is done, so the
+    // program and the parent's globals stay unchanged while the workers read them.
+    class ThreadPool {
+    public:
+        // matches the main thread's stack limit, only committed as far as it is used
+        static constexpr size_t STACK_SIZE = 64 << 20;
+
+        ThreadPool(Context& parent, size_t threads);
+        ThreadPool(const ThreadPool&) = delete;
+        ~ThreadPool();
+
+        size_t size() const { return m_Workers.size(); }
+
+        // call `function` with each of `arguments` on the workers, returning the results copied
+        // into the parent's heap
+        std::vector<Ref> map(FunctionValue& function, const std::vector<Ref>& arguments);
+
+    private:
+        struct Worker;
+
+        struct Task {
+            Ref argument;
+            // in the heap of the worker that ran the task, which keeps it on its stack
+            Ref result;
+            Worker* worker = nullptr;
+        };
+
+        struct Worker {
+            ThreadPool* pool;
+            uint16_t id;
+            pthread_t thread;
+            Context* context = nullptr;
+
+            std::mutex mutex;
+            std::deque<Task*> queue;
+        };
+
+        static void* start(void* worker);
+        void work(Worker& worker);
+        Task* next(Worker& worker);
+
+        Context& m_Parent;
+        std::vector<std::unique_ptr<Worker>> m_Workers;
+        FunctionValue* m_Function = nullptr;
+
+        std::mutex m_Mutex;
+        std::condition_variable m_Wake;
+        std::condition_variable m_Done;
+        uint64_t m_Batch = 0;
+        size_t m_Pending = 0;
+        size_t m_Ready = 0;
+        bool m_Stop = false;
+    };
+}
@@ -0,0 +1,193 @@
+#include <cerrno>
+#include <cstring>
+#include <unordered_set>
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "port.hpp"
+#include "value.hpp"
+
+namespace lisp {
+    // the output ports of the process for `flush_all`, outlives the static ports since it's
+    // created by the first of them
+    struct OpenPorts {
+        std::mutex mutex;
+        std::unordered_set<FilePort*> ports;
+    };
+
+    static OpenPorts& open_ports() {
+        static OpenPorts open;
+        return open;
+    }
+
+    FilePort::FilePort(int fd, Mode mode, bool line_buffered, bool owned)
+        : m_Fd(fd), m_Mode(mode), m_LineBuffered(line_buffered), m_Owned(owned), m_Buffer(new char[BUFFER_SIZE]), m_Stream(this) {
+        if(m_Mode == Mode::Output) {
+            setp(m_Buffer.get(), m_Buffer.get() + BUFFER_SIZE);
+            auto& open = open_ports();
+            std::lock_guard<std::mutex> lock(open.mutex);
+            open.ports.insert(this);
+        }
+    }
+
+    FilePort::~FilePort() {
+        close();
+        if(m_Mode == Mode::Output) {
+            auto& open = open_ports();
+            std::lock_guard<std::mutex> lock(open.mutex);
+            open.ports.erase(this);
+        }
+    }
+
+    std::unique_ptr<FilePort> FilePort::open(const char* path, Mode mode, bool append) {
+        int flags = O_CLOEXEC;
+        if(mode == Mode::Input)
+            flags |= O_RDONLY;
+        else
+            flags |= O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC);
+
+        int fd = ::open(path, flags, 0644);
+        if(fd < 0)
+            return nullptr;
+        return std::make_unique<FilePort>(fd, mode, false, true);
+    }
+
+    FilePort& FilePort::standard_output() {
+        static FilePort port(STDOUT_FILENO, Mode::Output, isatty(STDOUT_FILENO), false);
+        return port;
+    }
+
+    void FilePort::flush_all() {
+        auto& open = open_ports();
+        // waiting could deadlock a signal handler that interrupted the thread holding the lock
+        std::unique_lock<std::mutex> lock(open.mutex, std::try_to_lock);
+        if(!lock.owns_lock()) {
+            standard_output().flush();
+            return;
+        }
+        for(auto port : open.ports)
+            port->flush();
+    }
+
+    void FilePort::commit() {
+        if(m_LineBuffered && memchr(pbase(), '\n', pptr() - pbase()))
+            flush();
+    }
+
+    bool FilePort::flush() {
+        if(m_Mode == Mode::Output)
+            write_out(nullptr, 0);
+        return !m_Failed;
+    }
+
+    void FilePort::write_out(const char* data, size_t size) {
+        iovec parts[2] = {{pbase(), size_t(pptr() - pbase())}, {const_cast<char*>(data), size}};
+        setp(m_Buffer.get(), m_Buffer.get() + BUFFER_SIZE);
+        if(m_Fd < 0 || m_Failed)
+            return;
+
+        iovec* part = parts;
+        int count = 2;
+        while(count > 0) {
+            if(part->iov_len == 0) {
+                part++;
+                count--;
+                continue;
+            }
+
+            auto written = writev(m_Fd, part, count);
+            if(written < 0 && errno == EINTR)
+                continue;
+            if(written < 0) {
+                m_Failed = true;
+                return;
+            }
+            // a partial write continues where it stopped
+            while(count > 0 && size_t(written) >= part->iov_len) {
+                written -= part->iov_len;
+                part++;
+                count--;
+            }
+            if(count > 0) {
+                part->iov_base = static_cast<char*>(part->iov_base) + written;
+                part->iov_len -= written;
+            }
+        }
+    }
+
+    FilePort::int_type FilePort::overflow(int_type c) {
+        if(traits_type::eq_int_type(c, traits_type::eof()))
+            return traits_type::not_eof(c);
+        char byte = traits_type::to_char_type(c);
+        write_out(&byte, 1);
+        return c;
+    }
+
+    std::streamsize FilePort::xsputn(const char* data, std::streamsize size) {
+        if(size <= epptr() - pptr()) {
+            memcpy(pptr(), data, size);
+            pbump(size);
+        }
+        else
+            write_out(data, size);
+        return size;
+    }
+
+    int FilePort::sync() {
+        return flush() ? 0 : -1;
+    }
+
+    bool FilePort::fill() {
+        m_Begin = m_End = 0;
+        for(;;) {
+            auto size = ::read(m_Fd, m_Buffer.get(), BUFFER_SIZE);
+            if(size < 0 && errno == EINTR)
+                continue;
+            if(size <= 0)
+                return false;
+            m_End = size;
+            return true;
+        }
+    }
+
+    bool FilePort::read_line(std::string& line) {
+        line.clear();
+        if(m_Fd < 0 || m_Mode != Mode::Input)
+            return false;
+
+        for(;;) {
+            auto begin = m_Buffer.get() + m_Begin;
+            auto newline = static_cast<char*>(memchr(begin, '\n', m_End - m_Begin));
+            if(newline) {
+                line.append(begin, newline);
+                m_Begin = newline + 1 - m_Buffer.get();
+                return true;
+            }
+
+            line.append(begin, m_End - m_Begin);
+            // the last line may not end with a line break
+            if(!fill())
+                return !line.empty();
+        }
+    }
+
+    bool FilePort::close() {
+        bool flushed = flush();
+        if(m_Fd < 0)
+            return flushed;
+
+        bool closed = !m_Owned || ::close(m_Fd) == 0;
+        m_Fd = -1;
+        return flushed && closed;
+    }
+
+    PortValue::PortValue(std::unique_ptr<FilePort> port, std::string path) : m_Port(std::move(port)), m_Path(std::move(path)) {}
+
+    PortValue::~PortValue() {}
+
+    size_t PortValue::owned_bytes() const {
+        return FilePort::BUFFER_SIZE + m_Path.capacity();
+    }
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <string_view>
+
+namespace lisp {
+    // Buffered file descriptor behind `print`, `write` and `read-line`.
+    //
+    // Values are printed straight into a user-space buffer, which is written out once it is full,
+    // on `(flush)`, when the port is closed or, for line buffered ports, once a builtin has ended a
+    // line. Text that doesn't fit into the buffer is written together with the buffered text in
+    // one `writev` instead of being copied. Standard output is line buffered when it's a terminal
+    // and block buffered otherwise.
+    //
+    // Ports can be shared between threads, writers hold `lock()` while they write a line so the
+    // lines of different threads don't mix.
+    //
+    // Output still buffered when the process ends is written by the destructors of the ports,
+    // which a process ending with `_exit` or a signal never runs. Whoever exits that way calls
+    // `flush_all()` first, like the forked workers of the server do.
+    class FilePort : public std::streambuf {
+    public:
+        static constexpr size_t BUFFER_SIZE = 64 << 10;
+
+        enum class Mode {
+            Input,
+            Output
+        };
+
+        FilePort(int fd, Mode mode, bool line_buffered, bool owned);
+        FilePort(const FilePort&) = delete;
+        ~FilePort();
+
+        // a port on the file at `path`, nullptr and `errno` on failure
+        static std::unique_ptr<FilePort> open(const char* path, Mode mode, bool append = false);
+
+        // stdout, shared by every interpreter of the process and flushed when it exits
+        static FilePort& standard_output();
+
+        // flush every open output port of the process, before it ends without running their
+        // destructors. usable in signal handlers, where the text a write was just adding may be
+        // lost, and if another thread is opening or closing a port only stdout is flushed
+        static void flush_all();
+
+        std::unique_lock<std::mutex> lock() { return std::unique_lock<std::mutex>(m_Mutex); }
+
+        // formats into the buffer, for `Value::print`
+        std::ostream& stream() { return m_Stream; }
+        void write(std::string_view text) { xsputn(text.data(), text.size()); }
+
+        // called once a builtin is done writing, a line buffered port flushes if a line ended
+        void commit();
+        // false once writing to the descriptor failed
+        bool flush();
+
+        // the next line without its line break, false at the end of the input
+        bool read_line(std::string& line);
+
+        // flush and close the descriptor, false if either failed
+        bool close();
+
+        Mode get_mode() const { return m_Mode; }
+        bool is_open() const { return m_Fd >= 0; }
+
+    protected:
+        int_type overflow(int_type c) override;
+        std::streamsize xsputn(const char* data, std::streamsize size) override;
+        int sync() override;
+
+    private:
+        // write the buffered text followed by `size` bytes of `data`
+        void write_out(const char* data, size_t size);
+        bool fill();
+
+        int m_Fd;
+        Mode m_Mode;
+        bool m_LineBuffered;
+        bool m_Owned;
+        bool m_Failed = false;
+
+        std::unique_ptr<char[]> m_Buffer;
+        // unread input in the buffer
+        size_t m_Begin = 0;
+        size_t m_End = 0;
+
+        std::ostream m_Stream;
+        std::mutex m_Mutex;
+    };
+}
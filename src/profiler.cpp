@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <csignal>
+#include <iomanip>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <sys/time.h>
+
+#include "profiler.hpp"
+
+namespace lisp {
+    static Profiler* active_profiler = nullptr;
+
+    Profiler::Profiler()
+        : m_Stack(new uint32_t[MAX_DEPTH]), m_Samples(new uint32_t[SAMPLE_BUFFER_SIZE]) {}
+
+    Profiler::~Profiler() {
+        if(active_profiler == this)
+            stop();
+    }
+
+    void Profiler::start() {
+        active_profiler = this;
+
+        struct sigaction action = {};
+        action.sa_handler = handle_signal;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGPROF, &action, nullptr);
+
+        struct itimerval timer = {};
+        timer.it_interval.tv_usec = SAMPLE_INTERVAL_US;
+        timer.it_value.tv_usec = SAMPLE_INTERVAL_US;
+        setitimer(ITIMER_PROF, &timer, nullptr);
+    }
+
+    void Profiler::stop() {
+        struct itimerval timer = {};
+        setitimer(ITIMER_PROF, &timer, nullptr);
+        signal(SIGPROF, SIG_IGN);
+        active_profiler = nullptr;
+        drain();
+    }
+
+    void Profiler::handle_signal(int) {
+        if(active_profiler)
+            active_profiler->sample();
+    }
+
+    void Profiler::sample() {
+        size_t depth = std::min(m_Depth.load(std::memory_order_relaxed), MAX_DEPTH);
+        std::atomic_signal_fence(std::memory_order_acquire);
+
+        size_t end = m_SampleEnd.load(std::memory_order_relaxed);
+        if(end + depth + 1 > SAMPLE_BUFFER_SIZE) {
+            m_Dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        m_Samples[end] = depth;
+        std::copy(m_Stack.get(), m_Stack.get() + depth, m_Samples.get() + end + 1);
+        m_SampleEnd.store(end + depth + 1, std::memory_order_relaxed);
+    }
+
+    void Profiler::drain() {
+        // keep the handler from appending while the buffer is read and reset
+        sigset_t block, previous;
+        sigemptyset(&block);
+        sigaddset(&block, SIGPROF);
+        sigprocmask(SIG_BLOCK, &block, &previous);
+
+        size_t end = m_SampleEnd.load(std::memory_order_relaxed);
+        for(size_t i = 0; i < end; i += m_Samples[i] + 1) {
+            auto begin = m_Samples.get() + i + 1;
+            m_Stacks[std::vector<uint32_t>(begin, begin + m_Samples[i])]++;
+            m_SampleCount++;
+        }
+        m_SampleEnd.store(0, std::memory_order_relaxed);
+
+        sigprocmask(SIG_SETMASK, &previous, nullptr);
+    }
+
+    std::ostream& Profiler::print_report(std::ostream& stream) const {
+        struct Entry {
+            uint64_t calls = 0;
+            uint64_t self = 0;
+            uint64_t inclusive = 0;
+        };
+
+        // functions redefined under the same name are reported together
+        std::unordered_map<std::string, Entry> entries;
+        for(size_t id = 1; id < m_Names.size(); id++)
+            entries[m_Names[id]].calls += m_Calls[id];
+
+        for(auto& [stack, count] : m_Stacks) {
+            if(stack.empty())
+                continue;
+            entries[m_Names[stack.back()]].self += count;
+
+            std::unordered_set<std::string> seen;
+            for(auto id : stack) {
+                if(seen.insert(m_Names[id]).second)
+                    entries[m_Names[id]].inclusive += count;
+            }
+        }
+
+        std::vector<std::pair<std::string, Entry>> sorted(entries.begin(), entries.end());
+        std::sort(sorted.begin(), sorted.end(), [](auto& a, auto& b) {
+            return a.second.self != b.second.self ? a.second.self > b.second.self : a.first < b.first;
+        });
+
+        double interval = SAMPLE_INTERVAL_US / 1000.0;
+        stream << "[Profile]: " << m_SampleCount << " samples every " << interval << " ms";
+        if(auto dropped = m_Dropped.load())
+            stream << ", " << dropped << " dropped";
+        stream << std::endl
+               << "[Profile]: " << std::setw(12) << "calls" << std::setw(12) << "self ms" << std::setw(12) << "total ms" << "  function" << std::endl;
+        for(auto& [name, entry] : sorted) {
+            stream << "[Profile]: " << std::setw(12) << entry.calls
+                   << std::setw(12) << entry.self * interval
+                   << std::setw(12) << entry.inclusive * interval << "  " << name << std::endl;
+        }
+        return stream;
+    }
+
+    std::ostream& Profiler::write_collapsed(std::ostream& stream) const {
+        std::map<std::string, uint64_t> stacks;
+        for(auto& [stack, count] : m_Stacks) {
+            std::string names = m_Names[0];
+            for(auto id : stack)
+                names += ";" + m_Names[id];
+            stacks[names] += count;
+        }
+
+        for(auto& [names, count] : stacks)
+            stream << names << " " << count << std::endl;
+        return stream;
+    }
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "value.hpp"
+
+namespace lisp {
+    // Counts calls per function and samples the Lisp call stack on a CPU-time timer.
+    //
+    // Calls only push and pop function ids, so the instrumentation stays cheap. The `SIGPROF`
+    // handler copies the current stack into a preallocated buffer, which function entries drain
+    // into per-stack counts once it fills up. Self and inclusive times are estimated from those
+    // counts when the report is written.
+    class Profiler {
+    public:
+        static constexpr uint32_t SAMPLE_INTERVAL_US = 1000;
+        static constexpr size_t MAX_DEPTH = 1 << 18;
+        static constexpr size_t SAMPLE_BUFFER_SIZE = 4 << 20;
+
+        Profiler();
+        Profiler(const Profiler&) = delete;
+        ~Profiler();
+
+        // only one profiler can sample at a time
+        void start();
+        void stop();
+
+        void enter(FunctionValue& function) {
+            if(m_SampleEnd.load(std::memory_order_relaxed) > SAMPLE_BUFFER_SIZE / 2)
+                drain();
+
+            uint32_t id = function.get_profile_id();
+            if(!id) {
+                id = m_Names.size();
+                m_Names.push_back(function.get_name());
+                m_Calls.push_back(0);
+                function.set_profile_id(id);
+            }
+            m_Calls[id]++;
+
+            size_t depth = m_Depth.load(std::memory_order_relaxed);
+            if(depth < MAX_DEPTH)
+                m_Stack[depth] = id;
+            std::atomic_signal_fence(std::memory_order_release);
+            m_Depth.store(depth + 1, std::memory_order_relaxed);
+        }
+
+        void leave() {
+            m_Depth.store(m_Depth.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+        }
+
+        // a tail call replaces the caller's frame
+        void replace(FunctionValue& function) {
+            leave();
+            enter(function);
+        }
+
+        // per-function calls, self and inclusive time, sorted by self time
+        std::ostream& print_report(std::ostream& stream) const;
+        // one `caller;callee count` line per distinct stack, for flamegraph tools
+        std::ostream& write_collapsed(std::ostream& stream) const;
+
+    private:
+        static void handle_signal(int);
+        void sample();
+        void drain();
+
+        // id 0 stands for the top level, outside of any function
+        std::vector<std::string> m_Names = {"main"};
+        std::vector<uint64_t> m_Calls = {0};
+
+        std::unique_ptr<uint32_t[]> m_Stack;
+        std::atomic<size_t> m_Depth = 0;
+
+        // samples are stored back to back as a depth followed by that many ids
+        std::unique_ptr<uint32_t[]> m_Samples;
+        std::atomic<size_t> m_SampleEnd = 0;
+        std::atomic<size_t> m_Dropped = 0;
+
+        std::map<std::vector<uint32_t>, uint64_t> m_Stacks;
+        uint64_t m_SampleCount = 0;
+    };
+}
@@ -0,0 +1,165 @@
+#include <algorithm>
+
+#include "resolver.hpp"
+#include "builtin.hpp"
+#include "value.hpp"
+
+namespace lisp {
+    // argument and `let` names of the enclosing frames, innermost last. a name's index in its
+    // frame is its slot, and `let` names are only in scope for the body of their `let`
+    using Scope = std::vector<std::vector<std::string>>;
+
+    static void resolve(Ref& value, Scope& scope, Context& context);
+
+    static std::optional<Ref> lookup(IdentValue& ident, Scope& scope, Context& context) {
+        for(size_t depth = 0; depth < scope.size(); depth++) {
+            auto& frame = scope[scope.size() - depth - 1];
+            // later names shadow earlier ones
+            for(size_t slot = frame.size(); slot-- > 0;) {
+                if(frame[slot] == ident.get_name())
+                    return context.alloc_syntax<LocalValue>(ident.get_name(), depth, slot);
+            }
+        }
+        return std::nullopt;
+    }
+
+    static void resolve_defun(RefList& args, Context& context) {
+        // malformed definitions are reported by `defun` itself
+        if(args.size() != 4 || args[1].kind() != ValueKind::Ident || args[2].kind() != ValueKind::Compound)
+            return;
+
+        std::vector<std::string> arguments;
+        for(auto& argument : dynamic_cast<CompoundValue&>(*args[2]).get_contents()) {
+            if(argument.kind() != ValueKind::Ident)
+                return;
+            arguments.push_back(dynamic_cast<IdentValue&>(*argument).get_name());
+        }
+
+        // functions don't capture their surroundings, so the body only sees its own arguments
+        Scope scope = {arguments};
+        resolve(args[3], scope, context);
+    }
+
+    // the `(name value)` pairs of `let`, or nothing if they are malformed
+    static std::optional<std::vector<RefList*>> bindings(RefList& args) {
+        if(args.size() < 2 || args[1].kind() != ValueKind::Compound)
+            return std::nullopt;
+
+        std::vector<RefList*> pairs;
+        for(auto& binding : dynamic_cast<CompoundValue&>(*args[1]).get_contents()) {
+            if(binding.kind() != ValueKind::Compound)
+                return std::nullopt;
+            auto& pair = dynamic_cast<CompoundValue&>(*binding).get_contents();
+            if(pair.size() != 2 || pair[0].kind() != ValueKind::Ident)
+                return std::nullopt;
+            pairs.push_back(&pair);
+        }
+        return pairs;
+    }
+
+    // `let` and `dotimes` bind their names to new slots at the end of the current frame, which are
+    // free again after the body, so the frame of a function is sized once for all its bindings.
+    // `names` are the bound pairs, `hidden` the slots reserved after them for the loop state of
+    // `dotimes`
+    static void resolve_bindings(RefList& args, std::vector<RefList*> names, size_t hidden, Scope& scope, Context& context) {
+        auto& frame = scope.back();
+        size_t first = frame.size();
+        // the slots are reserved while the values are resolved, with names no identifier has, so
+        // a `let` in a value can't reuse them and the values don't see the new names
+        frame.resize(first + names.size() + hidden);
+        for(auto pair : names)
+            resolve((*pair)[1], scope, context);
+
+        for(size_t i = 0; i < names.size(); i++) {
+            auto& name = dynamic_cast<IdentValue&>(*(*names[i])[0]).get_name();
+            frame[first + i] = name;
+            (*names[i])[0] = context.alloc_syntax<LocalValue>(name, 0, first + i);
+        }
+        for(size_t i = 2; i < args.size(); i++)
+            resolve(args[i], scope, context);
+        frame.resize(first);
+    }
+
+    static void resolve_let(RefList& args, Scope& scope, Context& context) {
+        // malformed bindings are reported by `let` itself
+        auto pairs = bindings(args);
+        if(!pairs)
+            return;
+        resolve_bindings(args, pairs.value(), 0, scope, context);
+    }
+
+    static void resolve_dotimes(RefList& args, Scope& scope, Context& context) {
+        if(args.size() < 2 || args[1].kind() != ValueKind::Compound)
+            return;
+        auto& pair = dynamic_cast<CompoundValue&>(*args[1]).get_contents();
+        if(pair.size() != 2 || pair[0].kind() != ValueKind::Ident)
+            return;
+        // the count and counter of the compiled loop
+        resolve_bindings(args, {&pair}, 2, scope, context);
+    }
+
+    static void resolve(Ref& value, Scope& scope, Context& context) {
+        switch(value.kind()) {
+        case ValueKind::Ident:
+            if(auto local = lookup(dynamic_cast<IdentValue&>(*value), scope, context))
+                value = local.value();
+            break;
+        case ValueKind::Compound: {
+            auto& contents = dynamic_cast<CompoundValue&>(*value).get_contents();
+            size_t first = 0;
+            if(!contents.empty() && contents[0].kind() == ValueKind::Ident) {
+                auto& name = dynamic_cast<IdentValue&>(*contents[0]).get_name();
+                if(name == "defun" || name == "defun-memo")
+                    return resolve_defun(contents, context);
+                if(name == "let")
+                    return resolve_let(contents, scope, context);
+                if(name == "dotimes")
+                    return resolve_dotimes(contents, scope, context);
+                // builtins can't be shadowed
+                if(BUILTINS.find(name) != BUILTINS.end())
+                    first = 1;
+            }
+
+            for(size_t i = first; i < contents.size(); i++)
+                resolve(contents[i], scope, context);
+        } break;
+        default:
+            break;
+        }
+    }
+
+    static void count_slots(Ref value, size_t& size) {
+        switch(value.kind()) {
+        case ValueKind::Local: {
+            auto& local = dynamic_cast<LocalValue&>(*value);
+            if(local.get_depth() == 0)
+                size = std::max<size_t>(size, local.get_slot() + 1);
+        } break;
+        case ValueKind::Compound: {
+            auto& contents = dynamic_cast<CompoundValue&>(*value).get_contents();
+            // nested definitions get frames of their own
+            if(!contents.empty() && contents[0].kind() == ValueKind::Ident) {
+                auto& name = dynamic_cast<IdentValue&>(*contents[0]).get_name();
+                if(name == "defun" || name == "defun-memo")
+                    return;
+            }
+            for(auto& content : contents)
+                count_slots(content, size);
+        } break;
+        default:
+            break;
+        }
+    }
+
+    size_t frame_size(Ref body, size_t arity) {
+        size_t size = arity;
+        count_slots(body, size);
+        return size;
+    }
+
+    void resolve(Ref& value, Context& context) {
+        // top-level bindings live in the frame of the program
+        Scope scope = {{}};
+        resolve(value, scope, context);
+    }
+}
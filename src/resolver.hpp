@@ -0,0 +1,13 @@
+#pragma once
+
+#include "value.hpp"
+
+namespace lisp {
+    // rewrite identifiers referring to function arguments and `let` bindings into `LocalValue`
+    // frame/slot references
+    void resolve(Ref& value, Context& context);
+
+    // slots of the frame a resolved function body runs in, its arguments followed by the
+    // bindings of its `let` and `dotimes` forms
+    size_t frame_size(Ref body, size_t arity);
+}
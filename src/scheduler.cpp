@@ -0,0 +1,251 @@
+#include <algorithm>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "scheduler.hpp"
+#include "gc.hpp"
+
+namespace lisp {
+    Fiber::~Fiber() {
+        if(stack)
+            munmap(stack, Scheduler::STACK_SIZE);
+    }
+
+    void Fiber::trace(Heap& heap) {
+        for(auto& value : state.stack)
+            heap.mark(value);
+        for(auto& call : state.memos) {
+            heap.mark(call.function);
+            for(auto& value : call.key)
+                heap.mark(value);
+        }
+        heap.mark(value);
+    }
+
+    TaskValue::TaskValue(Ref expression, std::unique_ptr<Fiber> fiber) : m_Expression(expression), m_Fiber(std::move(fiber)) {
+        m_Fiber->task = this;
+    }
+
+    TaskValue::~TaskValue() {}
+
+    size_t TaskValue::owned_bytes() const {
+        return sizeof(Fiber);
+    }
+
+    Scheduler::~Scheduler() {
+        release_finished();
+        for(auto stack : m_FreeStacks)
+            munmap(stack, STACK_SIZE);
+    }
+
+    Ref Scheduler::spawn(Ref expression) {
+        auto stack = alloc_stack();
+        if(!stack)
+            return m_Context.get_error("can't allocate a task stack");
+
+        auto fiber = std::make_unique<Fiber>();
+        fiber->stack = stack;
+        fiber->state = Context::new_state(stack + STACK_SIZE, STACK_SIZE);
+        // locals of the expression refer to the innermost frame, which becomes the task's only one
+        fiber->state.stack = m_Context.get_frame();
+        if(!fiber->state.stack.empty())
+            fiber->state.frames.push_back(0);
+
+        getcontext(&fiber->registers);
+        fiber->registers.uc_stack.ss_sp = stack;
+        fiber->registers.uc_stack.ss_size = STACK_SIZE;
+        fiber->registers.uc_link = nullptr;
+        auto self = reinterpret_cast<uintptr_t>(this);
+        makecontext(&fiber->registers, reinterpret_cast<void (*)()>(start), 2, unsigned(self >> 32), unsigned(self));
+
+        auto task = m_Context.alloc<TaskValue>(expression, std::move(fiber));
+        m_Live.insert(task);
+        m_Ready.push_back(task->get_fiber());
+        return task;
+    }
+
+    Ref Scheduler::await(TaskValue& task) {
+        if(task.is_done())
+            return task.get_result();
+
+        auto& awaiters = task.get_awaiters();
+        awaiters.push_back(m_Current);
+        if(!block()) {
+            awaiters.erase(std::find(awaiters.begin(), awaiters.end(), m_Current));
+            return deadlock();
+        }
+        return task.get_result();
+    }
+
+    Ref Scheduler::send(ChannelValue& channel, Ref value) {
+        auto& receivers = channel.get_receivers();
+        if(!receivers.empty()) {
+            auto receiver = receivers.front();
+            receivers.pop_front();
+            receiver->value = value;
+            m_Ready.push_back(receiver);
+            return m_Context.get_const_val(ConstValue::Kind::Nil);
+        }
+
+        if(channel.get_buffer().size() < channel.get_capacity()) {
+            channel.get_buffer().push_back(value);
+            return m_Context.get_const_val(ConstValue::Kind::Nil);
+        }
+
+        // a receiver takes the value from the waiting sender
+        auto& senders = channel.get_senders();
+        senders.push_back({m_Current, value});
+        if(!block()) {
+            senders.erase(std::find_if(senders.begin(), senders.end(), [&](auto& sender) { return sender.fiber == m_Current; }));
+            return deadlock();
+        }
+        return m_Context.get_const_val(ConstValue::Kind::Nil);
+    }
+
+    Ref Scheduler::recv(ChannelValue& channel) {
+        auto& buffer = channel.get_buffer();
+        auto& senders = channel.get_senders();
+        if(!buffer.empty() || !senders.empty()) {
+            Ref value;
+            if(!buffer.empty()) {
+                value = buffer.front();
+                buffer.pop_front();
+            }
+
+            // the first waiting sender fills the space that was freed
+            if(!senders.empty()) {
+                auto sender = senders.front();
+                senders.pop_front();
+                if(value)
+                    buffer.push_back(sender.value);
+                else
+                    value = sender.value;
+                m_Ready.push_back(sender.fiber);
+            }
+            return value;
+        }
+
+        auto& receivers = channel.get_receivers();
+        receivers.push_back(m_Current);
+        if(!block()) {
+            receivers.erase(std::find(receivers.begin(), receivers.end(), m_Current));
+            return deadlock();
+        }
+
+        auto value = m_Current->value;
+        m_Current->value = Ref();
+        return value;
+    }
+
+    void Scheduler::yield() {
+        if(m_Ready.empty())
+            return;
+        m_Ready.push_back(m_Current);
+        block();
+    }
+
+    void Scheduler::run() {
+        while(!m_Ready.empty())
+            yield();
+    }
+
+    void Scheduler::trace(Heap& heap) {
+        m_Main.trace(heap);
+        for(auto task : m_Live)
+            heap.mark(task);
+    }
+
+    void Scheduler::start(unsigned high, unsigned low) {
+        auto scheduler = reinterpret_cast<Scheduler*>((uintptr_t(high) << 32) | low);
+        scheduler->run_task();
+    }
+
+    void Scheduler::run_task() {
+        release_finished();
+
+        auto task = m_Current->task;
+        auto result = task->get_expression().eval(m_Context);
+        task->set_result(result);
+        for(auto awaiter : task->get_awaiters())
+            m_Ready.push_back(awaiter);
+        task->get_awaiters().clear();
+        m_Live.erase(task);
+
+        // the stack can only be given back once the next fiber is running on its own
+        m_Finished = m_Current->stack;
+        m_Current->stack = nullptr;
+        block();
+        __builtin_unreachable();
+    }
+
+    bool Scheduler::block() {
+        Fiber* next;
+        if(!m_Ready.empty()) {
+            next = m_Ready.front();
+            m_Ready.pop_front();
+        }
+        else if(m_Current == &m_Main)
+            return false;
+        else {
+            // every task is blocked, so the spawning code has to be as well
+            m_Main.deadlocked = true;
+            next = &m_Main;
+        }
+
+        switch_to(next);
+
+        if(m_Current->deadlocked) {
+            m_Current->deadlocked = false;
+            return false;
+        }
+        return true;
+    }
+
+    void Scheduler::switch_to(Fiber* next) {
+        auto current = m_Current;
+        if(next == current)
+            return;
+
+        m_Context.swap_state(current->state);
+        m_Context.swap_state(next->state);
+        m_Current = next;
+        swapcontext(&current->registers, &next->registers);
+
+        // running on `current` again
+        release_finished();
+    }
+
+    void Scheduler::release_finished() {
+        if(m_Finished) {
+            free_stack(m_Finished);
+            m_Finished = nullptr;
+        }
+    }
+
+    char* Scheduler::alloc_stack() {
+        if(!m_FreeStacks.empty()) {
+            auto stack = m_FreeStacks.back();
+            m_FreeStacks.pop_back();
+            return stack;
+        }
+
+        void* stack = mmap(nullptr, STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+        if(stack == MAP_FAILED)
+            return nullptr;
+        // guard page below the stack
+        mprotect(stack, getpagesize(), PROT_NONE);
+        return static_cast<char*>(stack);
+    }
+
+    void Scheduler::free_stack(char* stack) {
+        if(m_FreeStacks.size() < MAX_FREE_STACKS)
+            m_FreeStacks.push_back(stack);
+        else
+            munmap(stack, STACK_SIZE);
+    }
+
+    Ref Scheduler::deadlock() {
+        return m_Context.get_error("deadlock, every task is blocked");
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+#include <ucontext.h>
+
+#include "value.hpp"
+
+namespace lisp {
+    // A suspended line of evaluation: the registers and native stack it stopped on, and the
+    // context's value stack and frames it was using.
+    struct Fiber {
+        Fiber() {}
+        Fiber(const Fiber&) = delete;
+        ~Fiber();
+
+        ucontext_t registers;
+        Context::State state;
+        // the task running on this fiber, null for the code that spawned the first task
+        TaskValue* task = nullptr;
+        // mapped by the scheduler, null for the spawning code, which runs on its thread's stack
+        char* stack = nullptr;
+        // a value a channel handed over while the fiber was blocked in `recv`
+        Ref value;
+        // woken up because every other fiber is blocked as well
+        bool deadlocked = false;
+
+        void trace(Heap& heap);
+    };
+
+    // Single-threaded cooperative scheduler for `spawn`ed tasks.
+    //
+    // Every task evaluates on its own native stack, so it can be suspended anywhere inside the
+    // recursive evaluation and resumed later. Tasks only switch in `await`, `send`, `recv` and
+    // `yield`: the current fiber either waits on a task or channel, which wakes it up again, or
+    // goes to the back of the run queue, and the front of the queue takes over. Stacks are mapped
+    // lazily and reused, so a task only costs the pages its evaluation actually touches.
+    class Scheduler {
+    public:
+        // as large as the main thread's default stack, so tasks recurse about as deep. only the
+        // pages a task touches are committed
+        static constexpr size_t STACK_SIZE = 8 << 20;
+        // stacks of finished tasks kept for new ones
+        static constexpr size_t MAX_FREE_STACKS = 64;
+
+        Scheduler(Context& context) : m_Context(context), m_Current(&m_Main) {}
+        Scheduler(const Scheduler&) = delete;
+        ~Scheduler();
+
+        // a task evaluating `expression` with the current function's arguments, queued to run
+        // once the current fiber waits or yields
+        Ref spawn(Ref expression);
+
+        // blocking operations return an error instead of waiting forever when no other fiber
+        // can run anymore
+        Ref await(TaskValue& task);
+        Ref send(ChannelValue& channel, Ref value);
+        Ref recv(ChannelValue& channel);
+        void yield();
+
+        // run queued tasks until all of them have finished or are blocked
+        void run();
+
+        void trace(Heap& heap);
+
+    private:
+        static void start(unsigned high, unsigned low);
+        [[noreturn]] void run_task();
+
+        // switch to the next queued fiber until the current one is woken up again, false if
+        // there is none and the current fiber is deadlocked
+        bool block();
+        void switch_to(Fiber* next);
+        void release_finished();
+
+        char* alloc_stack();
+        void free_stack(char* stack);
+
+        Ref deadlock();
+
+        Context& m_Context;
+        Fiber m_Main;
+        Fiber* m_Current;
+        std::deque<Fiber*> m_Ready;
+        // unfinished tasks, which stay alive until they finish even if nothing references them
+        std::unordered_set<TaskValue*> m_Live;
+
+        std::vector<char*> m_FreeStacks;
+        // stack of a task that just finished, freed once the next fiber runs
+        char* m_Finished = nullptr;
+    };
+}
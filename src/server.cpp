@@ -0,0 +1,333 @@
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "server.hpp"
+#include "context.hpp"
+#include "port.hpp"
+
+namespace lisp {
+    // exit status of a worker whose allocation failed at the memory limit
+    static constexpr int EXIT_OUT_OF_MEMORY = 3;
+    // exit status of a worker that flushed its output once it ran out of time
+    static constexpr int EXIT_OUT_OF_TIME = 4;
+    // a worker that ran out of time gets this long to flush its output before it is killed
+    static constexpr auto KILL_DELAY = std::chrono::milliseconds(500);
+    static constexpr int BACKLOG = 128;
+
+    // signal handlers wake up the server's `poll` through this pipe
+    static int WAKE_PIPE[2] = {-1, -1};
+    static volatile sig_atomic_t STOP = 0;
+    static volatile sig_atomic_t PRINT_STATS = 0;
+
+    static void handle_signal(int signal) {
+        if(signal == SIGINT || signal == SIGTERM)
+            STOP = 1;
+        else if(signal == SIGUSR1)
+            PRINT_STATS = 1;
+
+        int error = errno;
+        char byte = 0;
+        (void)!write(WAKE_PIPE[1], &byte, 1);
+        errno = error;
+    }
+
+    static void write_all(int fd, const char* data, size_t size) {
+        while(size > 0) {
+            auto written = write(fd, data, size);
+            if(written < 0 && errno == EINTR)
+                continue;
+            if(written <= 0)
+                return;
+            data += written;
+            size -= written;
+        }
+    }
+
+    // freed when a worker runs out of memory, so what it printed so far can still be written
+    static char* RESERVE = nullptr;
+    static constexpr size_t RESERVE_SIZE = 256 << 10;
+
+    static void out_of_memory() {
+        delete[] RESERVE;
+        RESERVE = nullptr;
+        FilePort::flush_all();
+        static const char message[] = "[Error]: memory limit exceeded\n";
+        write_all(STDERR_FILENO, message, sizeof(message) - 1);
+        _exit(EXIT_OUT_OF_MEMORY);
+    }
+
+    // the server's warning that a worker is about to be killed for running out of time. text a
+    // write is just adding to the buffer may be lost, but everything printed before is written
+    static void out_of_time(int) {
+        FilePort::flush_all();
+        _exit(EXIT_OUT_OF_TIME);
+    }
+
+    // bytes of address space the process has mapped
+    static size_t mapped_bytes() {
+        size_t pages = 0;
+        if(auto statm = fopen("/proc/self/statm", "r")) {
+            if(fscanf(statm, "%zu", &pages) != 1)
+                pages = 0;
+            fclose(statm);
+        }
+        return pages * sysconf(_SC_PAGESIZE);
+    }
+
+    Server::Server(Interpreter& interpreter, Options options) : m_Interpreter(interpreter), m_Options(options) {
+        if(!m_Options.workers)
+            m_Options.workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    Server::~Server() {
+        for(auto& [pid, request] : m_Requests) {
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+            close(request.connection);
+        }
+        if(m_Socket >= 0)
+            close(m_Socket);
+    }
+
+    bool Server::serve(const char* path) {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if(strlen(path) >= sizeof(address.sun_path)) {
+            errno = ENAMETOOLONG;
+            return false;
+        }
+        strcpy(address.sun_path, path);
+
+        m_Socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(m_Socket < 0)
+            return false;
+        // a socket left behind by a previous server
+        unlink(path);
+        if(bind(m_Socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(m_Socket, BACKLOG) != 0)
+            return false;
+
+        if(pipe2(WAKE_PIPE, O_NONBLOCK | O_CLOEXEC) != 0)
+            return false;
+        struct sigaction action = {};
+        action.sa_handler = handle_signal;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        for(auto signal : {SIGCHLD, SIGINT, SIGTERM, SIGUSR1})
+            sigaction(signal, &action, nullptr);
+        // clients may hang up before reading their output
+        std::signal(SIGPIPE, SIG_IGN);
+
+        // output buffered by the prelude would be repeated by every worker
+        FilePort::flush_all();
+        std::cerr << "[Serve]: listening on " << path << std::endl;
+
+        while(!STOP) {
+            pollfd fds[2] = {{WAKE_PIPE[0], POLLIN, 0}, {m_Socket, POLLIN, 0}};
+            // connections wait in the backlog while every worker is busy
+            nfds_t count = m_Requests.size() < m_Options.workers ? 2 : 1;
+            if(poll(fds, count, next_timeout()) < 0 && errno != EINTR)
+                break;
+
+            if(fds[0].revents & POLLIN) {
+                char bytes[64];
+                while(read(WAKE_PIPE[0], bytes, sizeof(bytes)) > 0) {}
+            }
+            reap();
+            kill_expired();
+            if(PRINT_STATS) {
+                PRINT_STATS = 0;
+                print_stats(std::cerr);
+            }
+            if(count == 2 && (fds[1].revents & POLLIN))
+                accept_request();
+        }
+
+        print_stats(std::cerr);
+        unlink(path);
+        for(auto signal : {SIGCHLD, SIGINT, SIGTERM, SIGUSR1})
+            std::signal(signal, SIG_DFL);
+        close(WAKE_PIPE[0]);
+        close(WAKE_PIPE[1]);
+        return true;
+    }
+
+    void Server::accept_request() {
+        int connection = accept4(m_Socket, nullptr, nullptr, SOCK_CLOEXEC);
+        if(connection < 0)
+            return;
+
+        auto start = Clock::now();
+        pid_t pid = fork();
+        if(pid < 0) {
+            static const char message[] = "[Error]: can't start a worker\n";
+            write_all(connection, message, sizeof(message) - 1);
+            close(connection);
+            m_Outcomes[static_cast<int>(Outcome::Failed)]++;
+            return;
+        }
+        if(pid == 0)
+            run_worker(connection);
+
+        m_Requests[pid] = {connection, start, start + std::chrono::milliseconds(m_Options.time_limit_ms), false, false};
+    }
+
+    void Server::run_worker(int connection) {
+        for(auto signal : {SIGCHLD, SIGINT, SIGTERM, SIGUSR1})
+            std::signal(signal, SIG_DFL);
+        close(m_Socket);
+        close(WAKE_PIPE[0]);
+        close(WAKE_PIPE[1]);
+
+        struct sigaction action = {};
+        action.sa_handler = out_of_time;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGALRM, &action, nullptr);
+
+        RESERVE = new char[RESERVE_SIZE];
+        struct rlimit limit;
+        limit.rlim_cur = limit.rlim_max = mapped_bytes() + m_Options.memory_limit;
+        setrlimit(RLIMIT_AS, &limit);
+        std::set_new_handler(out_of_memory);
+
+        std::string source;
+        char buffer[1 << 16];
+        for(;;) {
+            auto size = read(connection, buffer, sizeof(buffer));
+            if(size < 0 && errno == EINTR)
+                continue;
+            if(size <= 0)
+                break;
+            source.append(buffer, size);
+        }
+
+        dup2(connection, STDOUT_FILENO);
+        dup2(connection, STDERR_FILENO);
+        close(connection);
+
+        // the threads of the pool weren't forked along
+        m_Interpreter.get_context().detach_pool();
+
+        auto program = m_Interpreter.load(source);
+        if(program.kind() == ValueKind::Error) {
+            std::cerr << "[Panic]: " << *program.is_error().value() << std::endl;
+            _exit(1);
+        }
+        m_Interpreter.run(program);
+
+        // skip tearing down the heap, which the server still owns, and the ports the script left open
+        FilePort::flush_all();
+        _exit(0);
+    }
+
+    void Server::reap() {
+        int status;
+        pid_t pid;
+        while((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            auto request = m_Requests.find(pid);
+            if(request == m_Requests.end())
+                continue;
+
+            if(request->second.expired) {
+                static const char message[] = "[Error]: time limit exceeded\n";
+                write_all(request->second.connection, message, sizeof(message) - 1);
+                finish(pid, Outcome::TimedOut);
+            }
+            else if(WIFEXITED(status) && WEXITSTATUS(status) == 0)
+                finish(pid, Outcome::Ok);
+            else if(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_OUT_OF_MEMORY)
+                finish(pid, Outcome::OutOfMemory);
+            else {
+                if(WIFSIGNALED(status)) {
+                    auto message = "[Error]: worker killed by signal " + std::to_string(WTERMSIG(status)) + "\n";
+                    write_all(request->second.connection, message.data(), message.size());
+                }
+                finish(pid, Outcome::Failed);
+            }
+        }
+    }
+
+    void Server::kill_expired() {
+        auto now = Clock::now();
+        for(auto& [pid, request] : m_Requests) {
+            if(request.killed || now < request.deadline)
+                continue;
+            // the worker flushes its output and exits on SIGALRM, unless it's stuck writing it
+            if(!request.expired) {
+                kill(pid, SIGALRM);
+                request.expired = true;
+                request.deadline = now + KILL_DELAY;
+            }
+            else {
+                kill(pid, SIGKILL);
+                request.killed = true;
+            }
+        }
+    }
+
+    void Server::finish(pid_t pid, Outcome outcome) {
+        auto& request = m_Requests.at(pid);
+        std::chrono::duration<double, std::milli> latency = Clock::now() - request.start;
+        m_Latencies.push_back(latency.count());
+        m_Outcomes[static_cast<int>(outcome)]++;
+
+        close(request.connection);
+        m_Requests.erase(pid);
+    }
+
+    int Server::next_timeout() const {
+        if(m_Requests.empty())
+            return -1;
+
+        auto deadline = Clock::time_point::max();
+        for(auto& [_, request] : m_Requests) {
+            if(!request.killed)
+                deadline = std::min(deadline, request.deadline);
+        }
+        // killed workers are reaped once SIGCHLD arrives
+        if(deadline == Clock::time_point::max())
+            return -1;
+
+        auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - Clock::now()).count();
+        return std::max<int64_t>(remaining, 0);
+    }
+
+    void Server::print_stats(std::ostream& stream) const {
+        stream << "[Serve]: requests:        " << m_Latencies.size() << " ("
+               << m_Outcomes[static_cast<int>(Outcome::Ok)] << " ok, "
+               << m_Outcomes[static_cast<int>(Outcome::Failed)] << " failed, "
+               << m_Outcomes[static_cast<int>(Outcome::TimedOut)] << " timed out, "
+               << m_Outcomes[static_cast<int>(Outcome::OutOfMemory)] << " out of memory)" << std::endl;
+        if(m_Latencies.empty())
+            return;
+
+        auto sorted = m_Latencies;
+        std::sort(sorted.begin(), sorted.end());
+        auto percentile = [&](double p) {
+            return sorted[std::min(sorted.size() - 1, size_t(p * sorted.size()))];
+        };
+        double total = 0;
+        for(auto latency : sorted)
+            total += latency;
+
+        stream << std::fixed << std::setprecision(2)
+               << "[Serve]: latency:         mean " << total / sorted.size() << " ms, p50 " << percentile(0.5)
+               << " ms, p90 " << percentile(0.9) << " ms, p99 " << percentile(0.99) << " ms, max " << sorted.back() << " ms"
+               << std::defaultfloat << std::endl;
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+#include "interpreter.hpp"
+
+namespace lisp {
+    // Script server for `--serve`.
+    //
+    // The prelude is evaluated once in the server process, which then accepts connections on a
+    // Unix domain socket and forks a worker for each of them. Workers start from a copy-on-write
+    // copy of the warm interpreter, read a program until the client shuts down its end of the
+    // connection, evaluate it with stdout and stderr redirected into the connection and exit.
+    // Once a worker is gone the server appends a `[Error]: ...` line if it was killed or ran out
+    // of memory and closes the connection. Workers flush what they printed when they run out of
+    // memory or time, output is only lost if a worker has to be killed.
+    class Server {
+    public:
+        struct Options {
+            // wall time from accepting a connection until the worker is stopped
+            uint64_t time_limit_ms = 10000;
+            // address space a worker may map on top of the server's
+            size_t memory_limit = 512 << 20;
+            // workers running at the same time, further connections wait in the backlog
+            size_t workers = 0;
+        };
+
+        Server(Interpreter& interpreter, Options options);
+        Server(const Server&) = delete;
+        ~Server();
+
+        // serve until SIGINT or SIGTERM, false if the socket can't be set up. SIGUSR1 prints the
+        // statistics to stderr
+        bool serve(const char* path);
+
+        // request counts and latency percentiles
+        void print_stats(std::ostream& stream) const;
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        enum class Outcome {
+            Ok,
+            Failed,
+            TimedOut,
+            OutOfMemory
+        };
+
+        struct Request {
+            int connection;
+            Clock::time_point start;
+            // when the worker runs out of time, then when it is killed if it didn't exit by then
+            Clock::time_point deadline;
+            // told to exit for running out of time with SIGALRM, then killed, reaped once it is gone
+            bool expired;
+            bool killed;
+        };
+
+        void accept_request();
+        [[noreturn]] void run_worker(int connection);
+        void reap();
+        void kill_expired();
+        void finish(pid_t pid, Outcome outcome);
+        // milliseconds until the next worker runs out of time, -1 if none is running
+        int next_timeout() const;
+
+        Interpreter& m_Interpreter;
+        Options m_Options;
+        int m_Socket = -1;
+        std::unordered_map<pid_t, Request> m_Requests;
+
+        uint64_t m_Outcomes[4] = {};
+        std::vector<double> m_Latencies;
+    };
+}
@@ -0,0 +1,352 @@
+#include <algorithm>
+
+#include "simd.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LISP_AVX2 1
+#define AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace lisp {
+    namespace simd {
+        // the kernels can run before `main`, from the constructors of other translation units
+        static bool detect_avx2() {
+#ifdef LISP_AVX2
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2");
+#else
+            return false;
+#endif
+        }
+
+        static const bool HAS_AVX2 = detect_avx2();
+
+#ifdef LISP_AVX2
+        AVX2 static void add_avx2(const double* a, const double* b, double* out, size_t size) {
+            size_t i = 0;
+            for(; i + 4 <= size; i += 4)
+                _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+            for(; i < size; i++)
+                out[i] = a[i] + b[i];
+        }
+
+        AVX2 static void add_avx2(const double* a, double b, double* out, size_t size) {
+            auto scalar = _mm256_set1_pd(b);
+            size_t i = 0;
+            for(; i + 4 <= size; i += 4)
+                _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(a + i), scalar));
+            for(; i < size; i++)
+                out[i] = a[i] + b;
+        }
+
+        // a sum overflowed if it has a different sign than both operands
+        AVX2 static inline __m256i overflow_avx2(__m256i a, __m256i b, __m256i sum) {
+            return _mm256_and_si256(_mm256_xor_si256(a, sum), _mm256_xor_si256(b, sum));
+        }
+
+        AVX2 static inline bool any_sign_avx2(__m256i value) {
+            return _mm256_movemask_pd(_mm256_castsi256_pd(value)) != 0;
+        }
+
+        AVX2 static bool add_avx2(const int64_t* a, const int64_t* b, int64_t* out, size_t size) {
+            auto overflow = _mm256_setzero_si256();
+            size_t i = 0;
+            for(; i + 4 <= size; i += 4) {
+                auto lhs = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+                auto rhs = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+                auto sum = _mm256_add_epi64(lhs, rhs);
+                overflow = _mm256_or_si256(overflow, overflow_avx2(lhs, rhs, sum));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), sum);
+            }
+            for(; i < size; i++) {
+                if(__builtin_add_overflow(a[i], b[i], &out[i]))
+                    return false;
+            }
+            return !any_sign_avx2(overflow);
+        }
+
+        AVX2 static bool add_avx2(const int64_t* a, int64_t b, int64_t* out, size_t size) {
+            auto rhs = _mm256_set1_epi64x(b);
+            auto overflow = _mm256_setzero_si256();
+            size_t i = 0;
+            for(; i + 4 <= size; i += 4) {
+                auto lhs = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+                auto sum = _mm256_add_epi64(lhs, rhs);
+                overflow = _mm256_or_si256(overflow, overflow_avx2(lhs, rhs, sum));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), sum);
+            }
+            for(; i < size; i++) {
+                if(__builtin_add_overflow(a[i], b, &out[i]))
+                    return false;
+            }
+            return !any_sign_avx2(overflow);
+        }
+
+        AVX2 static void multiply_avx2(const double* a, const double* b, double* out, size_t size) {
+            size_t i = 0;
+            for(; i + 4 <= size; i += 4)
+                _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+            for(; i < size; i++)
+                out[i] = a[i] * b[i];
+        }
+
+        AVX2 static void multiply_avx2(const double* a, double b, double* out, size_t size) {
+            auto scalar = _mm256_set1_pd(b);
+            size_t i = 0;
+            for(; i + 4 <= size; i += 4)
+                _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), scalar));
+            for(; i < size; i++)
+                out[i] = a[i] * b;
+        }
+
+        AVX2 static double horizontal_sum_avx2(__m256d value) {
+            double lanes[4];
+            _mm256_storeu_pd(lanes, value);
+            return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        }
+
+        // two accumulators hide the latency of the additions
+        AVX2 static double dot_avx2(const double* a, const double* b, size_t size) {
+            auto first = _mm256_setzero_pd(), second = _mm256_setzero_pd();
+            size_t i = 0;
+            for(; i + 8 <= size; i += 8) {
+                first = _mm256_add_pd(first, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+                second = _mm256_add_pd(second, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+            }
+            double result = horizontal_sum_avx2(_mm256_add_pd(first, second));
+            for(; i < size; i++)
+                result += a[i] * b[i];
+            return result;
+        }
+
+        AVX2 static double sum_avx2(const double* a, size_t size) {
+            auto first = _mm256_setzero_pd(), second = _mm256_setzero_pd();
+            size_t i = 0;
+            for(; i + 8 <= size; i += 8) {
+                first = _mm256_add_pd(first, _mm256_loadu_pd(a + i));
+                second = _mm256_add_pd(second, _mm256_loadu_pd(a + i + 4));
+            }
+            double result = horizontal_sum_avx2(_mm256_add_pd(first, second));
+            for(; i < size; i++)
+                result += a[i];
+            return result;
+        }
+
+        // a lane can overflow even though the total fits, the caller then sums with bignums
+        AVX2 static bool sum_avx2(const int64_t* a, size_t size, int64_t& result) {
+            auto total = _mm256_setzero_si256();
+            auto overflow = _mm256_setzero_si256();
+            size_t i = 0;
+            for(; i + 4 <= size; i += 4) {
+                auto value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+                auto sum = _mm256_add_epi64(total, value);
+                overflow = _mm256_or_si256(overflow, overflow_avx2(total, value, sum));
+                total = sum;
+            }
+            if(any_sign_avx2(overflow))
+                return false;
+
+            int64_t lanes[4];
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), total);
+            result = 0;
+            for(auto lane : lanes) {
+                if(__builtin_add_overflow(result, lane, &result))
+                    return false;
+            }
+            for(; i < size; i++) {
+                if(__builtin_add_overflow(result, a[i], &result))
+                    return false;
+            }
+            return true;
+        }
+
+        AVX2 static double min_avx2(const double* a, size_t size) {
+            size_t i = 0;
+            double result = a[0];
+            if(size >= 4) {
+                auto lanes = _mm256_loadu_pd(a);
+                for(i = 4; i + 4 <= size; i += 4)
+                    lanes = _mm256_min_pd(lanes, _mm256_loadu_pd(a + i));
+                double values[4];
+                _mm256_storeu_pd(values, lanes);
+                result = std::min({values[0], values[1], values[2], values[3]});
+            }
+            for(; i < size; i++)
+                result = std::min(result, a[i]);
+            return result;
+        }
+
+        AVX2 static double max_avx2(const double* a, size_t size) {
+            size_t i = 0;
+            double result = a[0];
+            if(size >= 4) {
+                auto lanes = _mm256_loadu_pd(a);
+                for(i = 4; i + 4 <= size; i += 4)
+                    lanes = _mm256_max_pd(lanes, _mm256_loadu_pd(a + i));
+                double values[4];
+                _mm256_storeu_pd(values, lanes);
+                result = std::max({values[0], values[1], values[2], values[3]});
+            }
+            for(; i < size; i++)
+                result = std::max(result, a[i]);
+            return result;
+        }
+
+        // AVX2 has no 64-bit integer min and max, so compare and blend
+        AVX2 static int64_t min_avx2(const int64_t* a, size_t size) {
+            size_t i = 0;
+            int64_t result = a[0];
+            if(size >= 4) {
+                auto lanes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a));
+                for(i = 4; i + 4 <= size; i += 4) {
+                    auto value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+                    lanes = _mm256_blendv_epi8(lanes, value, _mm256_cmpgt_epi64(lanes, value));
+                }
+                int64_t values[4];
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(values), lanes);
+                result = std::min({values[0], values[1], values[2], values[3]});
+            }
+            for(; i < size; i++)
+                result = std::min(result, a[i]);
+            return result;
+        }
+
+        AVX2 static int64_t max_avx2(const int64_t* a, size_t size) {
+            size_t i = 0;
+            int64_t result = a[0];
+            if(size >= 4) {
+                auto lanes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a));
+                for(i = 4; i + 4 <= size; i += 4) {
+                    auto value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+                    lanes = _mm256_blendv_epi8(lanes, value, _mm256_cmpgt_epi64(value, lanes));
+                }
+                int64_t values[4];
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(values), lanes);
+                result = std::max({values[0], values[1], values[2], values[3]});
+            }
+            for(; i < size; i++)
+                result = std::max(result, a[i]);
+            return result;
+        }
+
+#define DISPATCH(call) if(HAS_AVX2) return call##_avx2
+#else
+#define DISPATCH(call) if(false) return call
+#endif
+
+        void add(const double* a, const double* b, double* out, size_t size) {
+            DISPATCH(add)(a, b, out, size);
+            for(size_t i = 0; i < size; i++)
+                out[i] = a[i] + b[i];
+        }
+
+        void add(const double* a, double b, double* out, size_t size) {
+            DISPATCH(add)(a, b, out, size);
+            for(size_t i = 0; i < size; i++)
+                out[i] = a[i] + b;
+        }
+
+        bool add(const int64_t* a, const int64_t* b, int64_t* out, size_t size) {
+            DISPATCH(add)(a, b, out, size);
+            for(size_t i = 0; i < size; i++) {
+                if(__builtin_add_overflow(a[i], b[i], &out[i]))
+                    return false;
+            }
+            return true;
+        }
+
+        bool add(const int64_t* a, int64_t b, int64_t* out, size_t size) {
+            DISPATCH(add)(a, b, out, size);
+            for(size_t i = 0; i < size; i++) {
+                if(__builtin_add_overflow(a[i], b, &out[i]))
+                    return false;
+            }
+            return true;
+        }
+
+        void multiply(const double* a, const double* b, double* out, size_t size) {
+            DISPATCH(multiply)(a, b, out, size);
+            for(size_t i = 0; i < size; i++)
+                out[i] = a[i] * b[i];
+        }
+
+        void multiply(const double* a, double b, double* out, size_t size) {
+            DISPATCH(multiply)(a, b, out, size);
+            for(size_t i = 0; i < size; i++)
+                out[i] = a[i] * b;
+        }
+
+        bool multiply(const int64_t* a, const int64_t* b, int64_t* out, size_t size) {
+            for(size_t i = 0; i < size; i++) {
+                if(__builtin_mul_overflow(a[i], b[i], &out[i]))
+                    return false;
+            }
+            return true;
+        }
+
+        bool multiply(const int64_t* a, int64_t b, int64_t* out, size_t size) {
+            for(size_t i = 0; i < size; i++) {
+                if(__builtin_mul_overflow(a[i], b, &out[i]))
+                    return false;
+            }
+            return true;
+        }
+
+        double dot(const double* a, const double* b, size_t size) {
+            DISPATCH(dot)(a, b, size);
+            double result = 0;
+            for(size_t i = 0; i < size; i++)
+                result += a[i] * b[i];
+            return result;
+        }
+
+        bool dot(const int64_t* a, const int64_t* b, size_t size, int64_t& result) {
+            result = 0;
+            for(size_t i = 0; i < size; i++) {
+                int64_t product;
+                if(__builtin_mul_overflow(a[i], b[i], &product) || __builtin_add_overflow(result, product, &result))
+                    return false;
+            }
+            return true;
+        }
+
+        double sum(const double* a, size_t size) {
+            DISPATCH(sum)(a, size);
+            double result = 0;
+            for(size_t i = 0; i < size; i++)
+                result += a[i];
+            return result;
+        }
+
+        bool sum(const int64_t* a, size_t size, int64_t& result) {
+            DISPATCH(sum)(a, size, result);
+            result = 0;
+            for(size_t i = 0; i < size; i++) {
+                if(__builtin_add_overflow(result, a[i], &result))
+                    return false;
+            }
+            return true;
+        }
+
+        double min(const double* a, size_t size) {
+            DISPATCH(min)(a, size);
+            return *std::min_element(a, a + size);
+        }
+
+        double max(const double* a, size_t size) {
+            DISPATCH(max)(a, size);
+            return *std::max_element(a, a + size);
+        }
+
+        int64_t min(const int64_t* a, size_t size) {
+            DISPATCH(min)(a, size);
+            return *std::min_element(a, a + size);
+        }
+
+        int64_t max(const int64_t* a, size_t size) {
+            DISPATCH(max)(a, size);
+            return *std::max_element(a, a + size);
+        }
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace lisp {
+    // Kernels for the vector builtins. They use AVX2 if the CPU supports it, which is checked
+    // once at startup, and fall back to scalar loops otherwise. Integer kernels return false when a result
+    // overflows 64 bits, leaving the output unspecified.
+    namespace simd {
+        // out[i] = a[i] + b[i] and out[i] = a[i] + b
+        void add(const double* a, const double* b, double* out, size_t size);
+        void add(const double* a, double b, double* out, size_t size);
+        bool add(const int64_t* a, const int64_t* b, int64_t* out, size_t size);
+        bool add(const int64_t* a, int64_t b, int64_t* out, size_t size);
+
+        // out[i] = a[i] * b[i] and out[i] = a[i] * b. AVX2 has no 64-bit multiplication, so the
+        // integer versions are always scalar
+        void multiply(const double* a, const double* b, double* out, size_t size);
+        void multiply(const double* a, double b, double* out, size_t size);
+        bool multiply(const int64_t* a, const int64_t* b, int64_t* out, size_t size);
+        bool multiply(const int64_t* a, int64_t b, int64_t* out, size_t size);
+
+        double dot(const double* a, const double* b, size_t size);
+        bool dot(const int64_t* a, const int64_t* b, size_t size, int64_t& result);
+
+        double sum(const double* a, size_t size);
+        bool sum(const int64_t* a, size_t size, int64_t& result);
+
+        // `size` may not be 0
+        double min(const double* a, size_t size);
+        double max(const double* a, size_t size);
+        int64_t min(const int64_t* a, size_t size);
+        int64_t max(const int64_t* a, size_t size);
+    }
+}
@@ -0,0 +1,157 @@
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "source.hpp"
+
+namespace lisp {
+    Source::~Source() {
+        if(m_Mapping)
+            munmap(m_Mapping, m_Text.size());
+    }
+
+    std::unique_ptr<Source> Source::open(const char* filename) {
+        int fd = ::open(filename, O_RDONLY);
+        if(fd < 0)
+            return nullptr;
+
+        struct stat info;
+        if(fstat(fd, &info) < 0) {
+            close(fd);
+            return nullptr;
+        }
+
+        if(!S_ISREG(info.st_mode) || info.st_size == 0) {
+            close(fd);
+            std::ifstream file(filename);
+            if(file.fail())
+                return nullptr;
+            return read(file);
+        }
+
+        void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(mapping == MAP_FAILED)
+            return nullptr;
+        madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+
+        auto source = std::unique_ptr<Source>(new Source());
+        source->m_Mapping = mapping;
+        source->m_Text = std::string_view(static_cast<const char*>(mapping), info.st_size);
+        return source;
+    }
+
+    std::unique_ptr<Source> Source::read(std::istream& stream) {
+        std::ostringstream buffer;
+        buffer << stream.rdbuf();
+        return std::make_unique<Source>(buffer.str());
+    }
+
+    static bool is_space(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+    }
+
+    std::optional<std::string_view> FormReader::next() {
+        // the previous form ended where scanning stopped
+        m_Start = m_Position;
+        m_Depth = 0;
+        m_Begun = m_InString = m_InAtom = false;
+
+        while(!scan()) {
+            if(m_Eof || !fill()) {
+                if(m_Failed || !m_Begun)
+                    return std::nullopt;
+                m_Position = m_Buffer.size();
+                break;
+            }
+        }
+        return std::string_view(m_Buffer).substr(m_Start, m_Position - m_Start);
+    }
+
+    bool FormReader::scan() {
+        const char* text = m_Buffer.data();
+        size_t size = m_Buffer.size();
+
+        for(; m_Position < size; m_Position++) {
+            char c = text[m_Position];
+            if(m_InString) {
+                if(c == '"') {
+                    m_InString = false;
+                    if(m_Depth == 0) {
+                        m_Position++;
+                        return true;
+                    }
+                }
+                continue;
+            }
+
+            bool space = is_space(c);
+            if(m_InAtom) {
+                if(!space && c != '(' && c != ')' && c != '"' && c != '\'')
+                    continue;
+                m_InAtom = false;
+                // the delimiter belongs to the next form
+                if(m_Depth == 0)
+                    return true;
+            }
+            if(space) {
+                if(!m_Begun)
+                    m_Start = m_Position + 1;
+                continue;
+            }
+
+            m_Begun = true;
+            switch(c) {
+            case '(':
+                m_Depth++;
+                break;
+            case ')':
+                // a stray paren is a form of its own, which the parser rejects
+                if(m_Depth == 0 || --m_Depth == 0) {
+                    m_Position++;
+                    return true;
+                }
+                break;
+            case '"':
+                m_InString = true;
+                break;
+            case '\'':
+                // a quote is part of the form that follows it
+                break;
+            default:
+                m_InAtom = true;
+                break;
+            }
+        }
+        return false;
+    }
+
+    bool FormReader::fill() {
+        m_Buffer.erase(0, m_Start);
+        m_Position -= m_Start;
+        m_Start = 0;
+
+        if(m_Wait)
+            m_Wait(m_Begun);
+
+        char buffer[1 << 16];
+        for(;;) {
+            auto size = ::read(m_Fd, buffer, sizeof(buffer));
+            if(size < 0 && errno == EINTR)
+                continue;
+            if(size < 0)
+                m_Failed = true;
+            if(size <= 0) {
+                m_Eof = true;
+                return false;
+            }
+            m_Buffer.append(buffer, size);
+            return true;
+        }
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <functional>
+#include <istream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace lisp {
+    // the full text of a program, memory-mapped from a file or held in a buffer
+    class Source {
+    public:
+        Source(std::string buffer) : m_Buffer(std::move(buffer)), m_Text(m_Buffer) {}
+        ~Source();
+
+        Source(const Source&) = delete;
+        Source& operator=(const Source&) = delete;
+
+        // map a regular file into memory, falling back to reading it for pipes and devices.
+        // returns nullptr and sets `errno` on failure
+        static std::unique_ptr<Source> open(const char* filename);
+        static std::unique_ptr<Source> read(std::istream& stream);
+
+        std::string_view text() const { return m_Text; }
+        size_t size() const { return m_Text.size(); }
+
+    private:
+        Source() {}
+
+        std::string m_Buffer;
+        std::string_view m_Text;
+        void* m_Mapping = nullptr;
+    };
+
+    // Reads a program from a pipe, terminal or file as it arrives and splits it into top-level
+    // forms, so each form can be evaluated before the rest of the input exists. Only the form
+    // being read is buffered, text that was handed out is dropped on the next read.
+    class FormReader {
+    public:
+        FormReader(int fd) : m_Fd(fd) {}
+        FormReader(const FormReader&) = delete;
+        ~FormReader() {}
+
+        // the text of the next complete form, blocking until it has been read. a form left
+        // unfinished by the end of the input is returned as it is for the parser to report.
+        // nullopt at the end of the input or on a read error, which sets `errno`. the text
+        // stays valid until the next call
+        std::optional<std::string_view> next();
+
+        // called before blocking on more input, with whether a form is partially read
+        void set_wait(std::function<void(bool partial)> wait) { m_Wait = std::move(wait); }
+
+        bool failed() const { return m_Failed; }
+
+    private:
+        // scan the buffered text for the end of the current form
+        bool scan();
+        bool fill();
+
+        int m_Fd;
+        std::string m_Buffer;
+        std::function<void(bool partial)> m_Wait;
+        // start of the current form and how far it has been scanned
+        size_t m_Start = 0;
+        size_t m_Position = 0;
+        size_t m_Depth = 0;
+        bool m_Begun = false;
+        bool m_InString = false;
+        bool m_InAtom = false;
+        bool m_Eof = false;
+        bool m_Failed = false;
+    };
+}
@@ -1,46 +1,173 @@
 #pragma once
 
+#include <cstdint>
 #include <ostream>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 #include <optional>
 #include <memory>
+#include <memory_resource>
+#include <atomic>
+#include <charconv>
+#include <deque>
+#include <functional>
 
-#define ERROR(reason) std::make_shared<ErrorValue>((reason))
+#include "bignum.hpp"
+#include "persistent.hpp"
+
+#define ERROR(reason) context.get_error((reason))
 
 #ifndef __LISP_VALUES
 #define __LISP_VALUES
 
 namespace lisp {
     class Context;
+    class Chunk;
+    class Memo;
+    class Heap;
+    class Arena;
+    class FilePort;
+    class Value;
+    struct Fiber;
     enum ValueKind {
         Error,
         Eof,
         String,
         Number,
+        Float,
+        Array,
+        Vector,
+        Map,
+        Task,
+        Channel,
+        Port,
         Ident,
+        Local,
         Quote,
         Compound,
         Function,
+        Native,
         Const
     };
 
+    // t, f, nil
+    namespace ConstValue {
+        enum Kind {
+            T,
+            F,
+            Nil
+        };
+    }
+
+    // Tagged value handle. Fixnums, `T`/`F`/`NIL` and the end of file are stored inline,
+    // everything else points to a `Value` on the context's heap:
+    //   ...1   63-bit fixnum
+    //   ..10   immediate constant, `ConstValue::Kind` (3 for end of file, 4 for a pending tail call) in the upper bits
+    //   .000   heap pointer
+    class Ref {
+    public:
+        Ref() : m_Bits(0) {}
+        Ref(Value* value) : m_Bits(reinterpret_cast<uintptr_t>(value)) {}
+
+        static constexpr int64_t FIXNUM_MIN = INT64_MIN >> 1;
+        static constexpr int64_t FIXNUM_MAX = INT64_MAX >> 1;
+
+        static Ref fixnum(int64_t value) { return Ref((static_cast<uint64_t>(value) << 1) | 1); }
+        static Ref constant(ConstValue::Kind kind) { return Ref((static_cast<uint64_t>(kind) << 3) | 2); }
+        static Ref eof() { return Ref((EOF_CODE << 3) | 2); }
+        // returned by `eval_tail` when the callee and its arguments were pushed instead of being called
+        static Ref tail_call() { return Ref((TAIL_CALL_CODE << 3) | 2); }
+
+        bool is_fixnum() const { return m_Bits & 1; }
+        bool is_immediate() const { return m_Bits & 3; }
+        bool is_heap() const { return !is_immediate() && m_Bits; }
+        bool is_eof() const { return m_Bits == eof().m_Bits; }
+        bool is_tail_call() const { return m_Bits == tail_call().m_Bits; }
+        bool is_truthy() const { return m_Bits == constant(ConstValue::Kind::T).m_Bits; }
+        // integers and floats
+        bool is_numeric() const;
+
+        int64_t fixnum() const { return static_cast<int64_t>(m_Bits) >> 1; }
+        ConstValue::Kind const_kind() const { return static_cast<ConstValue::Kind>(m_Bits >> 3); }
+
+        // only valid for numbers, saturates for bignums outside the range of `int64_t`
+        int64_t number() const;
+
+        Value* get() const { return reinterpret_cast<Value*>(m_Bits); }
+        Value& operator*() const { return *get(); }
+
+        explicit operator bool() const { return m_Bits != 0; }
+        bool operator==(const Ref& other) const { return m_Bits == other.m_Bits; }
+        bool operator!=(const Ref& other) const { return m_Bits != other.m_Bits; }
+
+        ValueKind kind() const;
+        std::ostream& print(std::ostream& stream) const;
+        Ref eval(Context& context) const;
+        Ref eval_tail(Context& context) const;
+        bool equals(Ref other) const;
+        std::optional<std::shared_ptr<std::string>> is_error() const;
+
+        uint64_t bits() const { return m_Bits; }
+
+    private:
+        static constexpr uint64_t EOF_CODE = 3;
+        static constexpr uint64_t TAIL_CALL_CODE = 4;
+
+        explicit Ref(uint64_t bits) : m_Bits(bits) {}
+
+        uint64_t m_Bits;
+    };
+
+    // child arrays, allocated from the program arena for parsed values
+    using RefList = std::pmr::vector<Ref>;
+
+    using Builtin = Ref (*)(Context& context, RefList& args);
+
+    // arithmetic and comparison builtins that binary call sites specialize on
+    enum class Operator : uint8_t {
+        None,
+        Add,
+        Subtract,
+        Multiply,
+        Divide,
+        Lt,
+        Gt,
+        LtEq,
+        GtEq,
+        Eq
+    };
+
     class Value {
     public:
         virtual ~Value() {};
-        
+
         virtual ValueKind kind() const = 0;
-        
+
         virtual std::ostream& print(std::ostream& stream) const = 0;
-        virtual std::shared_ptr<Value> eval(Context& context) = 0;
-        virtual bool equals(std::shared_ptr<Value> other) = 0;
+        virtual Ref eval(Context& context) = 0;
+        virtual bool equals(Ref other) = 0;
+
+        // evaluate in tail position of a function body, may return `Ref::tail_call()`
+        virtual Ref eval_tail(Context& context) { return eval(context); }
 
         virtual std::optional<std::shared_ptr<std::string>> is_error() const { return std::nullopt; }
-        virtual bool is_eof() const { return false; }
-        virtual bool is_const() const { return false; }
+
+        // mark the values referenced by this one
+        virtual void trace(Heap&) {}
+
+        // memory allocated outside the object, counted towards the next collection
+        virtual size_t owned_bytes() const { return 0; }
+
     private:
+        friend class Heap;
+        friend class Arena;
+        bool m_Marked = false;
+        bool m_InArena = false;
+        // the heap that allocated this value, arena values belong to the main context's
+        uint16_t m_HeapId = 0;
     };
 
     // errors
@@ -59,92 +186,346 @@ namespace lisp {
             return std::optional<std::shared_ptr<std::string>>(m_Reason);
         }
 
-        virtual std::shared_ptr<Value> eval(Context& context) override;
+        virtual Ref eval(Context& context) override;
         virtual ValueKind kind() const override { return ValueKind::Error; }
 
-        virtual bool equals(std::shared_ptr<Value> other) override {
-            if(other->kind() != ValueKind::Error)
+        virtual bool equals(Ref other) override {
+            if(other.kind() != ValueKind::Error)
                 return false;
-            return m_Reason == dynamic_cast<ErrorValue&>(*other).m_Reason;
+            // only the fixed messages are interned, errors built at runtime are equal by their text
+            return *m_Reason == *dynamic_cast<ErrorValue&>(*other).m_Reason;
         }
 
     private:
         std::shared_ptr<std::string> m_Reason;
     };
 
-    // end of file
-    class EofValue : public Value {
+    // "foo"
+    class StringValue : public Value {
     public:
-        EofValue() {}
-        ~EofValue() {}
+        StringValue(std::string value) : m_Value(value) {}
+        ~StringValue() {}
+
+        virtual std::ostream& print(std::ostream& stream) const override { return stream << m_Value; };
+        virtual Ref eval(Context& context) override;
+        virtual ValueKind kind() const override { return ValueKind::String; }
+
+        virtual bool equals(Ref other) override {
+            if(other.kind() != ValueKind::String)
+                return false;
+            return m_Value == dynamic_cast<StringValue&>(*other).m_Value;
+        }
+
+        const std::string& get_value() const { return m_Value; }
+
+    private:
+        std::string m_Value;
+    };
+
+    // 1234, boxed when it doesn't fit into a fixnum. boxed numbers are never in the fixnum
+    // range, so a number is either a fixnum or a `NumberValue`
+    class NumberValue : public Value {
+    public:
+        NumberValue(BigInt value) : m_Value(std::move(value)) {}
+        ~NumberValue() {}
 
         virtual std::ostream& print(std::ostream& stream) const override {
-            stream << "End of file";
+            stream << m_Value.to_string();
             return stream;
         };
 
-        virtual bool is_eof() const override {
-            return true;
+        virtual Ref eval(Context& context) override;
+        virtual ValueKind kind() const override { return ValueKind::Number; }
+
+        virtual bool equals(Ref other) override {
+            if(!other.is_heap() || other.kind() != ValueKind::Number)
+                return false;
+            return m_Value == static_cast<NumberValue&>(*other).m_Value;
         }
 
-        virtual std::shared_ptr<Value> eval(Context& context) override;
-        virtual ValueKind kind() const override { return ValueKind::Eof; }
+        const BigInt& value() const { return m_Value; }
+
+        virtual size_t owned_bytes() const override { return m_Value.owned_bytes(); }
 
-        virtual bool equals(std::shared_ptr<Value> other) override {
-            return other->kind() == ValueKind::Eof;
+    private:
+        BigInt m_Value;
+    };
+
+    // shortest text that reads back as the same double, always with a decimal point or exponent
+    inline std::ostream& print_float(std::ostream& stream, double value) {
+        char text[32];
+        auto end = std::to_chars(text, text + sizeof(text), value).ptr;
+        stream.write(text, end - text);
+        if(std::string_view(text, end - text).find_first_of(".ein") == std::string_view::npos)
+            stream << ".0";
+        return stream;
+    }
+
+    // 1.5, always boxed
+    class FloatValue : public Value {
+    public:
+        FloatValue(double value) : m_Value(value) {}
+        ~FloatValue() {}
+
+        virtual std::ostream& print(std::ostream& stream) const override { return print_float(stream, m_Value); }
+        virtual Ref eval(Context& context) override;
+        virtual ValueKind kind() const override { return ValueKind::Float; }
+
+        virtual bool equals(Ref other) override {
+            if(other.kind() != ValueKind::Float)
+                return false;
+            return m_Value == static_cast<FloatValue&>(*other).m_Value;
         }
 
-        virtual bool is_const() const { return true; }
+        double value() const { return m_Value; }
+
+    private:
+        double m_Value;
     };
 
-    // "foo"
-    class StringValue : public Value {
+    // [1 2 3 ], contiguous unboxed 64-bit integers or doubles for the vector builtins
+    class ArrayValue : public Value {
     public:
-        StringValue(std::string value) : m_Value(value) {}
-        ~StringValue() {}
+        ArrayValue(std::vector<int64_t> ints) : m_Ints(std::move(ints)) {}
+        ArrayValue(std::vector<double> floats) : m_Floats(std::move(floats)), m_IsFloat(true) {}
+        ~ArrayValue() {}
 
-        virtual std::ostream& print(std::ostream& stream) const override { return stream << m_Value; };
-        virtual std::shared_ptr<Value> eval(Context& context) override;
-        virtual ValueKind kind() const override { return ValueKind::String; }
+        virtual std::ostream& print(std::ostream& stream) const override {
+            stream << "[";
+            for(size_t i = 0; i < size(); i++) {
+                if(m_IsFloat)
+                    print_float(stream, m_Floats[i]);
+                else
+                    stream << m_Ints[i];
+                stream << " ";
+            }
+            stream << "]";
+            return stream;
+        };
+
+        virtual Ref eval(Context& context) override;
+        virtual ValueKind kind() const override { return ValueKind::Array; }
 
-        virtual bool equals(std::shared_ptr<Value> other) override {
-            if(other->kind() != ValueKind::String)
+        virtual bool equals(Ref other) override {
+            if(other.kind() != ValueKind::Array)
                 return false;
-            return m_Value == dynamic_cast<StringValue&>(*other).m_Value;
+            auto& array = static_cast<ArrayValue&>(*other);
+            return m_IsFloat == array.m_IsFloat && m_Ints == array.m_Ints && m_Floats == array.m_Floats;
         }
 
-        virtual bool is_const() const { return true; }
+        bool is_float() const { return m_IsFloat; }
+        size_t size() const { return m_IsFloat ? m_Floats.size() : m_Ints.size(); }
+
+        // only the one matching `is_float` holds the elements
+        const std::vector<int64_t>& ints() const { return m_Ints; }
+        const std::vector<double>& floats() const { return m_Floats; }
+
+        virtual size_t owned_bytes() const override {
+            return m_Ints.capacity() * sizeof(int64_t) + m_Floats.capacity() * sizeof(double);
+        }
 
     private:
-        std::string m_Value;
+        std::vector<int64_t> m_Ints;
+        std::vector<double> m_Floats;
+        bool m_IsFloat = false;
     };
 
-    // 1234
-    class NumberValue : public Value {
+    // #(1 2 3 ), persistent vector built by `vector`, `assoc` and `conj`
+    class VectorValue : public Value {
     public:
-        NumberValue(int64_t value) : m_Value(value) {}
-        ~NumberValue() {}
+        VectorValue(PersistentVector elements, size_t allocated) : m_Elements(std::move(elements)), m_Allocated(allocated) {}
+        ~VectorValue() {}
 
         virtual std::ostream& print(std::ostream& stream) const override {
-            stream << m_Value;
+            stream << "#(";
+            m_Elements.for_each([&](Ref element) {
+                element.print(stream);
+                stream << " ";
+            });
+            stream << ")";
             return stream;
         };
 
-        virtual std::shared_ptr<Value> eval(Context& context) override;
-        virtual ValueKind kind() const override { return ValueKind::Number; }
+        virtual Ref eval(Context& context) override;
+        virtual ValueKind kind() const override { return ValueKind::Vector; }
+
+        virtual bool equals(Ref other) override {
+            if(other.kind() != ValueKind::Vector)
+                return false;
+            auto& elements = static_cast<VectorValue&>(*other).m_Elements;
+            if(elements.size() != m_Elements.size())
+                return false;
+            for(size_t i = 0; i < m_Elements.size(); i++) {
+                if(!m_Elements.get(i).equals(elements.get(i)))
+                    return false;
+            }
+            return true;
+        }
+
+        const PersistentVector& elements() const { return m_Elements; }
+
+        virtual void trace(Heap& heap) override;
+
+        // only the nodes created for this version, shared ones are counted by their first owner
+        virtual size_t owned_bytes() const override { return m_Allocated; }
+
+    private:
+        PersistentVector m_Elements;
+        size_t m_Allocated;
+    };
 
-        virtual bool equals(std::shared_ptr<Value> other) override {
-            if(other->kind() != ValueKind::Number)
+    // {"a" 1 "b" 2 }, persistent hash map built by `hash-map` and `assoc`
+    class MapValue : public Value {
+    public:
+        MapValue(PersistentMap entries, size_t allocated) : m_Entries(std::move(entries)), m_Allocated(allocated) {}
+        ~MapValue() {}
+
+        virtual std::ostream& print(std::ostream& stream) const override {
+            stream << "{";
+            m_Entries.for_each([&](Ref key, Ref value) {
+                key.print(stream);
+                stream << " ";
+                value.print(stream);
+                stream << " ";
+            });
+            stream << "}";
+            return stream;
+        };
+
+        virtual Ref eval(Context& context) override;
+        virtual ValueKind kind() const override { return ValueKind::Map; }
+
+        virtual bool equals(Ref other) override {
+            if(other.kind() != ValueKind::Map)
+                return false;
+            auto& entries = static_cast<MapValue&>(*other).m_Entries;
+            if(entries.size() != m_Entries.size())
                 return false;
-            return m_Value == dynamic_cast<NumberValue&>(*other).m_Value;
+            bool equal = true;
+            m_Entries.for_each([&](Ref key, Ref value) {
+                auto found = entries.find(key);
+                equal = equal && found && found->equals(value);
+            });
+            return equal;
+        }
+
+        const PersistentMap& entries() const { return m_Entries; }
+
+        virtual void trace(Heap& heap) override;
+
+        virtual size_t owned_bytes() const override { return m_Allocated; }
+
+    private:
+        PersistentMap m_Entries;
+        size_t m_Allocated;
+    };
+
+    // result of `spawn`, a coroutine evaluating an expression on its own native stack
+    class TaskValue : public Value {
+    public:
+        TaskValue(Ref expression, std::unique_ptr<Fiber> fiber);
+        ~TaskValue();
+
+        virtual std::ostream& print(std::ostream& stream) const override {
+            stream << (m_Done ? "task (done)" : "task");
+            return stream;
+        };
+
+        virtual Ref eval(Context& context) override;
+        virtual ValueKind kind() const override { return ValueKind::Task; }
+
+        virtual bool equals(Ref other) override {
+            return other.is_heap() && other.get() == this;
         }
 
-        int64_t value() const { return m_Value; }
+        Ref get_expression() const { return m_Expression; }
+        Fiber* get_fiber() const { return m_Fiber.get(); }
 
-        virtual bool is_const() const { return true; }
+        bool is_done() const { return m_Done; }
+        Ref get_result() const { return m_Result; }
+        void set_result(Ref result) {
+            m_Result = result;
+            m_Done = true;
+        }
+
+        // fibers blocked in `await` until the task is done
+        std::vector<Fiber*>& get_awaiters() { return m_Awaiters; }
+
+        virtual void trace(Heap& heap) override;
+        virtual size_t owned_bytes() const override;
 
     private:
-        int64_t m_Value;
+        Ref m_Expression;
+        Ref m_Result;
+        bool m_Done = false;
+        std::unique_ptr<Fiber> m_Fiber;
+        std::vector<Fiber*> m_Awaiters;
+    };
+
+    // result of `(channel n)`, a queue of up to `n` values between tasks. a full channel blocks
+    // senders and an empty one receivers, `n` = 0 hands every value over directly
+    class ChannelValue : public Value {
+    public:
+        struct Sender {
+            Fiber* fiber;
+            Ref value;
+        };
+
+        ChannelValue(size_t capacity) : m_Capacity(capacity) {}
+        ~ChannelValue() {}
+
+        virtual std::ostream& print(std::ostream& stream) const override {
+            stream << "channel";
+            return stream;
+        };
+
+        virtual Ref eval(Context& context) override;
+        virtual ValueKind kind() const override { return ValueKind::Channel; }
+
+        virtual bool equals(Ref other) override {
+            return other.is_heap() && other.get() == this;
+        }
+
+        size_t get_capacity() const { return m_Capacity; }
+        std::deque<Ref>& get_buffer() { return m_Buffer; }
+        std::deque<Sender>& get_senders() { return m_Senders; }
+        std::deque<Fiber*>& get_receivers() { return m_Receivers; }
+
+        virtual void trace(Heap& heap) override;
+
+    private:
+        size_t m_Capacity;
+        std::deque<Ref> m_Buffer;
+        std::deque<Sender> m_Senders;
+        std::deque<Fiber*> m_Receivers;
+    };
+
+    // result of `open-input` and `open-output`, a buffered file closed by `close` or once it is collected
+    class PortValue : public Value {
+    public:
+        PortValue(std::unique_ptr<FilePort> port, std::string path);
+        ~PortValue();
+
+        virtual std::ostream& print(std::ostream& stream) const override {
+            stream << "port " << m_Path;
+            return stream;
+        };
+
+        virtual Ref eval(Context& context) override;
+        virtual ValueKind kind() const override { return ValueKind::Port; }
+
+        virtual bool equals(Ref other) override {
+            return other.is_heap() && other.get() == this;
+        }
+
+        FilePort& get_port() { return *m_Port; }
+
+        // the buffer counts towards the heap size, so unreachable ports are closed sooner
+        virtual size_t owned_bytes() const override;
+
+    private:
+        std::unique_ptr<FilePort> m_Port;
+        std::string m_Path;
     };
 
     // foo
@@ -158,11 +539,11 @@ namespace lisp {
             return stream;
         };
 
-        virtual std::shared_ptr<Value> eval(Context& context) override;
+        virtual Ref eval(Context& context) override;
         virtual ValueKind kind() const override { return ValueKind::Ident; }
 
-        virtual bool equals(std::shared_ptr<Value> other) override {
-            if(other->kind() != ValueKind::Ident)
+        virtual bool equals(Ref other) override {
+            if(other.kind() != ValueKind::Ident)
                 return false;
             return m_Name == dynamic_cast<IdentValue&>(*other).m_Name;
         }
@@ -173,44 +554,79 @@ namespace lisp {
         std::string m_Name;
     };
 
+    // function argument, resolved from an identifier by `resolve`
+    class LocalValue : public Value {
+    public:
+        LocalValue(std::string name, uint16_t depth, uint16_t slot) : m_Name(name), m_Depth(depth), m_Slot(slot) {}
+        ~LocalValue() {}
+
+        virtual std::ostream& print(std::ostream& stream) const override {
+            stream << m_Name;
+            return stream;
+        };
+
+        virtual Ref eval(Context& context) override;
+        virtual ValueKind kind() const override { return ValueKind::Local; }
+
+        virtual bool equals(Ref other) override {
+            if(other.kind() != ValueKind::Local)
+                return false;
+            auto& local = dynamic_cast<LocalValue&>(*other);
+            return m_Depth == local.m_Depth && m_Slot == local.m_Slot;
+        }
+
+        std::string& get_name() { return m_Name; }
+        uint16_t get_depth() const { return m_Depth; }
+        uint16_t get_slot() const { return m_Slot; }
+
+    private:
+        std::string m_Name;
+        uint16_t m_Depth;
+        uint16_t m_Slot;
+    };
+
     class QuoteValue : public Value {
     public:
-        QuoteValue(std::shared_ptr<Value> quoted) : m_Quoted(quoted) {}
+        QuoteValue(Ref quoted) : m_Quoted(quoted) {}
         ~QuoteValue() {}
 
         virtual std::ostream& print(std::ostream& stream) const override {
-            m_Quoted->print(stream);
+            m_Quoted.print(stream);
             return stream;
         };
 
-        virtual std::optional<std::shared_ptr<std::string>> is_error() const override { 
-            return m_Quoted->is_error();
-        }        
-        
-        virtual std::shared_ptr<Value> eval(Context& context) override;
+        virtual std::optional<std::shared_ptr<std::string>> is_error() const override {
+            return m_Quoted.is_error();
+        }
+
+        virtual Ref eval(Context& context) override;
         virtual ValueKind kind() const override { return ValueKind::Quote; }
 
-        virtual bool equals(std::shared_ptr<Value> other) override {
-            if(other->kind() != ValueKind::Quote)
+        virtual bool equals(Ref other) override {
+            if(other.kind() != ValueKind::Quote)
                 return false;
-            return m_Quoted->equals(dynamic_cast<QuoteValue&>(*other).m_Quoted);
+            return m_Quoted.equals(dynamic_cast<QuoteValue&>(*other).m_Quoted);
         }
 
+        Ref get_quoted() const { return m_Quoted; }
+
+        virtual void trace(Heap& heap) override;
+
     private:
-        std::shared_ptr<Value> m_Quoted;
+        Ref m_Quoted;
     };
 
     // (foo "bar" 123)
     class CompoundValue : public Value {
     public:
         CompoundValue() {}
-        CompoundValue(std::vector<std::shared_ptr<Value>> contents) : m_Contents(contents) {}
+        CompoundValue(RefList contents) : m_Contents(std::move(contents)) {}
         ~CompoundValue() {}
 
         virtual std::ostream& print(std::ostream& stream) const override {
             stream << "(";
             for(auto& value : m_Contents) {
-                value->print(stream);
+                value.print(stream);
                 stream << " ";
             }
             stream << ")";
@@ -219,110 +635,215 @@ namespace lisp {
 
         virtual std::optional<std::shared_ptr<std::string>> is_error() const override {
             for(auto& value : m_Contents) {
-                auto error = value->is_error();
+                auto error = value.is_error();
                 if(error.has_value()) {
                     return error.value();
                 }
             }
             return std::nullopt;
         }
-        
-        virtual std::shared_ptr<Value> eval(Context& context) override;
+
+        virtual Ref eval(Context& context) override;
         virtual ValueKind kind() const override { return ValueKind::Compound; }
 
-        virtual bool equals(std::shared_ptr<Value> other) override {
-            if(other->kind() != ValueKind::Compound)
+        virtual bool equals(Ref other) override {
+            if(other.kind() != ValueKind::Compound)
                 return false;
             return m_Contents == dynamic_cast<CompoundValue&>(*other).m_Contents;
         }
 
-        void add_value(std::shared_ptr<Value> value) {
+        void add_value(Ref value) {
             m_Contents.push_back(value);
         }
 
-        std::vector<std::shared_ptr<Value>>& get_contents() {
+        RefList& get_contents() {
             return m_Contents;
         }
 
+        virtual void trace(Heap& heap) override;
+
+        virtual Ref eval_tail(Context& context) override;
+
+        // resolve the head and cache the call target ahead of evaluating on worker threads, which
+        // only read the cached target
+        void prepare(Context& context);
+
     private:
-        std::vector<std::shared_ptr<Value>> m_Contents;
+        RefList m_Contents;
+
+        // call target of an identifier head, resolved on the first evaluation. builtins can't be
+        // redefined, functions are looked up again once the context's definition version changes
+        std::atomic<bool> m_Resolved = false;
+        bool m_LocalHead = false;
+        IdentValue* m_Head = nullptr;
+        Builtin m_Builtin = nullptr;
+        Builtin m_TailBuiltin = nullptr;
+        Ref m_Callee;
+        uint64_t m_CalleeVersion = 0;
+        // set for binary operator calls, which skip the builtin and take a fixnum fast path
+        Operator m_Operator = Operator::None;
+
+        Ref evaluate(Context& context, bool tail);
+        Ref evaluate_operator(Context& context);
+        void resolve_head();
+        Ref call(Context& context, Ref callee, bool tail);
     };
 
     class FunctionValue : public Value {
     public:
-        FunctionValue(std::string name, std::vector<std::string> arguments, std::shared_ptr<Value> body)
-            : m_Name(name), m_Arguments(arguments), m_Body(body) {}
+        FunctionValue(std::string name, std::vector<std::string> arguments, Ref body);
         ~FunctionValue() {}
 
         virtual std::ostream& print(std::ostream& stream) const override {
-            stream << "function " << m_Name; 
+            stream << "function " << m_Name;
             return stream;
         };
 
-        virtual std::shared_ptr<Value> eval(Context& context) override;
+        virtual Ref eval(Context& context) override;
         virtual ValueKind kind() const override { return ValueKind::Function; }
 
-        virtual bool equals(std::shared_ptr<Value> other) override {
-            if(other->kind() != ValueKind::Function)
+        virtual bool equals(Ref other) override {
+            if(other.kind() != ValueKind::Function)
                 return false;
             return m_Name == dynamic_cast<FunctionValue&>(*other).m_Name;
         }
 
-        std::vector<std::string> get_arguments() const { return m_Arguments; }
+        const std::string& get_name() const { return m_Name; }
+        const std::vector<std::string>& get_arguments() const { return m_Arguments; }
+        // call with arguments that are already evaluated
+        Ref apply(Context& context, const std::vector<Ref>& arguments);
+        size_t get_arity() const { return m_Arguments.size(); }
+        // the arguments followed by the slots of the body's `let` bindings
+        size_t get_frame_size() const { return m_FrameSize; }
+        Ref get_body() const { return m_Body; }
+
+        // bytecode of the body, compiled on the first call from the vm
+        const std::shared_ptr<Chunk>& get_code() const { return m_Code; }
+        void set_code(std::shared_ptr<Chunk> code) { m_Code = code; }
+
+        // cached results, set by `memoize`
+        Memo* get_memo() const { return m_Memo.get(); }
+        void set_memo(std::shared_ptr<Memo> memo) { m_Memo = memo; }
+
+        // index into the profiler's function table, 0 until the first profiled call
+        uint32_t get_profile_id() const { return m_ProfileId; }
+        void set_profile_id(uint32_t id) { m_ProfileId = id; }
+
+        virtual void trace(Heap& heap) override;
 
     private:
         std::string m_Name;
 
         std::vector<std::string> m_Arguments;
-        std::shared_ptr<Value> m_Body;
+        Ref m_Body;
+        size_t m_FrameSize;
+        std::shared_ptr<Chunk> m_Code;
+        std::shared_ptr<Memo> m_Memo;
+        uint32_t m_ProfileId = 0;
     };
 
-    // t, f, nil
-    class ConstValue : public Value {
+    // function implemented in C++, registered by the embedding host
+    class NativeValue : public Value {
     public:
-        enum Kind {
-            T,
-            F,
-            Nil
-        };
+        // `args` are evaluated and stay rooted during the call
+        using Function = std::function<Ref(Context& context, std::vector<Ref>& args)>;
 
-        ConstValue(Kind kind) : m_Kind(kind) {}
-        ConstValue(ConstValue* value) : m_Kind(value->m_Kind) {}
-        ~ConstValue() {}
+        NativeValue(std::string name, Function function) : m_Name(name), m_Function(std::move(function)) {}
+        ~NativeValue() {}
 
         virtual std::ostream& print(std::ostream& stream) const override {
-            switch(m_Kind) {
-            case T:
-                stream << 'T';
-                break;
-            case F:
-                stream << 'F';
-                break;
-            case Nil:
-                stream << "NIL";
-                break;
-            }
+            stream << "native function " << m_Name;
             return stream;
         };
 
-        virtual std::shared_ptr<Value> eval(Context& context) override;
-        virtual ValueKind kind() const override { return ValueKind::Const; }
-
-        Kind get_value_kind() const { return m_Kind; }
+        virtual Ref eval(Context& context) override;
+        virtual ValueKind kind() const override { return ValueKind::Native; }
 
-        virtual bool equals(std::shared_ptr<Value> other) override {
-            if(other->kind() != ValueKind::Const)
-                return false;
-            return m_Kind == dynamic_cast<ConstValue&>(*other).m_Kind;
+        virtual bool equals(Ref other) override {
+            return other.is_heap() && other.get() == this;
         }
 
-        bool is_truthy() { return m_Kind == T; }
+        const std::string& get_name() const { return m_Name; }
+        Ref call(Context& context, std::vector<Ref>& args) const { return m_Function(context, args); }
 
     private:
-        Kind m_Kind;
+        std::string m_Name;
+        Function m_Function;
     };
 
-    static const std::unordered_map<std::string, ConstValue::Kind> CONSTVALUE_IDENTS = {
+    inline int64_t Ref::number() const {
+        if(is_fixnum())
+            return fixnum();
+        return static_cast<NumberValue*>(get())->value().to_int64();
+    }
+
+    inline ValueKind Ref::kind() const {
+        if(is_fixnum())
+            return ValueKind::Number;
+        if(is_immediate())
+            return is_eof() ? ValueKind::Eof : ValueKind::Const;
+        return get()->kind();
+    }
+
+    inline bool Ref::is_numeric() const {
+        if(is_fixnum())
+            return true;
+        if(!is_heap())
+            return false;
+        auto value_kind = get()->kind();
+        return value_kind == ValueKind::Number || value_kind == ValueKind::Float;
+    }
+
+    inline std::ostream& Ref::print(std::ostream& stream) const {
+        if(is_heap())
+            return get()->print(stream);
+        if(is_fixnum())
+            return stream << fixnum();
+        if(is_eof())
+            return stream << "End of file";
+
+        switch(const_kind()) {
+        case ConstValue::Kind::T:
+            stream << 'T';
+            break;
+        case ConstValue::Kind::F:
+            stream << 'F';
+            break;
+        case ConstValue::Kind::Nil:
+            stream << "NIL";
+            break;
+        }
+        return stream;
+    }
+
+    inline Ref Ref::eval(Context& context) const {
+        if(is_heap())
+            return get()->eval(context);
+        return *this;
+    }
+
+    inline Ref Ref::eval_tail(Context& context) const {
+        if(is_heap())
+            return get()->eval_tail(context);
+        return *this;
+    }
+
+    inline bool Ref::equals(Ref other) const {
+        if(is_heap())
+            return get()->equals(other);
+        return m_Bits == other.m_Bits;
+    }
+
+    inline std::optional<std::shared_ptr<std::string>> Ref::is_error() const {
+        if(is_heap())
+            return get()->is_error();
+        return std::nullopt;
+    }
+
+    // consistent with `Ref::equals`: values that compare equal hash equally
+    size_t hash_value(Ref value);
+
+    static const std::unordered_map<std::string_view, ConstValue::Kind> CONSTVALUE_IDENTS = {
         {"t", ConstValue::Kind::T},
         {"T", ConstValue::Kind::T},
         {"f", ConstValue::Kind::F},
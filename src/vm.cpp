@@ -0,0 +1,416 @@
+#include "vm.hpp"
+#include "compiler.hpp"
+#include "builtin.hpp"
+#include "value.hpp"
+#include "profiler.hpp"
+
+namespace lisp {
+    static inline uint16_t read_u16(const uint8_t* ip) {
+        return ip[0] | (ip[1] << 8);
+    }
+
+    static inline uint32_t read_u32(const uint8_t* ip) {
+        return ip[0] | (ip[1] << 8) | (ip[2] << 16) | (uint32_t(ip[3]) << 24);
+    }
+
+    Ref VM::run(Ref program) {
+        auto& context = m_Context;
+        auto profiler = m_Context.get_profiler();
+        auto& function = static_cast<FunctionValue&>(*program);
+
+        // the program is called like a function without arguments
+        size_t entry = m_Frames.size();
+        m_Stack.push_back(program);
+        m_Frames.push_back({function.get_code().get(), function.get_code()->code(), m_Stack.size(), false});
+        m_Context.push_frame(0, function.get_code()->frame_size());
+
+        Frame* frame = &m_Frames.back();
+        const uint8_t* ip = frame->ip;
+
+        for(;;) {
+            switch(static_cast<OpCode>(*ip++)) {
+            case OpCode::Const:
+                m_Stack.push_back(frame->chunk->constant(read_u32(ip)));
+                ip += 4;
+                break;
+
+            case OpCode::Local:
+                m_Stack.push_back(m_Stack[frame->base + *ip++]);
+                break;
+
+            case OpCode::Global: {
+                auto& name = frame->chunk->name(read_u32(ip));
+                ip += 4;
+                if(auto value = m_Context.get_symbol(name))
+                    m_Stack.push_back(std::move(value.value()));
+                else
+                    m_Stack.push_back(ERROR("unknown identifier"));
+            } break;
+
+            case OpCode::SetLocal:
+                m_Stack[frame->base + *ip++] = std::move(m_Stack.back());
+                m_Stack.back() = m_Context.get_const_val(ConstValue::Kind::Nil);
+                break;
+
+            case OpCode::SetGlobal:
+                m_Context.add_symbol(frame->chunk->name(read_u32(ip)), std::move(m_Stack.back()));
+                ip += 4;
+                m_Stack.back() = m_Context.get_const_val(ConstValue::Kind::Nil);
+                break;
+
+            case OpCode::Defun: {
+                auto& function = frame->chunk->constant(read_u32(ip));
+                ip += 4;
+                m_Context.add_symbol(dynamic_cast<FunctionValue&>(*function).get_name(), function);
+                m_Stack.push_back(m_Context.get_const_val(ConstValue::Kind::Nil));
+            } break;
+
+            case OpCode::Pop:
+                m_Stack.pop_back();
+                break;
+
+            case OpCode::Jump:
+                ip = frame->chunk->code() + read_u32(ip);
+                break;
+
+            case OpCode::JumpIfError:
+                if(m_Stack.back().kind() == ValueKind::Error)
+                    ip = frame->chunk->code() + read_u32(ip);
+                else
+                    ip += 4;
+                break;
+
+            case OpCode::Test: {
+                auto cond = std::move(m_Stack.back());
+                m_Stack.pop_back();
+                if(cond.kind() == ValueKind::Error) {
+                    m_Stack.push_back(std::move(cond));
+                    ip = frame->chunk->code() + read_u32(ip + 4);
+                }
+                else if(cond.kind() != ValueKind::Const) {
+                    m_Stack.push_back(ERROR("expect `T`, `F` or `NIL` as condition values"));
+                    ip = frame->chunk->code() + read_u32(ip + 4);
+                }
+                else if(cond.is_truthy())
+                    ip += 8;
+                else
+                    ip = frame->chunk->code() + read_u32(ip);
+            } break;
+
+            case OpCode::Loop:
+                ip = frame->chunk->code() + read_u32(ip);
+                m_Context.safepoint();
+                break;
+
+            case OpCode::Count: {
+                uint8_t slot = ip[0];
+                auto end = read_u32(ip + 1);
+                ip += 5;
+
+                auto count = std::move(m_Stack.back());
+                m_Stack.pop_back();
+                if(count.kind() == ValueKind::Error)
+                    m_Stack.push_back(std::move(count));
+                else if(count.kind() != ValueKind::Number)
+                    m_Stack.push_back(ERROR("expect `dotimes` count to be an integer"));
+                else if(!count.is_fixnum())
+                    m_Stack.push_back(ERROR("`dotimes` count is out of range"));
+                else {
+                    // the count, then the next value of the counter
+                    m_Stack[frame->base + slot + 1] = count;
+                    m_Stack[frame->base + slot + 2] = Ref::fixnum(0);
+                    break;
+                }
+                ip = frame->chunk->code() + end;
+            } break;
+
+            case OpCode::Next: {
+                auto* state = &m_Stack[frame->base + ip[0]];
+                auto counter = state[2].fixnum();
+                if(counter >= state[1].fixnum()) {
+                    m_Stack.push_back(m_Context.get_const_val(ConstValue::Kind::Nil));
+                    ip = frame->chunk->code() + read_u32(ip + 1);
+                    break;
+                }
+                state[0] = Ref::fixnum(counter);
+                state[2] = Ref::fixnum(counter + 1);
+                ip += 5;
+            } break;
+
+            case OpCode::Function: {
+                auto index = read_u32(ip);
+                uint8_t argc = ip[4];
+                auto end = read_u32(ip + 5);
+                ip += 9;
+
+                auto& cache = frame->chunk->call_cache(index);
+                if(cache.version != m_Context.get_version()) {
+                    auto symbol = m_Context.get_symbol(frame->chunk->name(index));
+                    if(!symbol) {
+                        m_Stack.push_back(ERROR("could not find function"));
+                        ip = frame->chunk->code() + end;
+                        break;
+                    }
+                    cache.callee = symbol.value();
+                    cache.version = m_Context.get_version();
+                }
+
+                if(cache.callee.kind() == ValueKind::Native)
+                    m_Stack.push_back(cache.callee);
+                else if(cache.callee.kind() != ValueKind::Function) {
+                    m_Stack.push_back(ERROR("can only call functions"));
+                    ip = frame->chunk->code() + end;
+                }
+                else if(static_cast<FunctionValue&>(*cache.callee).get_arity() != argc) {
+                    m_Stack.push_back(ERROR("wrong number of arguments for function call"));
+                    ip = frame->chunk->code() + end;
+                }
+                else
+                    m_Stack.push_back(cache.callee);
+            } break;
+
+            case OpCode::Callee: {
+                uint8_t argc = ip[0];
+                auto end = read_u32(ip + 1);
+                ip += 5;
+
+                auto& callee = m_Stack.back();
+                if(callee.kind() == ValueKind::Native)
+                    break;
+                if(callee.kind() != ValueKind::Function) {
+                    callee = ERROR("can only call functions");
+                    ip = frame->chunk->code() + end;
+                }
+                else if(static_cast<FunctionValue&>(*callee).get_arity() != argc) {
+                    callee = ERROR("wrong number of arguments for function call");
+                    ip = frame->chunk->code() + end;
+                }
+            } break;
+
+            case OpCode::TailCall: {
+                uint8_t argc = *ip;
+                auto& callee = m_Stack[m_Stack.size() - argc - 1];
+                auto& function = static_cast<FunctionValue&>(*callee);
+                // memoized and native functions get their own frame, to store the result when it returns
+                if(callee.kind() == ValueKind::Function && !function.get_memo()) {
+                    // move the callee and arguments over the current ones and reuse the frame
+                    ip++;
+                    if(!function.get_code())
+                        function.set_code(compile_function(function, m_Context));
+
+                    if(profiler)
+                        profiler->replace(function);
+
+                    std::move(m_Stack.end() - argc - 1, m_Stack.end(), m_Stack.begin() + frame->base - 1);
+                    m_Stack.resize(frame->base + argc);
+                    frame->chunk = function.get_code().get();
+                    m_Context.resize_frame(frame->chunk->frame_size());
+                    ip = frame->chunk->code();
+                    m_Context.safepoint();
+                    break;
+                }
+            } [[fallthrough]];
+
+            case OpCode::Call: {
+                uint8_t argc = *ip++;
+                auto& callee = m_Stack[m_Stack.size() - argc - 1];
+                if(callee.kind() == ValueKind::Native) {
+                    // the callee and arguments stay on the stack until the native function returns
+                    std::vector<Ref> args(m_Stack.end() - argc, m_Stack.end());
+                    auto result = static_cast<NativeValue&>(*callee).call(m_Context, args);
+                    m_Stack.resize(m_Stack.size() - argc);
+                    m_Stack.back() = result;
+                    break;
+                }
+
+                auto& function = static_cast<FunctionValue&>(*callee);
+                if(m_Frames.size() - entry >= MAX_FRAMES) {
+                    m_Stack.resize(m_Stack.size() - argc);
+                    m_Stack.back() = ERROR("stack depth exceeded");
+                    break;
+                }
+
+                auto memo = function.get_memo();
+                if(memo) {
+                    std::vector<Ref> key(m_Stack.end() - argc, m_Stack.end());
+                    if(auto result = memo->find(key)) {
+                        m_Stack.resize(m_Stack.size() - argc);
+                        m_Stack.back() = result.value();
+                        break;
+                    }
+                    m_Context.push_memo(&function, std::move(key));
+                }
+
+                if(!function.get_code())
+                    function.set_code(compile_function(function, m_Context));
+                if(profiler)
+                    profiler->enter(function);
+
+                frame->ip = ip;
+                m_Frames.push_back({function.get_code().get(), function.get_code()->code(), m_Stack.size() - argc, memo != nullptr});
+                m_Context.push_frame(argc, function.get_code()->frame_size());
+                frame = &m_Frames.back();
+                ip = frame->ip;
+                m_Context.safepoint();
+            } break;
+
+            case OpCode::Add:
+            case OpCode::Subtract:
+            case OpCode::Multiply:
+            case OpCode::Divide: {
+                auto op = static_cast<OpCode>(ip[-1]);
+                uint8_t argc = *ip++;
+                auto args = m_Stack.end() - argc;
+
+                Ref result;
+                for(auto arg = args; arg != m_Stack.end(); arg++) {
+                    if(arg->kind() == ValueKind::Error) {
+                        result = *arg;
+                        break;
+                    }
+                    if(!arg->is_numeric()) {
+                        switch(op) {
+                        case OpCode::Add:
+                            result = ERROR("`+` exepects all arguments to be numbers");
+                            break;
+                        case OpCode::Subtract:
+                            result = ERROR("`-` exepects all arguments to be numbers");
+                            break;
+                        case OpCode::Multiply:
+                            result = ERROR("`*` exepects all arguments to be numbers");
+                            break;
+                        default:
+                            result = ERROR("`/` exepects all arguments to be numbers");
+                        }
+                        break;
+                    }
+                }
+
+                if(!result) {
+                    Operator arithmetic;
+                    switch(op) {
+                    case OpCode::Add:
+                        arithmetic = Operator::Add;
+                        break;
+                    case OpCode::Subtract:
+                        arithmetic = Operator::Subtract;
+                        break;
+                    case OpCode::Multiply:
+                        arithmetic = Operator::Multiply;
+                        break;
+                    default:
+                        arithmetic = Operator::Divide;
+                    }
+
+                    // the operands stay on the stack until the total is computed
+                    result = *args;
+                    for(auto arg = args + 1; arg != m_Stack.end() && result.kind() != ValueKind::Error; arg++)
+                        result = apply_operator(m_Context, arithmetic, result, *arg);
+                }
+
+                m_Stack.erase(args, m_Stack.end());
+                m_Stack.push_back(std::move(result));
+            } break;
+
+            case OpCode::Lt:
+            case OpCode::Gt:
+            case OpCode::LtEq:
+            case OpCode::GtEq: {
+                auto op = static_cast<OpCode>(ip[-1]);
+                auto& first = m_Stack[m_Stack.size() - 2];
+                auto& second = m_Stack.back();
+
+                Ref result;
+                if(first.kind() == ValueKind::Error)
+                    result = first;
+                else if(second.kind() == ValueKind::Error)
+                    result = second;
+                else if(!first.is_numeric() || !second.is_numeric()) {
+                    switch(op) {
+                    case OpCode::Lt:
+                        result = ERROR("`<` only operates on numbers");
+                        break;
+                    case OpCode::Gt:
+                        result = ERROR("`>` only operates on numbers");
+                        break;
+                    case OpCode::LtEq:
+                        result = ERROR("`<=` only operates on numbers");
+                        break;
+                    default:
+                        result = ERROR("`>=` only operates on numbers");
+                    }
+                }
+                else {
+                    switch(op) {
+                    case OpCode::Lt:
+                        result = apply_operator(m_Context, Operator::Lt, first, second);
+                        break;
+                    case OpCode::Gt:
+                        result = apply_operator(m_Context, Operator::Gt, first, second);
+                        break;
+                    case OpCode::LtEq:
+                        result = apply_operator(m_Context, Operator::LtEq, first, second);
+                        break;
+                    default:
+                        result = apply_operator(m_Context, Operator::GtEq, first, second);
+                    }
+                }
+
+                m_Stack.pop_back();
+                m_Stack.back() = std::move(result);
+            } break;
+
+            case OpCode::Eq: {
+                auto value = std::move(m_Stack.back());
+                m_Stack.pop_back();
+                if(value.equals(m_Stack.back()))
+                    ip += 4;
+                else {
+                    m_Stack.back() = m_Context.get_const_val(ConstValue::Kind::F);
+                    ip = frame->chunk->code() + read_u32(ip);
+                }
+            } break;
+
+            case OpCode::EqEnd:
+                m_Stack.back() = m_Context.get_const_val(ConstValue::Kind::T);
+                break;
+
+            case OpCode::Print: {
+                size_t count = read_u16(ip);
+                ip += 2;
+                print_line(m_Stack.data() + m_Stack.size() - count, count);
+                m_Stack.resize(m_Stack.size() - count);
+                m_Stack.push_back(m_Context.get_const_val(ConstValue::Kind::Nil));
+            } break;
+
+            case OpCode::Builtin: {
+                auto builtin = frame->chunk->builtin(read_u16(ip));
+                auto& compound = dynamic_cast<CompoundValue&>(*frame->chunk->constant(read_u32(ip + 2)));
+                ip += 6;
+                m_Stack.push_back(builtin(m_Context, compound.get_contents()));
+            } break;
+
+            case OpCode::Return: {
+                // drop the arguments, then replace the callee with the result
+                auto result = m_Stack.back();
+                bool memo = frame->memo;
+                m_Context.pop_frame();
+                m_Frames.pop_back();
+                if(memo)
+                    m_Context.pop_memo(result);
+
+                if(m_Frames.size() == entry) {
+                    m_Stack.pop_back();
+                    return result;
+                }
+                m_Stack.back() = result;
+                if(profiler)
+                    profiler->leave();
+
+                frame = &m_Frames.back();
+                ip = frame->ip;
+            } break;
+            }
+        }
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "bytecode.hpp"
+#include "value.hpp"
+
+namespace lisp {
+    // stack-based bytecode interpreter, an alternative to `Value::eval`
+    class VM {
+    public:
+        VM(Context& context) : m_Context(context), m_Stack(context.get_stack()) {}
+        ~VM() {}
+
+        // run a program compiled by `compile_program`
+        Ref run(Ref program);
+
+    private:
+        // deeper non-tail recursion evaluates to a "stack depth exceeded" error
+        static constexpr size_t MAX_FRAMES = 1 << 18;
+
+        struct Frame {
+            Chunk* chunk;
+            const uint8_t* ip;
+            size_t base;
+            // whether returning stores the result in the function's memo
+            bool memo;
+        };
+
+        Context& m_Context;
+        // shared with the context so builtins see the same function frames
+        std::vector<Ref>& m_Stack;
+        std::vector<Frame> m_Frames;
+    };
+}
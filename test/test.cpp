@@ -0,0 +1,275 @@
+// Regression tests for `make test`: every test runs against the embedding library, the runner
+// reports each one and fails if any expectation didn't hold.
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "interpreter.hpp"
+#include "context.hpp"
+#include "server.hpp"
+
+static bool failed = false;
+
+#define EXPECT(condition) expect(condition, #condition, __LINE__)
+
+static void expect(bool condition, const char* text, int line) {
+    if(condition)
+        return;
+    std::cerr << "  test.cpp:" << line << ": expected " << text << std::endl;
+    failed = true;
+}
+
+// the heap's live size after a full collection
+static size_t live_bytes(lisp::Interpreter& interpreter) {
+    auto& context = interpreter.get_context();
+    context.collect();
+    return context.get_heap().get_bytes();
+}
+
+static std::string to_string(lisp::Ref value) {
+    std::string string;
+    lisp::Interpreter::to_string(value, string);
+    return string;
+}
+
+// a fresh path in the temporary directory, removed by the caller
+static std::string temporary_path(const char* name) {
+    return "/tmp/lisppp-test-" + std::to_string(getpid()) + "-" + name;
+}
+
+static std::string read_file(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+static void write_file(const std::string& path, const std::string& contents) {
+    std::ofstream(path, std::ios::binary) << contents;
+}
+
+// a streamed form's string literals go away with the rest of its syntax
+static void streamed_literals() {
+    lisp::Interpreter interpreter;
+    auto stream = [&](int from, int to) {
+        for(int i = from; i < to; i++) {
+            auto program = interpreter.load_form("(setq last \"s" + std::to_string(i) + "\")");
+            EXPECT(!lisp::Interpreter::is_error(interpreter.run(program)));
+        }
+    };
+
+    stream(0, 1000);
+    size_t before = live_bytes(interpreter);
+    stream(1000, 100000);
+    EXPECT(live_bytes(interpreter) < before + (16 << 10));
+}
+
+// an embedder evaluating source after source keeps neither the syntax nor the strings of old ones
+static void repeated_evals(bool use_vm) {
+    lisp::Interpreter::Options options;
+    options.use_vm = use_vm;
+    lisp::Interpreter interpreter(options);
+    auto& arena = interpreter.get_context().get_arena();
+    auto evaluate = [&](int from, int to) {
+        for(int i = from; i < to; i++) {
+            auto text = "s" + std::to_string(i);
+            interpreter.set("host", interpreter.string(text));
+            auto result = interpreter.eval("(setq last (vector \"" + text + "\" host))");
+            EXPECT(!lisp::Interpreter::is_error(result));
+        }
+    };
+
+    evaluate(0, 1000);
+    size_t before = live_bytes(interpreter);
+    size_t nodes = arena.get_bytes();
+    evaluate(1000, 100000);
+    EXPECT(live_bytes(interpreter) < before + (16 << 10));
+    EXPECT(arena.get_bytes() == nodes);
+}
+
+static void repeated_evals() {
+    repeated_evals(false);
+    repeated_evals(true);
+}
+
+// load `image` into a fresh interpreter, which must either fail cleanly or define printable globals
+static bool load_image(const std::string& path, const std::string& image) {
+    write_file(path, image);
+    lisp::Interpreter interpreter;
+    auto result = interpreter.load_image(path);
+    if(lisp::Interpreter::is_error(result))
+        return false;
+    for(auto& [name, value] : interpreter.get_context().get_globals())
+        lisp::Interpreter::print(value);
+    live_bytes(interpreter);
+    return true;
+}
+
+// truncated and corrupted images are rejected instead of crashing the interpreter
+static void corrupted_images() {
+    auto path = temporary_path("image");
+    {
+        lisp::Interpreter interpreter;
+        auto result = interpreter.eval(
+            "(defun add (a b) (let ((c (+ a b))) (* c c)))"
+            "(defun-memo fib (n) (cond (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))"
+            "(setq names (quote (a b (c \"d\"))))"
+            "(setq table (assoc (hash-map) \"key\" (vector 1 2.5 (quote e))))"
+            "(setq numbers (vec 1 2 3))"
+            "(setq big 123456789012345678901234567890)");
+        EXPECT(!lisp::Interpreter::is_error(result));
+        EXPECT(!lisp::Interpreter::is_error(interpreter.dump_image(path)));
+    }
+    auto image = read_file(path);
+    EXPECT(load_image(path, image));
+
+    for(size_t size = 0; size < image.size(); size++)
+        EXPECT(!load_image(path, image.substr(0, size)));
+    for(size_t i = 0; i < image.size(); i++) {
+        for(char mask : {'\x01', '\x80', '\xff'}) {
+            auto corrupted = image;
+            corrupted[i] ^= mask;
+            load_image(path, corrupted);
+        }
+    }
+    unlink(path.c_str());
+}
+
+// a cache corrupted where the decoder can't tell is parsed again instead of being run
+static void corrupted_caches() {
+    auto source = temporary_path("cache.lisp");
+    auto cache = temporary_path("cache.lppc");
+    auto text = std::string("(setq greeting \"hello\") greeting");
+    write_file(source, text);
+    auto load = [&]() {
+        lisp::Interpreter interpreter;
+        auto program = interpreter.load(text, source.c_str(), cache);
+        return to_string(interpreter.run(program));
+    };
+
+    EXPECT(load() == "hello");
+    auto image = read_file(cache);
+    auto literal = image.find("hello");
+    EXPECT(literal != std::string::npos);
+    image[literal] = 'j';
+    write_file(cache, image);
+    EXPECT(load() == "hello");
+    // and replaced by a good one
+    EXPECT(read_file(cache).find("hello") != std::string::npos);
+
+    unlink(source.c_str());
+    unlink(cache.c_str());
+}
+
+// send `script` to the server at `path` and read its output until the worker is done
+static std::string request(const std::string& path, const std::string& script) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    // the server may still be starting up
+    for(int i = 0; i < 100 && connect(connection, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0; i++)
+        usleep(20000);
+    (void)!write(connection, script.data(), script.size());
+    shutdown(connection, SHUT_WR);
+
+    std::string output;
+    char buffer[4096];
+    ssize_t size;
+    while((size = read(connection, buffer, sizeof(buffer))) > 0)
+        output.append(buffer, size);
+    close(connection);
+    return output;
+}
+
+// a server on `path` with short limits, running in a child process until `stop_server`
+static pid_t start_server(const std::string& path) {
+    pid_t server = fork();
+    if(server == 0) {
+        freopen("/dev/null", "w", stderr);
+        lisp::Interpreter interpreter;
+        lisp::Server::Options options;
+        options.time_limit_ms = 500;
+        options.memory_limit = 64 << 20;
+        lisp::Server(interpreter, options).serve(path.c_str());
+        _exit(0);
+    }
+    return server;
+}
+
+static void stop_server(pid_t server) {
+    kill(server, SIGTERM);
+    waitpid(server, nullptr, 0);
+}
+
+// workers stopped at the time or memory limit keep what they printed before
+static void server_limits() {
+    auto path = temporary_path("socket");
+    auto server = start_server(path);
+
+    auto output = request(path, "(print \"before\") (while t nil)");
+    EXPECT(output == "before \n[Error]: time limit exceeded\n");
+    output = request(path, "(print \"before\") (make-vec 1000000000 0)");
+    EXPECT(output == "before \n[Error]: memory limit exceeded\n");
+    output = request(path, "(print \"after\")");
+    EXPECT(output == "after \n");
+
+    stop_server(server);
+}
+
+// files a script leaves open are written out when its worker exits
+static void server_ports() {
+    auto path = temporary_path("socket");
+    auto file = temporary_path("output");
+    auto server = start_server(path);
+
+    request(path, "(write (open-output \"" + file + "\") \"kept\")");
+    EXPECT(read_file(file) == "kept");
+    request(path, "(write (open-output \"" + file + "\") \"before\") (while t nil)");
+    EXPECT(read_file(file) == "before");
+
+    stop_server(server);
+    unlink(file.c_str());
+}
+
+struct Test {
+    const char* name;
+    void (*run)();
+};
+
+static const Test TESTS[] = {
+    {"streamed-literals", streamed_literals},
+    {"repeated-evals", repeated_evals},
+    {"corrupted-images", corrupted_images},
+    {"corrupted-caches", corrupted_caches},
+    {"server-limits", server_limits},
+    {"server-ports", server_ports},
+};
+
+// runs the tests named on the command line, all of them without arguments
+int main(int argc, char** argv) {
+    int failures = 0;
+    for(auto& test : TESTS) {
+        bool selected = argc == 1;
+        for(int i = 1; i < argc; i++)
+            selected |= strcmp(argv[i], test.name) == 0;
+        if(!selected)
+            continue;
+
+        failed = false;
+        test.run();
+        std::cerr << "[Test]: " << test.name << (failed ? " failed" : " ok") << std::endl;
+        failures += failed;
+    }
+    return failures ? 1 : 0;
+}